@@ -362,6 +362,60 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
 				 uint32_t buf_num,
 				 uint32_t buf_len);
 
+typedef int(*rtlsdr_read_async_zc_cb_t)(unsigned char *buf, uint32_t len, void *ctx);
+
+/*!
+ * Read samples from the device asynchronously without copying. This function
+ * will block until it is being canceled using rtlsdr_cancel_async()
+ *
+ * The callback may keep the transfer buffer it is handed by returning a
+ * non-zero value. The transfer is then resubmitted with one of the spare
+ * buffers and the kept buffer stays owned by the application until it is
+ * given back with rtlsdr_release_buffer(). If no spare is left, the transfer
+ * waits for the next release, so the application should hold at most
+ * spare_num buffers at a time. Returning 0 hands the buffer straight back.
+ *
+ * Buffers still held when this function returns stay valid until they are
+ * released or the device is closed.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param cb callback function to return received samples
+ * \param ctx user specific context to pass via the callback function
+ * \param buf_num optional transfer count, set to 0 for default count (32)
+ * \param buf_len optional buffer length, must be multiple of 512,
+ *		  set to 0 for default buffer length (16 * 32 * 512)
+ * \param spare_num optional number of extra buffers to lend out,
+ *		    set to 0 for default count (32)
+ * \return 0 on success
+ */
+RTLSDR_API int rtlsdr_read_async_zerocopy(rtlsdr_dev_t *dev,
+					  rtlsdr_read_async_zc_cb_t cb,
+					  void *ctx,
+					  uint32_t buf_num,
+					  uint32_t buf_len,
+					  uint32_t spare_num);
+
+/*!
+ * Give a buffer kept by a rtlsdr_read_async_zerocopy() callback back to the
+ * library. Safe to call from any thread, including the callback itself.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param buf buffer pointer as it was passed to the callback
+ * \return 0 on success, -1 if buf is not a lent buffer
+ */
+RTLSDR_API int rtlsdr_release_buffer(rtlsdr_dev_t *dev, unsigned char *buf);
+
+/*!
+ * Completion time of the buffer currently being delivered to an async read
+ * callback, taken as soon as libusb reported the transfer done. Only
+ * meaningful when called from inside the callback.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \param ns CLOCK_MONOTONIC time in nanoseconds
+ * \return 0 on success, -1 if not supported on this platform
+ */
+RTLSDR_API int rtlsdr_get_buffer_time(rtlsdr_dev_t *dev, uint64_t *ns);
+
 /*!
  * Cancel all pending asynchronous operations on the device.
  *
@@ -370,6 +424,16 @@ RTLSDR_API int rtlsdr_read_async(rtlsdr_dev_t *dev,
  */
 RTLSDR_API int rtlsdr_cancel_async(rtlsdr_dev_t *dev);
 
+/*!
+ * Check whether the device went away, e.g. it was unplugged or its hub was
+ * reset. An async read ends by itself when that happens, the handle can
+ * then only be closed.
+ *
+ * \param dev the device handle given by rtlsdr_open()
+ * \return 1 if the device is lost, 0 if not, -1 on error
+ */
+RTLSDR_API int rtlsdr_is_device_lost(rtlsdr_dev_t *dev);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,140 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "channelizer.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Hamming windowed sinc with the cutoff at the output Nyquist frequency and
+ * unity DC gain. Its ~-53 dB sidelobes are below what an 8 bit ADC can
+ * resolve anyway. The edges of the output band alias, keep the windows in
+ * the middle part of the channel.
+ */
+static void design_low_pass(fft_real *taps, unsigned int n, unsigned int decim)
+{
+	double fc = 0.5 / decim;
+	double sum = 0, t, h;
+	unsigned int k;
+
+	for (k = 0; k < n; k++) {
+		t = k - (n - 1) / 2.0;
+		h = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+		h *= 0.54 - 0.46 * cos(2 * M_PI * k / (n - 1));
+		/* stored time reversed, so the dot product walks forward */
+		taps[n - 1 - k] = (fft_real)h;
+		sum += h;
+	}
+
+	for (k = 0; k < n; k++)
+		taps[k] = (fft_real)(taps[k] / sum);
+}
+
+int channelizer_init(struct channelizer *ch, unsigned int decim,
+		     unsigned int taps_per_phase, double offset,
+		     unsigned long max_in)
+{
+	memset(ch, 0, sizeof(*ch));
+
+	if (decim < 2 || !taps_per_phase || !max_in || fabs(offset) > 0.5)
+		return -1;
+
+	ch->decim = decim;
+	ch->n_taps = decim * taps_per_phase;
+	ch->max_in = max_in;
+
+	ch->taps = FFTW(malloc)(sizeof(fft_real) * ch->n_taps);
+	/* unconsumed tail (< n_taps) plus one block */
+	ch->line = FFTW(malloc)(sizeof(fft_complex) * (ch->n_taps + max_in));
+	if (!ch->taps || !ch->line) {
+		channelizer_free(ch);
+		return -1;
+	}
+
+	design_low_pass(ch->taps, ch->n_taps, decim);
+
+	/* mixing with exp(-j 2 pi offset n) moves the channel to 0 Hz */
+	ch->nco_re = 1.0;
+	ch->nco_im = 0.0;
+	ch->rot_re = cos(2 * M_PI * offset);
+	ch->rot_im = -sin(2 * M_PI * offset);
+
+	return 0;
+}
+
+void channelizer_free(struct channelizer *ch)
+{
+	if (ch->taps)
+		FFTW(free)(ch->taps);
+	if (ch->line)
+		FFTW(free)(ch->line);
+	memset(ch, 0, sizeof(*ch));
+}
+
+unsigned long channelizer_run(struct channelizer *ch, const fft_complex *in,
+			      unsigned long n, fft_complex *out)
+{
+	fft_complex *line = ch->line + ch->line_len;
+	const fft_real *taps = ch->taps;
+	double nr = ch->nco_re, ni = ch->nco_im, t, mag;
+	unsigned long i, pos, n_out = 0;
+	unsigned int k;
+	fft_real sr, si;
+
+	if (n > ch->max_in)
+		n = ch->max_in;
+
+	/* downconvert onto the end of the delay line */
+	for (i = 0; i < n; i++) {
+		line[i][0] = (fft_real)(in[i][0] * nr - in[i][1] * ni);
+		line[i][1] = (fft_real)(in[i][0] * ni + in[i][1] * nr);
+		t = nr * ch->rot_re - ni * ch->rot_im;
+		ni = nr * ch->rot_im + ni * ch->rot_re;
+		nr = t;
+	}
+	ch->line_len += n;
+
+	/* keep the oscillator on the unit circle */
+	mag = sqrt(nr * nr + ni * ni);
+	ch->nco_re = nr / mag;
+	ch->nco_im = ni / mag;
+
+	/* filter, only at the samples that survive decimation */
+	line = ch->line;
+	for (pos = 0; pos + ch->n_taps <= ch->line_len; pos += ch->decim) {
+		sr = 0;
+		si = 0;
+		for (k = 0; k < ch->n_taps; k++) {
+			sr += taps[k] * line[pos + k][0];
+			si += taps[k] * line[pos + k][1];
+		}
+		out[n_out][0] = sr;
+		out[n_out][1] = si;
+		n_out++;
+	}
+
+	/* the next output starts at pos, keep from there on */
+	memmove(line, line + pos, sizeof(fft_complex) * (ch->line_len - pos));
+	ch->line_len -= pos;
+
+	return n_out;
+}
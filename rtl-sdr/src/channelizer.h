@@ -0,0 +1,75 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CHANNELIZER_H
+#define __CHANNELIZER_H
+
+#include "fft_types.h"
+
+/*
+ * Single channel digital downconverter: mix the band of interest down to
+ * 0 Hz, low pass it and keep every decim'th sample. The filter is only
+ * evaluated at the samples that are kept (the polyphase form of the
+ * decimator), so it costs taps_per_phase complex MACs per input sample.
+ *
+ * The FFT behind it then covers rate / decim instead of the full span, for
+ * the same bin width it is decim times shorter.
+ */
+struct channelizer {
+	unsigned int decim;
+	unsigned int n_taps;		/* decim * taps_per_phase */
+	unsigned long max_in;		/* most input samples per run */
+	fft_real *taps;			/* low pass prototype, time reversed */
+
+	/* mixed samples not consumed by the filter yet */
+	fft_complex *line;
+	unsigned long line_len;
+
+	/* oscillator, advanced by one rotation per input sample */
+	double nco_re;
+	double nco_im;
+	double rot_re;
+	double rot_im;
+};
+
+/*!
+ * Design the filter and allocate the delay line.
+ *
+ * \param decim decimation factor, at least 2
+ * \param taps_per_phase filter length per polyphase branch
+ * \param offset center of the channel relative to the input center, in
+ *		 cycles per input sample (-0.5 to 0.5)
+ * \param max_in largest block that will be passed to channelizer_run()
+ * \return 0 on success, -1 on bad parameters or allocation failure
+ */
+int channelizer_init(struct channelizer *ch, unsigned int decim,
+		     unsigned int taps_per_phase, double offset,
+		     unsigned long max_in);
+
+void channelizer_free(struct channelizer *ch);
+
+/*!
+ * Downconvert and decimate a block of complex samples.
+ *
+ * \param n number of input samples, at most max_in
+ * \param out room for n / decim + 1 samples
+ * \return number of samples written to out
+ */
+unsigned long channelizer_run(struct channelizer *ch, const fft_complex *in,
+			      unsigned long n, fft_complex *out);
+
+#endif /* __CHANNELIZER_H */
@@ -0,0 +1,90 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "detector.h"
+
+int detector_arena_init(struct detector_arena *a, size_t size)
+{
+	void *base;
+
+	memset(a, 0, sizeof(*a));
+
+	size = DETECTOR_ALIGN_UP(size);
+	if (posix_memalign(&base, DETECTOR_ALIGN, size))
+		return -1;
+
+	memset(base, 0, size);
+	a->base = base;
+	a->size = size;
+
+	return 0;
+}
+
+void *detector_arena_alloc(struct detector_arena *a, size_t size)
+{
+	void *ptr;
+
+	size = DETECTOR_ALIGN_UP(size);
+	if (a->used + size > a->size)
+		return NULL;
+
+	ptr = a->base + a->used;
+	a->used += size;
+
+	return ptr;
+}
+
+void detector_arena_free(struct detector_arena *a)
+{
+	free(a->base);
+	memset(a, 0, sizeof(*a));
+}
+
+int ducky_detector_init(struct ducky_detector *det,
+			const struct detector_config *cfg)
+{
+	size_t size;
+
+	memset(det, 0, sizeof(*det));
+	det->n_points = cfg->n_points;
+	det->rules = cfg->rules;
+
+	size = power_spectrum_size(cfg->n_points, cfg->average, cfg->depth) +
+	       rule_engine_size(cfg->rules, &cfg->floor, MAX_BINS_FOR_MEDIAN);
+
+	if (detector_arena_init(&det->arena, size) < 0)
+		return -1;
+
+	if (power_spectrum_init(&det->spec, &det->arena, cfg->n_points,
+				cfg->average, cfg->depth) < 0 ||
+	    rule_engine_init(cfg->rules, &det->arena, &cfg->floor,
+			     cfg->n_points, MAX_BINS_FOR_MEDIAN) < 0) {
+		ducky_detector_free(det);
+		return -1;
+	}
+
+	return 0;
+}
+
+void ducky_detector_free(struct ducky_detector *det)
+{
+	detector_arena_free(&det->arena);
+	memset(det, 0, sizeof(*det));
+}
@@ -0,0 +1,82 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DETECTOR_H
+#define __DETECTOR_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "fft_types.h"
+#include "power_spectrum.h"
+#include "noise_floor.h"
+#include "rules.h"
+
+#define MAX_BINS_FOR_MEDIAN 100
+
+/* every arena allocation starts on its own cache line */
+#define DETECTOR_ALIGN		64
+#define DETECTOR_ALIGN_UP(x) \
+	(((x) + DETECTOR_ALIGN - 1) & ~(size_t)(DETECTOR_ALIGN - 1))
+
+/*
+ * One contiguous block carved into aligned per-bin arrays. Everything is
+ * sized once from the FFT length, so nothing large lives on a thread stack
+ * and the FFT size is only bounded by memory.
+ */
+struct detector_arena {
+	unsigned char *base;
+	size_t size;
+	size_t used;
+};
+
+int detector_arena_init(struct detector_arena *a, size_t size);
+void *detector_arena_alloc(struct detector_arena *a, size_t size);
+void detector_arena_free(struct detector_arena *a);
+
+/* Layout of the detector, fixed for the lifetime of the process */
+struct detector_config {
+	unsigned long n_points;
+	enum spectrum_average average;
+	unsigned int depth;		/* frames of Welch averaging */
+
+	struct noise_floor_config floor;
+	struct rule_engine *rules;	/* laid out for n_points already */
+};
+
+/* Everything the detector stage keeps between frames */
+struct ducky_detector {
+	unsigned long n_points;
+
+	struct detector_arena arena;
+	struct power_spectrum spec;	/* spec.power is what gets detected on */
+	struct rule_engine *rules;	/* estimators live in the arena */
+
+	double max_value_difference_old;
+};
+
+/*!
+ * Size the arena for the configured layout and set up the power spectrum
+ * and the noise floor of every rule.
+ *
+ * \return 0 on success, -1 on allocation failure
+ */
+int ducky_detector_init(struct ducky_detector *det,
+			const struct detector_config *cfg);
+void ducky_detector_free(struct ducky_detector *det);
+
+#endif /* __DETECTOR_H */
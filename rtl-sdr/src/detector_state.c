@@ -0,0 +1,462 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "detector_state.h"
+#include "fft_pipeline.h"
+
+#define STATE_RULES(hdr) \
+	((const struct detector_state_rule *)((const unsigned char *)(hdr) + \
+					      sizeof(struct detector_state_header)))
+#define STATE_FLOORS(hdr) \
+	((const struct detector_state_floor *)(STATE_RULES(hdr) + (hdr)->n_rules))
+#define STATE_ARENA(hdr) \
+	((const unsigned char *)(STATE_FLOORS(hdr) + (hdr)->n_rules + 1))
+
+static size_t state_size(uint32_t n_rules, uint64_t arena_size)
+{
+	return sizeof(struct detector_state_header) +
+	       n_rules * sizeof(struct detector_state_rule) +
+	       (n_rules + 1) * sizeof(struct detector_state_floor) +
+	       arena_size;
+}
+
+static uint64_t wall_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int detector_state_open(struct detector_state *st, const char *path)
+{
+	const struct detector_state_header *hdr;
+	struct stat sb;
+	size_t size;
+
+	st->map = NULL;
+	st->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (st->fd < 0) {
+		if (errno != ENOENT)
+			fprintf(stderr, "Could not open state file %s: %s\n",
+				path, strerror(errno));
+		return -1;
+	}
+
+	if (fstat(st->fd, &sb) < 0 ||
+	    (size_t)sb.st_size < sizeof(struct detector_state_header)) {
+		fprintf(stderr, "%s is not a detector state file\n", path);
+		goto err;
+	}
+
+	st->map_size = (size_t)sb.st_size;
+	st->map = mmap(NULL, st->map_size, PROT_READ, MAP_PRIVATE, st->fd, 0);
+	if (st->map == MAP_FAILED) {
+		st->map = NULL;
+		fprintf(stderr, "Could not map state file %s: %s\n", path,
+			strerror(errno));
+		goto err;
+	}
+
+	hdr = st->map;
+	if (memcmp(hdr->magic, DETECTOR_STATE_MAGIC,
+		   sizeof(DETECTOR_STATE_MAGIC)) ||
+	    hdr->byte_order != DETECTOR_STATE_BYTE_ORDER) {
+		fprintf(stderr, "%s is not a detector state file\n", path);
+		goto err;
+	}
+	if (hdr->version != DETECTOR_STATE_VERSION ||
+	    hdr->real_size != sizeof(fft_real)) {
+		fprintf(stderr, "%s is from another version or build (version %u, "
+			"%u byte samples)\n", path, hdr->version, hdr->real_size);
+		goto err;
+	}
+
+	size = state_size(hdr->n_rules, hdr->arena_size);
+	if (hdr->n_rules > RULE_MAX || size + hdr->wisdom_size != st->map_size ||
+	    (hdr->wisdom_size &&
+	     ((const char *)st->map)[st->map_size - 1] != '\0')) {
+		fprintf(stderr, "State file %s is truncated or corrupt\n", path);
+		goto err;
+	}
+
+	return 0;
+err:
+	detector_state_close(st);
+	return -1;
+}
+
+const char *detector_state_wisdom(const struct detector_state *st)
+{
+	const struct detector_state_header *hdr = st->map;
+
+	if (!hdr->wisdom_size)
+		return NULL;
+	return (const char *)st->map + state_size(hdr->n_rules, hdr->arena_size);
+}
+
+double detector_state_age(const struct detector_state *st)
+{
+	const struct detector_state_header *hdr = st->map;
+	uint64_t now = wall_now();
+
+	return now > hdr->saved ? (now - hdr->saved) / 1e9 : 0;
+}
+
+static void fill_rule(struct detector_state_rule *r,
+		      const struct detection_rule *rule)
+{
+	memset(r, 0, sizeof(*r));
+	r->lo = rule->lo;
+	r->hi = rule->hi;
+	r->ref_lo_bin = rule->ref_lo_bin;
+	r->ref_hi_bin = rule->ref_hi_bin;
+	r->win_lo = rule->floor.win_lo;
+	r->win_hi = rule->floor.win_hi;
+	r->n_buckets = rule->floor.n_buckets;
+}
+
+/* the header as det would write it, for saving and for comparing */
+static void fill_header(struct detector_state_header *hdr,
+			const struct ducky_detector *det)
+{
+	const struct rule_engine *eng = det->rules;
+	const struct power_spectrum *ps = &det->spec;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, DETECTOR_STATE_MAGIC, sizeof(DETECTOR_STATE_MAGIC));
+	hdr->version = DETECTOR_STATE_VERSION;
+	hdr->byte_order = DETECTOR_STATE_BYTE_ORDER;
+	hdr->real_size = sizeof(fft_real);
+	hdr->n_rules = eng->n_rules;
+
+	hdr->n_points = det->n_points;
+	hdr->average = ps->average;
+	hdr->depth = ps->depth;
+	hdr->floor_method = eng->floor_cfg.method;
+	hdr->ema_alpha = eng->floor_cfg.ema_alpha;
+	hdr->median_frames = eng->floor_cfg.median_frames;
+	hdr->cfar_train = eng->floor_cfg.cfar_train;
+	hdr->cfar_guard = eng->floor_cfg.cfar_guard;
+
+	hdr->lower_bound = eng->lower_bound;
+	hdr->span = eng->span;
+
+	hdr->spec_slot = ps->slot;
+	hdr->spec_swapped = ps->sum > ps->lap;
+
+	hdr->arena_size = det->arena.size;
+}
+
+int detector_state_restore(const struct detector_state *st,
+			   struct ducky_detector *det)
+{
+	const struct detector_state_header *hdr = st->map;
+	const struct detector_state_floor *floors = STATE_FLOORS(hdr);
+	struct detector_state_header want;
+	struct detector_state_rule r;
+	struct rule_engine *eng = det->rules;
+	struct power_spectrum *ps = &det->spec;
+	struct noise_floor *nf;
+	fft_real *swap;
+	unsigned int k;
+
+	/* everything but the state itself has to match */
+	fill_header(&want, det);
+	if (hdr->n_points != want.n_points || hdr->average != want.average ||
+	    hdr->depth != want.depth) {
+		fprintf(stderr, "State file is for a %llu point FFT with other "
+			"averaging, starting cold\n",
+			(unsigned long long)hdr->n_points);
+		return -1;
+	}
+	if (hdr->floor_method != want.floor_method ||
+	    hdr->ema_alpha != want.ema_alpha ||
+	    hdr->median_frames != want.median_frames ||
+	    hdr->cfar_train != want.cfar_train ||
+	    hdr->cfar_guard != want.cfar_guard) {
+		fprintf(stderr, "State file is for another noise floor "
+			"estimator, starting cold\n");
+		return -1;
+	}
+	if (hdr->lower_bound != want.lower_bound || hdr->span != want.span ||
+	    hdr->n_rules != want.n_rules || hdr->arena_size != want.arena_size) {
+		fprintf(stderr, "State file is for other tuning or rules, "
+			"starting cold\n");
+		return -1;
+	}
+	for (k = 0; k < eng->n_rules; k++) {
+		fill_rule(&r, &eng->rules[k]);
+		if (memcmp(&r, &STATE_RULES(hdr)[k], sizeof(r))) {
+			fprintf(stderr, "State file has other bins for rule %s, "
+				"starting cold\n", eng->rules[k].name);
+			return -1;
+		}
+	}
+
+	memcpy(det->arena.base, STATE_ARENA(hdr), det->arena.size);
+
+	ps->slot = hdr->spec_slot < ps->depth ? hdr->spec_slot : 0;
+	if (ps->sum && (ps->sum > ps->lap) != !!hdr->spec_swapped) {
+		swap = ps->sum;
+		ps->sum = ps->lap;
+		ps->lap = swap;
+	}
+
+	for (k = 0; k <= eng->n_rules; k++) {
+		nf = k < eng->n_rules ? &eng->rules[k].floor : &eng->cfar;
+		nf->frames = floors[k].frames;
+		nf->floor = floors[k].floor;
+		nf->med_fill = floors[k].med_fill;
+		nf->med_pos = floors[k].med_pos;
+	}
+
+	return 0;
+}
+
+void detector_state_close(struct detector_state *st)
+{
+	if (st->map)
+		munmap(st->map, st->map_size);
+	if (st->fd >= 0)
+		close(st->fd);
+	st->map = NULL;
+	st->map_size = 0;
+	st->fd = -1;
+}
+
+int detector_state_init(struct detector_state *st,
+			const struct ducky_detector *det)
+{
+	st->image_size = state_size(det->rules->n_rules, det->arena.size);
+	st->image = malloc(st->image_size);
+	if (!st->image) {
+		fprintf(stderr, "Failed to allocate %zu bytes of detector state\n",
+			st->image_size);
+		return -1;
+	}
+	memset(st->image, 0, st->image_size);
+
+	return 0;
+}
+
+void detector_state_capture(struct detector_state *st,
+			    const struct ducky_detector *det)
+{
+	struct detector_state_header *hdr = (void *)st->image;
+	struct detector_state_rule *rules = (void *)(hdr + 1);
+	struct detector_state_floor *floors;
+	const struct rule_engine *eng = det->rules;
+	const struct noise_floor *nf;
+	unsigned int k;
+
+	fill_header(hdr, det);
+	hdr->saved = wall_now();
+
+	for (k = 0; k < eng->n_rules; k++)
+		fill_rule(&rules[k], &eng->rules[k]);
+
+	floors = (void *)(rules + eng->n_rules);
+	for (k = 0; k <= eng->n_rules; k++) {
+		nf = k < eng->n_rules ? &eng->rules[k].floor : &eng->cfar;
+		memset(&floors[k], 0, sizeof(floors[k]));
+		floors[k].frames = nf->frames;
+		floors[k].floor = nf->floor;
+		floors[k].med_fill = nf->med_fill;
+		floors[k].med_pos = nf->med_pos;
+	}
+
+	memcpy(floors + eng->n_rules + 1, det->arena.base, det->arena.size);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+int detector_state_write(struct detector_state *st, const char *path)
+{
+	struct detector_state_header *hdr = (void *)st->image;
+	char *tmp, *wisdom;
+	int fd, r = -1;
+
+	if (!hdr->saved)
+		return -1;
+
+	tmp = malloc(strlen(path) + 5);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", path);
+
+	wisdom = fft_wisdom_export();
+	hdr->wisdom_size = wisdom ? strlen(wisdom) + 1 : 0;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Could not write state file %s: %s\n", tmp,
+			strerror(errno));
+		goto out;
+	}
+
+	if (write_all(fd, st->image, st->image_size) < 0 ||
+	    (wisdom && write_all(fd, wisdom, hdr->wisdom_size) < 0) ||
+	    fdatasync(fd) < 0) {
+		fprintf(stderr, "Could not write state file %s: %s\n", tmp,
+			strerror(errno));
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+
+	if (rename(tmp, path) < 0) {
+		fprintf(stderr, "Could not replace state file %s: %s\n", path,
+			strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	r = 0;
+out:
+	fft_wisdom_free(wisdom);
+	free(tmp);
+	return r;
+}
+
+static void *detector_state_fn(void *arg)
+{
+	struct detector_state *st = arg;
+
+	pthread_mutex_lock(&st->lock);
+	for (;;) {
+		while (!st->stop && __atomic_load_n(&st->capture, __ATOMIC_ACQUIRE) !=
+		       DETECTOR_STATE_CAPTURED)
+			pthread_cond_wait(&st->cond, &st->lock);
+		if (__atomic_load_n(&st->capture, __ATOMIC_ACQUIRE) !=
+		    DETECTOR_STATE_CAPTURED)
+			break;
+		pthread_mutex_unlock(&st->lock);
+
+		detector_state_write(st, st->path);
+
+		pthread_mutex_lock(&st->lock);
+		__atomic_store_n(&st->capture, DETECTOR_STATE_IDLE,
+				 __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&st->lock);
+
+	return NULL;
+}
+
+int detector_state_start(struct detector_state *st, const char *path)
+{
+	st->path = strdup(path);
+	if (!st->path)
+		return -1;
+
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+	st->capture = DETECTOR_STATE_IDLE;
+	st->stop = 0;
+
+	st->started = 1;
+	if (pthread_create(&st->thread, NULL, detector_state_fn, st)) {
+		st->started = 0;
+		pthread_cond_destroy(&st->cond);
+		pthread_mutex_destroy(&st->lock);
+		free(st->path);
+		st->path = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void detector_state_request(struct detector_state *st)
+{
+	int idle = DETECTOR_STATE_IDLE;
+
+	__atomic_compare_exchange_n(&st->capture, &idle,
+				    DETECTOR_STATE_REQUESTED, 0,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+void detector_state_poll(struct detector_state *st,
+			 const struct ducky_detector *det)
+{
+	if (__atomic_load_n(&st->capture, __ATOMIC_ACQUIRE) !=
+	    DETECTOR_STATE_REQUESTED)
+		return;
+
+	detector_state_capture(st, det);
+
+	/* once per save, the writer only sleeps in between */
+	pthread_mutex_lock(&st->lock);
+	__atomic_store_n(&st->capture, DETECTOR_STATE_CAPTURED,
+			 __ATOMIC_RELEASE);
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+}
+
+void detector_state_stop(struct detector_state *st)
+{
+	if (!st->started)
+		return;
+
+	pthread_mutex_lock(&st->lock);
+	st->stop = 1;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	pthread_join(st->thread, NULL);
+
+	pthread_cond_destroy(&st->cond);
+	pthread_mutex_destroy(&st->lock);
+	free(st->path);
+	st->path = NULL;
+	st->capture = DETECTOR_STATE_IDLE;
+	st->started = 0;
+}
+
+void detector_state_free(struct detector_state *st)
+{
+	detector_state_stop(st);
+	free(st->image);
+	st->image = NULL;
+	st->image_size = 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DETECTOR_STATE_H
+#define __DETECTOR_STATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "detector.h"
+
+/*
+ * Detector state file for a warm restart: the noise floors and averaging
+ * history pick up where the last run left them instead of settling from
+ * zero, and FFTW wisdom comes along so planning is quick.
+ *
+ * All of that history lives in the detector arena, so the file is mostly
+ * one copy of it. Arena offsets only mean the same thing for the same
+ * layout, so the file also records the configuration and the bin map of
+ * every rule, and a file for any other setup is refused. The bin maps
+ * themselves are recomputed, that takes microseconds. Rule outputs are
+ * not restored, every rule starts inactive so a signal that is still
+ * there raises a fresh event.
+ *
+ * File, host byte order, written to path.tmp and renamed over path:
+ *
+ *	struct detector_state_header
+ *	struct detector_state_rule	n_rules of them
+ *	struct detector_state_floor	n_rules + 1, the last is the shared cfar
+ *	arena				arena_size bytes
+ *	wisdom				wisdom_size bytes, NUL terminated
+ *
+ * Loading maps the file and copies the arena out of the mapping, the live
+ * arena stays private so the next save can replace the file.
+ *
+ * Saving is split so the detector thread only pays for a memcpy:
+ * detector_state_capture() copies the state into an image between frames,
+ * detector_state_write() puts it on disk from any other thread. For saves
+ * while running, detector_state_start() runs the writes on a thread of
+ * their own: any thread asks with detector_state_request(), the detector
+ * captures in detector_state_poll() and the writer takes it from there, so
+ * a slow card never holds up a thread that moves samples.
+ */
+
+#define DETECTOR_STATE_MAGIC		"DUCKYST"
+#define DETECTOR_STATE_VERSION		2
+#define DETECTOR_STATE_BYTE_ORDER	0x01020304u
+
+struct detector_state_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t real_size;		/* sizeof(fft_real) */
+	uint32_t n_rules;
+
+	/* struct detector_config */
+	uint64_t n_points;
+	uint32_t average;
+	uint32_t depth;
+	uint32_t floor_method;
+	uint32_t median_frames;
+	double ema_alpha;
+	uint32_t cfar_train;
+	uint32_t cfar_guard;
+
+	/* rule_engine_layout() */
+	uint32_t lower_bound;
+	uint32_t span;
+
+	/* power spectrum, the Welch sums trade places every lap */
+	uint32_t spec_slot;
+	uint32_t spec_swapped;
+
+	uint64_t arena_size;
+	uint64_t wisdom_size;
+	uint64_t saved;			/* CLOCK_REALTIME ns */
+};
+
+struct detector_state_rule {
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t ref_lo_bin;
+	uint64_t ref_hi_bin;
+	uint64_t win_lo;
+	uint64_t win_hi;
+	uint32_t n_buckets;
+	uint32_t pad;
+};
+
+struct detector_state_floor {
+	uint64_t frames;
+	double floor;
+	uint32_t med_fill;
+	uint32_t med_pos;
+};
+
+struct detector_state {
+	/* loaded file */
+	int fd;
+	void *map;
+	size_t map_size;
+
+	/* capture image, everything but the wisdom */
+	unsigned char *image;
+	size_t image_size;
+
+	/* background saves */
+	char *path;
+	int capture;			/* enum detector_state_capture, atomic */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	int stop;
+};
+
+enum detector_state_capture {
+	DETECTOR_STATE_IDLE = 0,
+	DETECTOR_STATE_REQUESTED,	/* the detector copies between two frames */
+	DETECTOR_STATE_CAPTURED		/* the writer puts it on disk */
+};
+
+/*!
+ * Map a state file and check its header.
+ *
+ * \return 0 on success, -1 if it is missing or not a state file of this
+ *	   version and build (the reason is printed unless it is missing)
+ */
+int detector_state_open(struct detector_state *st, const char *path);
+
+/* FFTW wisdom of an open state file, NULL if it has none */
+const char *detector_state_wisdom(const struct detector_state *st);
+
+/*!
+ * Resume from an open state file, after ducky_detector_init() with the
+ * rules laid out.
+ *
+ * \return 0 on success, -1 if the file is for a different setup (the
+ *	   reason is printed), the detector is left as it was
+ */
+int detector_state_restore(const struct detector_state *st,
+			   struct ducky_detector *det);
+
+/* seconds since an open state file was saved */
+double detector_state_age(const struct detector_state *st);
+
+/* unmap, the restored detector does not depend on the file */
+void detector_state_close(struct detector_state *st);
+
+/*!
+ * Allocate the capture image for det.
+ *
+ * \return 0 on success, -1 on allocation failure
+ */
+int detector_state_init(struct detector_state *st,
+			const struct ducky_detector *det);
+
+/* copy the state of det into the image, on the detector thread */
+void detector_state_capture(struct detector_state *st,
+			    const struct ducky_detector *det);
+
+/*!
+ * Write the last capture and the current FFTW wisdom, atomically replacing
+ * path.
+ *
+ * \return 0 on success, -1 on failure (the reason is printed)
+ */
+int detector_state_write(struct detector_state *st, const char *path);
+
+/*!
+ * Start the writer thread, after detector_state_init().
+ *
+ * \return 0 on success, -1 if the thread could not be started
+ */
+int detector_state_start(struct detector_state *st, const char *path);
+
+/* ask for a save, ignored while the last one is still under way */
+void detector_state_request(struct detector_state *st);
+
+/* capture if a save was asked for, on the detector thread between frames */
+void detector_state_poll(struct detector_state *st,
+			 const struct ducky_detector *det);
+
+/* join the writer, a save under way is finished first */
+void detector_state_stop(struct detector_state *st);
+
+void detector_state_free(struct detector_state *st);
+
+#endif /* __DETECTOR_STATE_H */
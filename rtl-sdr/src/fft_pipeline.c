@@ -0,0 +1,514 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "fft_pipeline.h"
+#include "iq_convert.h"
+#include "latency.h"
+
+#define JOB(p, seq)	(&(p)->jobs[(seq) % (p)->n_jobs])
+
+/* u8 IQ straight into fft_complex, viewed as 2 * n fft_reals */
+#ifdef USE_FFTWF
+#define iq_u8_to_fft	iq_u8_to_f32
+#define iq_u8_to_fft_win	iq_u8_to_f32_win
+#else
+#define iq_u8_to_fft	iq_u8_to_f64
+#define iq_u8_to_fft_win	iq_u8_to_f64_win
+#endif
+
+/* dst = src * win, the channelizer output counterpart of iq_u8_to_fft_win */
+static void fft_window_copy(fft_complex *dst, const fft_complex *src,
+			    unsigned long n, const fft_real *win)
+{
+	fft_real *d = (fft_real *)dst;
+	const fft_real *s = (const fft_real *)src;
+	unsigned long i;
+
+	for (i = 0; i < 2 * n; i++)
+		d[i] = s[i] * win[i];
+}
+
+static void *fft_worker_fn(void *arg)
+{
+	struct fft_worker *w = arg;
+	struct fft_pipeline *p = w->p;
+	struct fft_job *job;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stop) {
+		job = JOB(p, p->fft_seq);
+		if (job->state != FFT_JOB_FILLED || job->seq != p->fft_seq) {
+			pthread_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+
+		job->state = FFT_JOB_RUNNING;
+		p->fft_seq++;
+		pthread_mutex_unlock(&p->lock);
+
+		job->t_fft_start = lat_now();
+		FFTW(execute_dft)(w->plan, job->in, job->out);
+		job->t_fft_end = lat_now();
+
+		pthread_mutex_lock(&p->lock);
+		job->state = FFT_JOB_DONE;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+static void *fft_detector_fn(void *arg)
+{
+	struct fft_pipeline *p = arg;
+	struct fft_job *job;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stop) {
+		job = JOB(p, p->detect_seq);
+		if (job->state != FFT_JOB_DONE || job->seq != p->detect_seq) {
+			pthread_cond_wait(&p->cond, &p->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&p->lock);
+
+		p->detect_cb(p->cb_ctx, job);
+
+		pthread_mutex_lock(&p->lock);
+		job->state = FFT_JOB_FREE;
+		p->detect_seq++;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+int fft_pipeline_init(struct fft_pipeline *p, unsigned long n_points,
+		      unsigned int overlap_pct, unsigned int n_workers,
+		      unsigned int plan_flags, fft_pipeline_detect_cb_t detect_cb,
+		      void *cb_ctx)
+{
+	unsigned int i;
+
+	memset(p, 0, sizeof(*p));
+
+	if (!n_points || !n_workers || overlap_pct > 90)
+		return -1;
+
+	p->n_points = n_points;
+	p->hop = n_points - (unsigned long)
+		 (((unsigned long long)n_points * overlap_pct) / 100);
+	p->n_workers = n_workers;
+	/* one frame filling, one being detected, up to two per worker */
+	p->n_jobs = 2 * n_workers + 2;
+	p->detect_cb = detect_cb;
+	p->cb_ctx = cb_ctx;
+
+	p->jobs = calloc(p->n_jobs, sizeof(struct fft_job));
+	p->workers = calloc(n_workers, sizeof(struct fft_worker));
+	if (!p->jobs || !p->workers)
+		goto err;
+
+	for (i = 0; i < p->n_jobs; i++) {
+		p->jobs[i].in = FFTW(malloc)(sizeof(fft_complex) * n_points);
+		p->jobs[i].out = FFTW(malloc)(sizeof(fft_complex) * n_points);
+		if (!p->jobs[i].in || !p->jobs[i].out)
+			goto err;
+		/* fault the pages in now, not on the first frames */
+		memset(p->jobs[i].in, 0, sizeof(fft_complex) * n_points);
+		memset(p->jobs[i].out, 0, sizeof(fft_complex) * n_points);
+	}
+
+	if (p->hop < n_points) {
+		p->overlap = FFTW(malloc)(sizeof(fft_complex) * (n_points - p->hop));
+		if (!p->overlap)
+			goto err;
+	}
+
+	/*
+	 * The planner is not thread safe, so every plan is made here. All job
+	 * buffers come from FFTW(malloc) and share the alignment of the first
+	 * one, which lets the workers run their plan on any job with
+	 * FFTW(execute_dft)(). Planning clobbers the arrays, they are not in use
+	 * yet.
+	 */
+	for (i = 0; i < n_workers; i++) {
+		p->workers[i].p = p;
+		p->workers[i].plan = FFTW(plan_dft_1d)(n_points, p->jobs[0].in,
+						      p->jobs[0].out,
+						      FFTW_FORWARD, plan_flags);
+		if (!p->workers[i].plan)
+			goto err;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->cond, NULL);
+
+	for (i = 0; i < n_workers; i++) {
+		if (pthread_create(&p->workers[i].thread, NULL, fft_worker_fn,
+				   &p->workers[i]))
+			goto err_threads;
+	}
+	if (pthread_create(&p->detector, NULL, fft_detector_fn, p))
+		goto err_threads;
+	p->started = 1;
+
+	return 0;
+
+	/* the workers that did start are waiting for jobs, stop them */
+err_threads:
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	while (i--)
+		pthread_join(p->workers[i].thread, NULL);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->cond);
+err:
+	fft_pipeline_free(p);
+	return -1;
+}
+
+/* wait for the job of fill_seq to come back from the detector */
+static struct fft_job *fft_pipeline_acquire(struct fft_pipeline *p)
+{
+	struct fft_job *job = JOB(p, p->fill_seq);
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stop && job->state != FFT_JOB_FREE)
+		pthread_cond_wait(&p->cond, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->stop)
+		return NULL;
+
+	job->seq = p->fill_seq;
+	job->t_fill_start = lat_now();
+
+	p->fill_pos = 0;
+	if (p->have_overlap) {
+		p->fill_pos = p->n_points - p->hop;
+		if (p->raw)
+			iq_u8_to_fft_win((fft_real *)job->in, p->raw,
+					 2 * p->fill_pos, 128, p->window);
+		else if (p->chan_frame)
+			fft_window_copy(job->in, p->chan_frame, p->fill_pos,
+					p->window);
+		else
+			memcpy(job->in, p->overlap,
+			       sizeof(fft_complex) * p->fill_pos);
+	}
+
+	return job;
+}
+
+static void fft_pipeline_publish(struct fft_pipeline *p, struct fft_job *job)
+{
+	job->t_fill_end = lat_now();
+	job->t_usb = p->stamp;
+	job->end_sample = p->in_samples;
+
+	if (p->raw) {
+		memmove(p->raw, p->raw + 2 * p->hop, 2 * (p->n_points - p->hop));
+		p->have_overlap = 1;
+	} else if (p->chan_frame) {
+		memmove(p->chan_frame, p->chan_frame + p->hop,
+			sizeof(fft_complex) * (p->n_points - p->hop));
+		p->have_overlap = 1;
+	} else if (p->overlap) {
+		memcpy(p->overlap, job->in + p->hop,
+		       sizeof(fft_complex) * (p->n_points - p->hop));
+		p->have_overlap = 1;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	job->state = FFT_JOB_FILLED;
+	p->fill_seq++;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+}
+
+/* append already converted samples to the frames */
+static int fft_pipeline_fill(struct fft_pipeline *p, const fft_complex *src,
+			     unsigned long len)
+{
+	unsigned long n;
+
+	while (len) {
+		if (!p->filling) {
+			p->filling = fft_pipeline_acquire(p);
+			if (!p->filling)
+				return -1;
+		}
+
+		n = p->n_points - p->fill_pos;
+		if (n > len)
+			n = len;
+
+		if (p->window) {
+			fft_window_copy(p->filling->in + p->fill_pos, src, n,
+					p->window + 2 * p->fill_pos);
+			if (p->chan_frame)
+				memcpy(p->chan_frame + p->fill_pos, src,
+				       sizeof(fft_complex) * n);
+		} else {
+			memcpy(p->filling->in + p->fill_pos, src,
+			       sizeof(fft_complex) * n);
+		}
+
+		src += n;
+		len -= n;
+		p->fill_pos += n;
+		p->in_samples += n * p->chan->decim;
+
+		if (p->fill_pos == p->n_points) {
+			fft_pipeline_publish(p, p->filling);
+			p->filling = NULL;
+		}
+	}
+
+	return 0;
+}
+
+/* converter stage in channelizer mode, the frames get the decimated output */
+static int fft_pipeline_push_channel(struct fft_pipeline *p,
+				     const unsigned char *buf, uint32_t len)
+{
+	unsigned long n, n_out;
+
+	while (len) {
+		n = len / 2;
+		if (n > p->chan->max_in)
+			n = p->chan->max_in;
+
+		iq_u8_to_fft((fft_real *)p->chan_in, buf, 2 * n, 128);
+		n_out = channelizer_run(p->chan, p->chan_in, n, p->chan_out);
+		if (fft_pipeline_fill(p, p->chan_out, n_out) < 0)
+			return -1;
+
+		buf += 2 * n;
+		len -= 2 * n;
+	}
+
+	return 0;
+}
+
+int fft_pipeline_set_channelizer(struct fft_pipeline *p,
+				 struct channelizer *chan)
+{
+	p->chan_in = FFTW(malloc)(sizeof(fft_complex) * chan->max_in);
+	p->chan_out = FFTW(malloc)(sizeof(fft_complex) *
+				   (chan->max_in / chan->decim + 1));
+	if (!p->chan_in || !p->chan_out)
+		return -1;
+
+	p->chan = chan;
+
+	return 0;
+}
+
+int fft_pipeline_set_window(struct fft_pipeline *p, window_fn_t fn)
+{
+	unsigned long i;
+	double sum = 0;
+
+	if (fn == rectangle)
+		return 0;
+
+	p->window = FFTW(malloc)(sizeof(fft_real) * 2 * p->n_points);
+	if (!p->window)
+		return -1;
+
+	for (i = 0; i < p->n_points; i++)
+		sum += fn((int)i, (int)p->n_points);
+	for (i = 0; i < p->n_points; i++)
+		p->window[2 * i] = p->window[2 * i + 1] = (fft_real)
+			(fn((int)i, (int)p->n_points) * p->n_points / sum);
+
+	if (p->hop < p->n_points) {
+		if (p->chan)
+			p->chan_frame = FFTW(malloc)(sizeof(fft_complex) *
+						     p->n_points);
+		else
+			p->raw = malloc(2 * p->n_points);
+		if (!p->chan_frame && !p->raw)
+			return -1;
+	}
+
+	return 0;
+}
+
+int fft_pipeline_push(struct fft_pipeline *p, const unsigned char *buf,
+		      uint32_t len, uint64_t stamp)
+{
+	unsigned long n;
+
+	len &= ~1u;
+	p->stamp = stamp;
+
+	if (p->chan)
+		return fft_pipeline_push_channel(p, buf, len);
+
+	while (len) {
+		if (!p->filling) {
+			p->filling = fft_pipeline_acquire(p);
+			if (!p->filling)
+				return -1;
+		}
+
+		n = p->n_points - p->fill_pos;
+		if (n > len / 2)
+			n = len / 2;
+
+		//Subtract 128 to ensure data is centered on 0
+		if (p->window) {
+			iq_u8_to_fft_win((fft_real *)(p->filling->in + p->fill_pos),
+					 buf, 2 * n, 128,
+					 p->window + 2 * p->fill_pos);
+			if (p->raw)
+				memcpy(p->raw + 2 * p->fill_pos, buf, 2 * n);
+		} else {
+			iq_u8_to_fft((fft_real *)(p->filling->in + p->fill_pos),
+				     buf, 2 * n, 128);
+		}
+
+		buf += 2 * n;
+		len -= 2 * n;
+		p->fill_pos += n;
+		p->in_samples += n;
+
+		if (p->fill_pos == p->n_points) {
+			fft_pipeline_publish(p, p->filling);
+			p->filling = NULL;
+		}
+	}
+
+	return 0;
+}
+
+void fft_pipeline_drain(struct fft_pipeline *p)
+{
+	if (!p->started)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	while (!p->stop && p->detect_seq != p->fill_seq)
+		pthread_cond_wait(&p->cond, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void fft_pipeline_stop(struct fft_pipeline *p)
+{
+	unsigned int i;
+
+	if (!p->started)
+		return;
+
+	pthread_mutex_lock(&p->lock);
+	if (p->stop) {
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+	p->stop = 1;
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+
+	for (i = 0; i < p->n_workers; i++)
+		pthread_join(p->workers[i].thread, NULL);
+	pthread_join(p->detector, NULL);
+}
+
+void fft_pipeline_free(struct fft_pipeline *p)
+{
+	unsigned int i;
+
+	if (p->workers) {
+		for (i = 0; i < p->n_workers; i++)
+			if (p->workers[i].plan)
+				FFTW(destroy_plan)(p->workers[i].plan);
+		free(p->workers);
+	}
+
+	if (p->jobs) {
+		for (i = 0; i < p->n_jobs; i++) {
+			FFTW(free)(p->jobs[i].in);
+			FFTW(free)(p->jobs[i].out);
+		}
+		free(p->jobs);
+	}
+
+	FFTW(free)(p->overlap);
+	FFTW(free)(p->window);
+	FFTW(free)(p->chan_frame);
+	free(p->raw);
+	FFTW(free)(p->chan_in);
+	FFTW(free)(p->chan_out);
+
+	if (p->started) {
+		pthread_mutex_destroy(&p->lock);
+		pthread_cond_destroy(&p->cond);
+	}
+
+	memset(p, 0, sizeof(*p));
+}
+
+int fft_parse_effort(const char *name)
+{
+	if (!strcasecmp(name, "estimate"))
+		return FFTW_ESTIMATE;
+	if (!strcasecmp(name, "measure"))
+		return FFTW_MEASURE;
+	if (!strcasecmp(name, "patient"))
+		return FFTW_PATIENT;
+	if (!strcasecmp(name, "exhaustive"))
+		return FFTW_EXHAUSTIVE;
+
+	return -1;
+}
+
+int fft_wisdom_load(const char *path)
+{
+	return FFTW(import_wisdom_from_filename)(path) ? 0 : -1;
+}
+
+int fft_wisdom_save(const char *path)
+{
+	return FFTW(export_wisdom_to_filename)(path) ? 0 : -1;
+}
+
+char *fft_wisdom_export(void)
+{
+	return FFTW(export_wisdom_to_string)();
+}
+
+void fft_wisdom_free(char *wisdom)
+{
+	if (wisdom)
+		FFTW(free)(wisdom);
+}
+
+int fft_wisdom_import(const char *wisdom)
+{
+	return FFTW(import_wisdom_from_string)(wisdom) ? 0 : -1;
+}
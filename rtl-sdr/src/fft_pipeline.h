@@ -0,0 +1,204 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FFT_PIPELINE_H
+#define __FFT_PIPELINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "fft_types.h"
+#include "channelizer.h"
+#include "window.h"
+
+/*
+ * Staged FFT pipeline for the rtl_tcp detector.
+ *
+ *  converter:  the caller of fft_pipeline_push(), turns u8 IQ into frames of
+ *		n_points complex samples, consecutive frames overlap by
+ *		n_points - hop samples. With a channelizer attached the
+ *		frames hold its decimated output instead.
+ *  workers:    n_workers threads, each with its own fftw_plan
+ *  detector:   one thread that gets the transformed frames strictly in
+ *		sequence order through the detect callback
+ *
+ * Frames live in a fixed pool of jobs indexed by sequence number, so a job
+ * can only be reused once the detector is done with it and ordering falls
+ * out of the indexing. When every job is busy the converter blocks, which
+ * backs up the sample ring instead of growing memory.
+ *
+ * An optional window is applied by the converter while it writes a frame,
+ * in the same pass as the u8 conversion (or the channelizer output copy).
+ * A sample in the overlap sits at a different place in the next frame and
+ * needs a different coefficient, so with a window the overlap is taken
+ * from an unwindowed copy of the frame instead of the frame itself.
+ */
+
+enum fft_job_state {
+	FFT_JOB_FREE = 0,
+	FFT_JOB_FILLED,
+	FFT_JOB_RUNNING,
+	FFT_JOB_DONE
+};
+
+struct fft_job {
+	fft_complex *in;
+	fft_complex *out;
+	uint64_t seq;
+	enum fft_job_state state;
+	/* stage timing, CLOCK_MONOTONIC ns (see latency.h) */
+	uint64_t t_usb;		/* USB completion of the buffer that filled it */
+	uint64_t t_fill_start;
+	uint64_t t_fill_end;
+	uint64_t t_fft_start;
+	uint64_t t_fft_end;
+	uint64_t end_sample;	/* input samples pushed up to the end of the frame */
+};
+
+typedef void (*fft_pipeline_detect_cb_t)(void *ctx, struct fft_job *job);
+
+struct fft_pipeline;
+
+struct fft_worker {
+	struct fft_pipeline *p;
+	fft_plan plan;
+	pthread_t thread;
+};
+
+struct fft_pipeline {
+	unsigned long n_points;
+	unsigned long hop;
+	unsigned int n_workers;
+	unsigned int n_jobs;
+	struct fft_job *jobs;
+	struct fft_worker *workers;
+	pthread_t detector;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int started;
+	int stop;
+
+	uint64_t fill_seq;	/* job the converter is filling */
+	uint64_t fft_seq;	/* next job for a worker */
+	uint64_t detect_seq;	/* next job for the detector */
+
+	/* converter state, only touched by the fft_pipeline_push() caller */
+	struct fft_job *filling;
+	unsigned long fill_pos;
+	uint64_t stamp;		/* of the buffer being pushed */
+	uint64_t in_samples;	/* input samples framed so far */
+	fft_complex *overlap;	/* tail of the last frame, head of the next */
+	int have_overlap;
+
+	/* optional window, 2 * n_points coefficients (each one twice for I
+	 * and Q), and the unwindowed frame the overlap comes from: u8 IQ, or
+	 * the channelizer output with one attached */
+	fft_real *window;
+	unsigned char *raw;
+	fft_complex *chan_frame;
+
+	/* optional downconverter in front of the frames, owned by the caller */
+	struct channelizer *chan;
+	fft_complex *chan_in;
+	fft_complex *chan_out;
+
+	fft_pipeline_detect_cb_t detect_cb;
+	void *cb_ctx;
+};
+
+/*!
+ * Allocate the job pool, plan one FFT per worker and start the threads.
+ *
+ * \param n_points FFT size
+ * \param overlap_pct overlap between consecutive frames in percent (0-90)
+ * \param n_workers number of FFT worker threads
+ * \param plan_flags FFTW planner flags
+ * \param detect_cb called on the detector thread for each frame, in order
+ * \return 0 on success
+ */
+int fft_pipeline_init(struct fft_pipeline *p, unsigned long n_points,
+		      unsigned int overlap_pct, unsigned int n_workers,
+		      unsigned int plan_flags, fft_pipeline_detect_cb_t detect_cb,
+		      void *cb_ctx);
+
+/*!
+ * Converter stage: append u8 IQ samples to the frames. Blocks while every
+ * job is busy.
+ *
+ * \param stamp USB completion time of buf, frames completed by it carry it
+ *		as t_usb, 0 if unknown
+ * \return 0 on success, -1 once the pipeline is stopping
+ */
+int fft_pipeline_push(struct fft_pipeline *p, const unsigned char *buf,
+		      uint32_t len, uint64_t stamp);
+
+/* wait until the detector is done with every full frame pushed so far, a
+ * partly filled one is left alone */
+void fft_pipeline_drain(struct fft_pipeline *p);
+
+/*!
+ * Run the samples through a channelizer before they are framed. Must be
+ * called before the first fft_pipeline_push().
+ *
+ * \return 0 on success, -1 on allocation failure
+ */
+int fft_pipeline_set_channelizer(struct fft_pipeline *p,
+				 struct channelizer *chan);
+
+/*!
+ * Window every frame, normalized to a coherent gain of 1 so a tone keeps
+ * its level in the spectrum. Must be called after
+ * fft_pipeline_set_channelizer() and before the first fft_pipeline_push().
+ *
+ * \param fn window function, see window.h; rectangle leaves frames as they are
+ * \return 0 on success, -1 on allocation failure
+ */
+int fft_pipeline_set_window(struct fft_pipeline *p, window_fn_t fn);
+
+/* stop and join every stage, frames still in flight are discarded */
+void fft_pipeline_stop(struct fft_pipeline *p);
+
+void fft_pipeline_free(struct fft_pipeline *p);
+
+/*!
+ * Map a planner effort name to FFTW flags.
+ *
+ * \param name "estimate", "measure", "patient" or "exhaustive"
+ * \return the FFTW planner flags, -1 for an unknown name
+ */
+int fft_parse_effort(const char *name);
+
+/*!
+ * Import FFTW wisdom so plans measured by an earlier run are reused.
+ *
+ * \return 0 on success, -1 if the file is missing or not wisdom for this
+ *	   FFTW build and precision
+ */
+int fft_wisdom_load(const char *path);
+
+/* export all wisdom gathered so far, return 0 on success */
+int fft_wisdom_save(const char *path);
+
+/* the same as a string, to embed elsewhere; release with fft_wisdom_free(),
+ * NULL on failure */
+char *fft_wisdom_export(void);
+void fft_wisdom_free(char *wisdom);
+
+/* import wisdom from fft_wisdom_export(), return 0 on success */
+int fft_wisdom_import(const char *wisdom);
+
+#endif /* __FFT_PIPELINE_H */
@@ -0,0 +1,42 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FFT_TYPES_H
+#define __FFT_TYPES_H
+
+#include <fftw3.h>
+
+/*
+ * FFTW precision used by the rtl_tcp detector, picked at build time.
+ * Single precision (fftw3f) halves the memory traffic per bin, which is
+ * plenty for 8 bit samples. Wisdom files are precision specific.
+ */
+#ifdef USE_FFTWF
+typedef float fft_real;
+typedef fftwf_complex fft_complex;
+typedef fftwf_plan fft_plan;
+#define FFTW(name)		fftwf_##name
+#define FFT_PRECISION_NAME	"single"
+#else
+typedef double fft_real;
+typedef fftw_complex fft_complex;
+typedef fftw_plan fft_plan;
+#define FFTW(name)		fftw_##name
+#define FFT_PRECISION_NAME	"double"
+#endif
+
+#endif /* __FFT_TYPES_H */
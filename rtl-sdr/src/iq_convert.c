@@ -0,0 +1,390 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "iq_convert.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define IQ_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+void iq_u8_to_f32_scalar(float *dst, const uint8_t *src, uint32_t len,
+			 float dc)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = (float)src[i] - dc;
+}
+
+void iq_u8_to_f64_scalar(double *dst, const uint8_t *src, uint32_t len,
+			 double dc)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = (double)src[i] - dc;
+}
+
+void iq_u8_to_s16_scalar(int16_t *dst, const uint8_t *src, uint32_t len,
+			 int dc)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = (int16_t)((int)src[i] - dc);
+}
+
+void iq_u8_to_f32_win_scalar(float *dst, const uint8_t *src, uint32_t len,
+			     float dc, const float *win)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = ((float)src[i] - dc) * win[i];
+}
+
+void iq_u8_to_f64_win_scalar(double *dst, const uint8_t *src, uint32_t len,
+			     double dc, const double *win)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		dst[i] = ((double)src[i] - dc) * win[i];
+}
+
+#ifdef IQ_HAVE_X86
+/*
+ * Built with target attributes rather than global -msse2/-mavx2 so the rest
+ * of the binary keeps running on any x86, the dispatcher only hands these
+ * out after checking the CPU.
+ */
+
+__attribute__((target("sse2")))
+static void iq_u8_to_f32_sse2(float *dst, const uint8_t *src, uint32_t len,
+			      float dc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 vdc = _mm_set1_ps(dc);
+	__m128i v, lo, hi;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dst + i, _mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpacklo_epi16(lo, zero)), vdc));
+		_mm_storeu_ps(dst + i + 4, _mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpackhi_epi16(lo, zero)), vdc));
+		_mm_storeu_ps(dst + i + 8, _mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpacklo_epi16(hi, zero)), vdc));
+		_mm_storeu_ps(dst + i + 12, _mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpackhi_epi16(hi, zero)), vdc));
+	}
+
+	iq_u8_to_f32_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("sse2")))
+static void iq_u8_to_f64_sse2(double *dst, const uint8_t *src, uint32_t len,
+			      double dc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128d vdc = _mm_set1_pd(dc);
+	__m128i v, w;
+	uint32_t i;
+	int k;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i)),
+				      zero);
+		for (k = 0; k < 2; k++) {
+			w = k ? _mm_unpackhi_epi16(v, zero) :
+				_mm_unpacklo_epi16(v, zero);
+			_mm_storeu_pd(dst + i + 4 * k,
+				      _mm_sub_pd(_mm_cvtepi32_pd(w), vdc));
+			_mm_storeu_pd(dst + i + 4 * k + 2,
+				      _mm_sub_pd(_mm_cvtepi32_pd(
+					_mm_srli_si128(w, 8)), vdc));
+		}
+	}
+
+	iq_u8_to_f64_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("sse2")))
+static void iq_u8_to_s16_sse2(int16_t *dst, const uint8_t *src, uint32_t len,
+			      int dc)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vdc = _mm_set1_epi16((short)dc);
+	__m128i v;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), vdc));
+		_mm_storeu_si128((__m128i *)(dst + i + 8),
+				 _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), vdc));
+	}
+
+	iq_u8_to_s16_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("sse2")))
+static void iq_u8_to_f32_win_sse2(float *dst, const uint8_t *src, uint32_t len,
+				  float dc, const float *win)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 vdc = _mm_set1_ps(dc);
+	__m128i v, lo, hi;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		lo = _mm_unpacklo_epi8(v, zero);
+		hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpacklo_epi16(lo, zero)), vdc),
+				_mm_loadu_ps(win + i)));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpackhi_epi16(lo, zero)), vdc),
+				_mm_loadu_ps(win + i + 4)));
+		_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpacklo_epi16(hi, zero)), vdc),
+				_mm_loadu_ps(win + i + 8)));
+		_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(
+				_mm_unpackhi_epi16(hi, zero)), vdc),
+				_mm_loadu_ps(win + i + 12)));
+	}
+
+	iq_u8_to_f32_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+
+__attribute__((target("sse2")))
+static void iq_u8_to_f64_win_sse2(double *dst, const uint8_t *src, uint32_t len,
+				  double dc, const double *win)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128d vdc = _mm_set1_pd(dc);
+	__m128i v, w;
+	uint32_t i;
+	int k;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(src + i)),
+				      zero);
+		for (k = 0; k < 2; k++) {
+			w = k ? _mm_unpackhi_epi16(v, zero) :
+				_mm_unpacklo_epi16(v, zero);
+			_mm_storeu_pd(dst + i + 4 * k, _mm_mul_pd(
+				_mm_sub_pd(_mm_cvtepi32_pd(w), vdc),
+				_mm_loadu_pd(win + i + 4 * k)));
+			_mm_storeu_pd(dst + i + 4 * k + 2, _mm_mul_pd(
+				_mm_sub_pd(_mm_cvtepi32_pd(
+					_mm_srli_si128(w, 8)), vdc),
+				_mm_loadu_pd(win + i + 4 * k + 2)));
+		}
+	}
+
+	iq_u8_to_f64_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+
+__attribute__((target("avx2")))
+static void iq_u8_to_f32_avx2(float *dst, const uint8_t *src, uint32_t len,
+			      float dc)
+{
+	const __m256 vdc = _mm256_set1_ps(dc);
+	__m128i v;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_sub_ps(_mm256_cvtepi32_ps(
+				_mm256_cvtepu8_epi32(v)), vdc));
+		_mm256_storeu_ps(dst + i + 8, _mm256_sub_ps(_mm256_cvtepi32_ps(
+				_mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))), vdc));
+	}
+
+	iq_u8_to_f32_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("avx2")))
+static void iq_u8_to_f64_avx2(double *dst, const uint8_t *src, uint32_t len,
+			      double dc)
+{
+	const __m256d vdc = _mm256_set1_pd(dc);
+	__m128i v;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = _mm_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_pd(dst + i,
+				 _mm256_sub_pd(_mm256_cvtepi32_pd(v), vdc));
+		v = _mm_cvtepu8_epi32(_mm_srli_si128(
+			_mm_loadl_epi64((const __m128i *)(src + i)), 4));
+		_mm256_storeu_pd(dst + i + 4,
+				 _mm256_sub_pd(_mm256_cvtepi32_pd(v), vdc));
+	}
+
+	iq_u8_to_f64_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("avx2")))
+static void iq_u8_to_s16_avx2(int16_t *dst, const uint8_t *src, uint32_t len,
+			      int dc)
+{
+	const __m256i vdc = _mm256_set1_epi16((short)dc);
+	__m256i lo, hi;
+	uint32_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		lo = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)(src + i)));
+		hi = _mm256_cvtepu8_epi16(
+			_mm_loadu_si128((const __m128i *)(src + i + 16)));
+		_mm256_storeu_si256((__m256i *)(dst + i),
+				    _mm256_sub_epi16(lo, vdc));
+		_mm256_storeu_si256((__m256i *)(dst + i + 16),
+				    _mm256_sub_epi16(hi, vdc));
+	}
+
+	iq_u8_to_s16_scalar(dst + i, src + i, len - i, dc);
+}
+
+__attribute__((target("avx2")))
+static void iq_u8_to_f32_win_avx2(float *dst, const uint8_t *src, uint32_t len,
+				  float dc, const float *win)
+{
+	const __m256 vdc = _mm256_set1_ps(dc);
+	__m128i v;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_sub_ps(
+				_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(v)), vdc),
+				_mm256_loadu_ps(win + i)));
+		_mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_sub_ps(
+				_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+					_mm_srli_si128(v, 8))), vdc),
+				_mm256_loadu_ps(win + i + 8)));
+	}
+
+	iq_u8_to_f32_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+
+__attribute__((target("avx2")))
+static void iq_u8_to_f64_win_avx2(double *dst, const uint8_t *src, uint32_t len,
+				  double dc, const double *win)
+{
+	const __m256d vdc = _mm256_set1_pd(dc);
+	__m128i v;
+	uint32_t i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = _mm_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+		_mm256_storeu_pd(dst + i, _mm256_mul_pd(
+			_mm256_sub_pd(_mm256_cvtepi32_pd(v), vdc),
+			_mm256_loadu_pd(win + i)));
+		v = _mm_cvtepu8_epi32(_mm_srli_si128(
+			_mm_loadl_epi64((const __m128i *)(src + i)), 4));
+		_mm256_storeu_pd(dst + i + 4, _mm256_mul_pd(
+			_mm256_sub_pd(_mm256_cvtepi32_pd(v), vdc),
+			_mm256_loadu_pd(win + i + 4)));
+	}
+
+	iq_u8_to_f64_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+
+static const struct iq_kernels iq_sse2 = {
+	"sse2", iq_u8_to_f32_sse2, iq_u8_to_f64_sse2, iq_u8_to_s16_sse2,
+	iq_u8_to_f32_win_sse2, iq_u8_to_f64_win_sse2
+};
+
+static const struct iq_kernels iq_avx2 = {
+	"avx2", iq_u8_to_f32_avx2, iq_u8_to_f64_avx2, iq_u8_to_s16_avx2,
+	iq_u8_to_f32_win_avx2, iq_u8_to_f64_win_avx2
+};
+#endif
+
+static const struct iq_kernels iq_scalar = {
+	"scalar", iq_u8_to_f32_scalar, iq_u8_to_f64_scalar, iq_u8_to_s16_scalar,
+	iq_u8_to_f32_win_scalar, iq_u8_to_f64_win_scalar
+};
+
+iq_u8_to_f32_t iq_u8_to_f32 = iq_u8_to_f32_scalar;
+iq_u8_to_f64_t iq_u8_to_f64 = iq_u8_to_f64_scalar;
+iq_u8_to_s16_t iq_u8_to_s16 = iq_u8_to_s16_scalar;
+iq_u8_to_f32_win_t iq_u8_to_f32_win = iq_u8_to_f32_win_scalar;
+iq_u8_to_f64_win_t iq_u8_to_f64_win = iq_u8_to_f64_win_scalar;
+
+static const struct iq_kernels *iq_current = &iq_scalar;
+
+/* kernel set by name if this CPU can run it, NULL for the best available */
+static const struct iq_kernels *iq_lookup(const char *name)
+{
+	const struct iq_kernels *k = NULL;
+
+#ifdef IQ_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && (!name || !strcmp(name, "avx2")))
+		return &iq_avx2;
+	if (__builtin_cpu_supports("sse2") && (!name || !strcmp(name, "sse2")))
+		return &iq_sse2;
+#endif
+
+	k = iq_convert_neon();
+	if (k && (!name || !strcmp(name, k->name)))
+		return k;
+
+	if (!name || !strcmp(name, "scalar"))
+		return &iq_scalar;
+
+	return NULL;
+}
+
+void iq_convert_init(void)
+{
+	iq_convert_select(NULL);
+}
+
+int iq_convert_select(const char *name)
+{
+	const struct iq_kernels *k = iq_lookup(name);
+
+	if (!k)
+		return -1;
+
+	iq_current = k;
+	iq_u8_to_f32 = k->to_f32;
+	iq_u8_to_f64 = k->to_f64;
+	iq_u8_to_s16 = k->to_s16;
+	iq_u8_to_f32_win = k->to_f32_win;
+	iq_u8_to_f64_win = k->to_f64_win;
+
+	return 0;
+}
+
+const char *iq_convert_name(void)
+{
+	return iq_current->name;
+}
@@ -0,0 +1,98 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IQ_CONVERT_H
+#define __IQ_CONVERT_H
+
+#include <stdint.h>
+
+/*
+ * Conversion of the interleaved u8 IQ stream coming off the dongle into
+ * signed samples, shared by rtl_tcp, rtl_fm and rtl_power.
+ *
+ * Every kernel computes dst[i] = src[i] - dc over len bytes, so I and Q stay
+ * interleaved and a complex array can be passed as a plain float/double
+ * array of twice its length. There are scalar, SSE2, AVX2 and NEON variants;
+ * the pointers below start out on the scalar ones and iq_convert_init()
+ * switches them to the fastest set the running CPU supports.
+ *
+ * The _win variants also apply a window on the way, dst[i] = (src[i] - dc) *
+ * win[i], so a windowed FFT frame costs no pass over the samples beyond the
+ * conversion. win holds one coefficient per byte, each sample's twice.
+ */
+
+typedef void (*iq_u8_to_f32_t)(float *dst, const uint8_t *src, uint32_t len,
+			       float dc);
+typedef void (*iq_u8_to_f64_t)(double *dst, const uint8_t *src, uint32_t len,
+			       double dc);
+typedef void (*iq_u8_to_s16_t)(int16_t *dst, const uint8_t *src, uint32_t len,
+			       int dc);
+typedef void (*iq_u8_to_f32_win_t)(float *dst, const uint8_t *src,
+				   uint32_t len, float dc, const float *win);
+typedef void (*iq_u8_to_f64_win_t)(double *dst, const uint8_t *src,
+				   uint32_t len, double dc, const double *win);
+
+extern iq_u8_to_f32_t iq_u8_to_f32;
+extern iq_u8_to_f64_t iq_u8_to_f64;
+extern iq_u8_to_s16_t iq_u8_to_s16;
+extern iq_u8_to_f32_win_t iq_u8_to_f32_win;
+extern iq_u8_to_f64_win_t iq_u8_to_f64_win;
+
+/* pick the fastest kernels for this CPU, call once before starting threads */
+void iq_convert_init(void);
+
+/*!
+ * Force a specific kernel set, e.g. to compare them.
+ *
+ * \param name "scalar", "sse2", "avx2" or "neon", NULL for the best one
+ * \return 0 on success, -1 if the set is not built in or not supported by
+ *	   this CPU
+ */
+int iq_convert_select(const char *name);
+
+/* name of the kernel set in use */
+const char *iq_convert_name(void);
+
+/* one kernel set, the dispatcher picks among these */
+struct iq_kernels {
+	const char *name;
+	iq_u8_to_f32_t to_f32;
+	iq_u8_to_f64_t to_f64;
+	iq_u8_to_s16_t to_s16;
+	iq_u8_to_f32_win_t to_f32_win;
+	iq_u8_to_f64_win_t to_f64_win;
+};
+
+/*
+ * NEON set, lives in iq_convert_neon.c so only that file is built with NEON
+ * code generation. NULL when NEON was not built in or the CPU lacks it.
+ */
+const struct iq_kernels *iq_convert_neon(void);
+
+/* scalar kernels, also used for the tails of the vector ones */
+void iq_u8_to_f32_scalar(float *dst, const uint8_t *src, uint32_t len,
+			 float dc);
+void iq_u8_to_f64_scalar(double *dst, const uint8_t *src, uint32_t len,
+			 double dc);
+void iq_u8_to_s16_scalar(int16_t *dst, const uint8_t *src, uint32_t len,
+			 int dc);
+void iq_u8_to_f32_win_scalar(float *dst, const uint8_t *src, uint32_t len,
+			     float dc, const float *win);
+void iq_u8_to_f64_win_scalar(double *dst, const uint8_t *src, uint32_t len,
+			     double dc, const double *win);
+
+#endif /* __IQ_CONVERT_H */
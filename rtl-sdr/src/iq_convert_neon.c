@@ -0,0 +1,188 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * On 32 bit ARM this file is the only one built with -mfpu=neon, the
+ * Raspberry Pi 1 and Zero have no NEON and must never run code from it.
+ * Without NEON code generation it only provides the NULL lookup.
+ */
+
+#include <stddef.h>
+
+#include "iq_convert.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+#ifndef __aarch64__
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON	(1 << 12)
+#endif
+#endif
+
+static void iq_u8_to_f32_neon(float *dst, const uint8_t *src, uint32_t len,
+			      float dc)
+{
+	const float32x4_t vdc = vdupq_n_f32(dc);
+	uint8x16_t v;
+	uint16x8_t lo, hi;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = vld1q_u8(src + i);
+		lo = vmovl_u8(vget_low_u8(v));
+		hi = vmovl_u8(vget_high_u8(v));
+		vst1q_f32(dst + i, vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_low_u16(lo))), vdc));
+		vst1q_f32(dst + i + 4, vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_high_u16(lo))), vdc));
+		vst1q_f32(dst + i + 8, vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_low_u16(hi))), vdc));
+		vst1q_f32(dst + i + 12, vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_high_u16(hi))), vdc));
+	}
+
+	iq_u8_to_f32_scalar(dst + i, src + i, len - i, dc);
+}
+
+static void iq_u8_to_f32_win_neon(float *dst, const uint8_t *src, uint32_t len,
+				  float dc, const float *win)
+{
+	const float32x4_t vdc = vdupq_n_f32(dc);
+	uint8x16_t v;
+	uint16x8_t lo, hi;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = vld1q_u8(src + i);
+		lo = vmovl_u8(vget_low_u8(v));
+		hi = vmovl_u8(vget_high_u8(v));
+		vst1q_f32(dst + i, vmulq_f32(vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_low_u16(lo))), vdc),
+				vld1q_f32(win + i)));
+		vst1q_f32(dst + i + 4, vmulq_f32(vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_high_u16(lo))), vdc),
+				vld1q_f32(win + i + 4)));
+		vst1q_f32(dst + i + 8, vmulq_f32(vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_low_u16(hi))), vdc),
+				vld1q_f32(win + i + 8)));
+		vst1q_f32(dst + i + 12, vmulq_f32(vsubq_f32(vcvtq_f32_u32(
+				vmovl_u16(vget_high_u16(hi))), vdc),
+				vld1q_f32(win + i + 12)));
+	}
+
+	iq_u8_to_f32_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+
+#ifdef __aarch64__
+static void iq_u8_to_f64_neon(double *dst, const uint8_t *src, uint32_t len,
+			      double dc)
+{
+	const float64x2_t vdc = vdupq_n_f64(dc);
+	uint16x8_t v;
+	float32x4_t f;
+	uint32_t i;
+	int k;
+
+	/* u8 -> f32 is exact, widening that to f64 keeps it exact */
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = vmovl_u8(vld1_u8(src + i));
+		for (k = 0; k < 2; k++) {
+			f = vcvtq_f32_u32(vmovl_u16(k ? vget_high_u16(v) :
+							vget_low_u16(v)));
+			vst1q_f64(dst + i + 4 * k,
+				  vsubq_f64(vcvt_f64_f32(vget_low_f32(f)), vdc));
+			vst1q_f64(dst + i + 4 * k + 2,
+				  vsubq_f64(vcvt_high_f64_f32(f), vdc));
+		}
+	}
+
+	iq_u8_to_f64_scalar(dst + i, src + i, len - i, dc);
+}
+
+static void iq_u8_to_f64_win_neon(double *dst, const uint8_t *src, uint32_t len,
+				  double dc, const double *win)
+{
+	const float64x2_t vdc = vdupq_n_f64(dc);
+	uint16x8_t v;
+	float32x4_t f;
+	uint32_t i;
+	int k;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		v = vmovl_u8(vld1_u8(src + i));
+		for (k = 0; k < 2; k++) {
+			f = vcvtq_f32_u32(vmovl_u16(k ? vget_high_u16(v) :
+							vget_low_u16(v)));
+			vst1q_f64(dst + i + 4 * k, vmulq_f64(
+				vsubq_f64(vcvt_f64_f32(vget_low_f32(f)), vdc),
+				vld1q_f64(win + i + 4 * k)));
+			vst1q_f64(dst + i + 4 * k + 2, vmulq_f64(
+				vsubq_f64(vcvt_high_f64_f32(f), vdc),
+				vld1q_f64(win + i + 4 * k + 2)));
+		}
+	}
+
+	iq_u8_to_f64_win_scalar(dst + i, src + i, len - i, dc, win + i);
+}
+#else
+/* ARMv7 NEON has no double precision lanes */
+#define iq_u8_to_f64_neon	iq_u8_to_f64_scalar
+#define iq_u8_to_f64_win_neon	iq_u8_to_f64_win_scalar
+#endif
+
+static void iq_u8_to_s16_neon(int16_t *dst, const uint8_t *src, uint32_t len,
+			      int dc)
+{
+	const int16x8_t vdc = vdupq_n_s16((int16_t)dc);
+	uint8x16_t v;
+	uint32_t i;
+
+	for (i = 0; i + 16 <= len; i += 16) {
+		v = vld1q_u8(src + i);
+		vst1q_s16(dst + i, vsubq_s16(vreinterpretq_s16_u16(
+				vmovl_u8(vget_low_u8(v))), vdc));
+		vst1q_s16(dst + i + 8, vsubq_s16(vreinterpretq_s16_u16(
+				vmovl_u8(vget_high_u8(v))), vdc));
+	}
+
+	iq_u8_to_s16_scalar(dst + i, src + i, len - i, dc);
+}
+
+static const struct iq_kernels iq_neon = {
+	"neon", iq_u8_to_f32_neon, iq_u8_to_f64_neon, iq_u8_to_s16_neon,
+	iq_u8_to_f32_win_neon, iq_u8_to_f64_win_neon
+};
+
+const struct iq_kernels *iq_convert_neon(void)
+{
+#ifndef __aarch64__
+	if (!(getauxval(AT_HWCAP) & HWCAP_NEON))
+		return NULL;
+#endif
+	return &iq_neon;
+}
+
+#else
+
+const struct iq_kernels *iq_convert_neon(void)
+{
+	return NULL;
+}
+
+#endif
@@ -0,0 +1,632 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* accept4() */
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "iq_server.h"
+#include "latency.h"
+#include "logger.h"
+
+#define EV_LISTEN	0xffffffffU
+#define EV_WAKE		0xfffffffeU
+#define EPOLL_EVENTS	16
+#define EPOLL_WAIT_MS	500
+#define HELLO_WAIT_MS	10
+
+static uint32_t round_pow2(uint32_t n)
+{
+	uint32_t p = 1;
+
+	while (p < n)
+		p <<= 1;
+
+	return p;
+}
+
+int iq_server_init(struct iq_server *srv, const char *addr, int port,
+		   uint32_t slot_count, uint32_t slot_size,
+		   const void *header, size_t header_len)
+{
+	struct sockaddr_in local;
+	struct epoll_event ev;
+	unsigned int i;
+	int one = 1;
+
+	memset(srv, 0, sizeof(*srv));
+	srv->listen_fd = srv->epoll_fd = srv->event_fd = -1;
+	for (i = 0; i < IQ_SERVER_MAX_CLIENTS; i++)
+		srv->clients[i].fd = -1;
+
+	if (slot_count < 2 * IQ_SERVER_GUARD)
+		slot_count = 2 * IQ_SERVER_GUARD;
+	srv->slot_count = round_pow2(slot_count);
+	srv->slot_size = slot_size;
+
+	if (header_len > IQ_SERVER_HEADER)
+		header_len = IQ_SERVER_HEADER;
+	memcpy(srv->header, header, header_len);
+	srv->header_len = header_len;
+
+	srv->pool = malloc((size_t)srv->slot_count * slot_size);
+	srv->lens = calloc(srv->slot_count, sizeof(*srv->lens));
+	if (!srv->pool || !srv->lens) {
+		fprintf(stderr, "Failed to allocate %u stream buffers\n",
+			srv->slot_count);
+		goto fail;
+	}
+
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	if (inet_pton(AF_INET, addr, &local.sin_addr) != 1) {
+		fprintf(stderr, "Bad listen address %s\n", addr);
+		goto fail;
+	}
+
+	srv->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK |
+				SOCK_CLOEXEC, 0);
+	if (srv->listen_fd < 0)
+		goto fail_errno;
+	setsockopt(srv->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(srv->listen_fd, (struct sockaddr *)&local, sizeof(local)) < 0 ||
+	    listen(srv->listen_fd, 4) < 0)
+		goto fail_errno;
+
+	srv->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	srv->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (srv->epoll_fd < 0 || srv->event_fd < 0)
+		goto fail_errno;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = EV_LISTEN;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->listen_fd, &ev) < 0)
+		goto fail_errno;
+	ev.data.u32 = EV_WAKE;
+	if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, srv->event_fd, &ev) < 0)
+		goto fail_errno;
+
+	return 0;
+
+fail_errno:
+	fprintf(stderr, "IQ server on %s:%d: %s\n", addr, port, strerror(errno));
+fail:
+	iq_server_free(srv);
+	return -1;
+}
+
+void iq_server_set_command(struct iq_server *srv, iq_server_command_t command,
+			   void *ctx)
+{
+	srv->command = command;
+	srv->ctx = ctx;
+}
+
+void iq_server_set_tuning(struct iq_server *srv, uint32_t center_freq,
+			  uint32_t sample_rate)
+{
+	srv->center_freq = center_freq;
+	srv->sample_rate = sample_rate;
+}
+
+void iq_server_push(struct iq_server *srv, const unsigned char *buf,
+		    uint32_t len)
+{
+	uint32_t head = srv->head;
+	uint64_t one = 1;
+
+	if (!__atomic_load_n(&srv->n_clients, __ATOMIC_RELAXED))
+		return;
+
+	if (len > srv->slot_size)
+		len = srv->slot_size;
+
+	memcpy(srv->pool + (size_t)(head & (srv->slot_count - 1)) * srv->slot_size,
+	       buf, len);
+	srv->lens[head & (srv->slot_count - 1)] = len;
+	__atomic_store_n(&srv->head, head + 1, __ATOMIC_RELEASE);
+
+	/* never blocks, a full counter means a wakeup is pending anyway */
+	if (write(srv->event_fd, &one, sizeof(one)) < 0)
+		return;
+}
+
+static void close_client(struct iq_server *srv, struct iq_client *c,
+			 const char *why)
+{
+	logger_printf(LOGGER_INFO, "Client %s disconnected (%s), %llu bytes sent",
+		      c->name, why, (unsigned long long)c->bytes);
+
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	if (c->state == IQ_CLIENT_STREAM)
+		iq_stream_free(&c->stream);
+	__atomic_sub_fetch(&srv->n_clients, 1, __ATOMIC_RELAXED);
+}
+
+static void watch_out(struct iq_server *srv, struct iq_client *c, int on)
+{
+	struct epoll_event ev;
+
+	if (c->want_out == on)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.u32 = (uint32_t)(c - srv->clients);
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+	c->want_out = on;
+}
+
+/* a client this far behind is about to be overwritten */
+static int evict_slow(struct iq_server *srv, struct iq_client *c, uint32_t head)
+{
+	if (c->state == IQ_CLIENT_HELLO ||
+	    head - c->seq <= srv->slot_count - IQ_SERVER_GUARD)
+		return 0;
+
+	srv->evicted++;
+	close_client(srv, c, "too slow");
+	return 1;
+}
+
+/* a send that failed: wait for room, or drop the client, nonzero to stop */
+static int send_failed(struct iq_server *srv, struct iq_client *c)
+{
+	if (errno == EINTR)
+		return 0;
+	if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		watch_out(srv, c, 1);
+		return 1;
+	}
+	close_client(srv, c, strerror(errno));
+	return 1;
+}
+
+/* reshaped stream: one slot at a time through the client's iq_stream */
+static void flush_stream(struct iq_server *srv, struct iq_client *c)
+{
+	uint32_t head, slot;
+	ssize_t sent;
+
+	for (;;) {
+		if (!c->header_done) {
+			sent = send(c->fd, c->header + c->offset,
+				    c->header_len - c->offset,
+				    MSG_DONTWAIT | MSG_NOSIGNAL);
+			if (sent < 0) {
+				if (send_failed(srv, c))
+					return;
+				continue;
+			}
+			c->bytes += sent;
+			c->offset += sent;
+			if (c->offset == c->header_len) {
+				c->header_done = 1;
+				c->offset = 0;
+			}
+			continue;
+		}
+
+		if (c->offset == c->chunk_len) {
+			head = __atomic_load_n(&srv->head, __ATOMIC_ACQUIRE);
+			if (evict_slow(srv, c, head))
+				return;
+			if (c->seq == head) {
+				watch_out(srv, c, 0);
+				return;
+			}
+
+			slot = c->seq & (srv->slot_count - 1);
+			c->chunk_len = iq_stream_run(&c->stream,
+					srv->pool + (size_t)slot * srv->slot_size,
+					srv->lens[slot], &c->chunk);
+			c->offset = 0;
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&srv->head, __ATOMIC_RELAXED) - c->seq >=
+			    srv->slot_count) {
+				srv->evicted++;
+				close_client(srv, c, "overrun");
+				return;
+			}
+			c->seq++;
+			continue;
+		}
+
+		sent = send(c->fd, c->chunk + c->offset, c->chunk_len - c->offset,
+			    MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (send_failed(srv, c))
+				return;
+			continue;
+		}
+		c->bytes += sent;
+		c->offset += sent;
+	}
+}
+
+/* send everything published so far or until the socket is full */
+static void flush_client(struct iq_server *srv, struct iq_client *c)
+{
+	struct iovec iov[IQ_SERVER_IOV + 1];
+	struct msghdr msg;
+	uint32_t head, seq, slot, skip;
+	unsigned int n;
+	ssize_t sent;
+	size_t left;
+
+	if (c->state == IQ_CLIENT_HELLO)
+		return;
+	if (c->state == IQ_CLIENT_STREAM) {
+		flush_stream(srv, c);
+		return;
+	}
+
+	for (;;) {
+		head = __atomic_load_n(&srv->head, __ATOMIC_ACQUIRE);
+		if (evict_slow(srv, c, head))
+			return;
+
+		n = 0;
+		skip = c->offset;
+		if (!c->header_done) {
+			iov[n].iov_base = c->header + skip;
+			iov[n].iov_len = c->header_len - skip;
+			n++;
+			skip = 0;
+		}
+		for (seq = c->seq; seq != head && n < IQ_SERVER_IOV + 1; seq++) {
+			slot = seq & (srv->slot_count - 1);
+			iov[n].iov_base = srv->pool + (size_t)slot * srv->slot_size + skip;
+			iov[n].iov_len = srv->lens[slot] - skip;
+			n++;
+			skip = 0;
+		}
+		if (!n) {
+			watch_out(srv, c, 0);
+			return;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		sent = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (send_failed(srv, c))
+				return;
+			continue;
+		}
+
+		/* the producer may have lapped us while the kernel copied */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&srv->head, __ATOMIC_RELAXED) - c->seq >=
+		    srv->slot_count) {
+			srv->evicted++;
+			close_client(srv, c, "overrun");
+			return;
+		}
+
+		c->bytes += sent;
+		left = (size_t)sent + c->offset;
+		if (!c->header_done) {
+			if (left < c->header_len) {
+				c->offset = (uint32_t)left;
+				continue;
+			}
+			left -= c->header_len;
+			c->header_done = 1;
+		}
+		while (c->seq != head &&
+		       left >= srv->lens[c->seq & (srv->slot_count - 1)]) {
+			left -= srv->lens[c->seq & (srv->slot_count - 1)];
+			c->seq++;
+		}
+		c->offset = (uint32_t)left;
+	}
+}
+
+/* end of the hello: grant what was asked for, or plain IQ, and start */
+static void start_client(struct iq_server *srv, struct iq_client *c, int ext)
+{
+	dongle_ext_info_t info;
+	double offset = 0;
+	uint32_t decim = c->decim ? c->decim : 1;
+	uint32_t codec = c->codec;
+
+	memcpy(c->header, srv->header, srv->header_len);
+	c->header_len = srv->header_len;
+	c->state = IQ_CLIENT_RAW;
+
+	if (ext) {
+		if (srv->sample_rate)
+			offset = (double)c->offset_hz / srv->sample_rate;
+		if (decim > IQ_SERVER_MAX_DECIM || codec >= IQ_CODECS ||
+		    fabs(offset) > 0.5)
+			decim = 1, codec = IQ_CODEC_RAW, offset = 0;
+
+		if ((decim > 1 || codec != IQ_CODEC_RAW) &&
+		    iq_stream_init(&c->stream, decim, decim > 1 ? offset : 0,
+				   codec, srv->slot_size) == 0) {
+			c->state = IQ_CLIENT_STREAM;
+		} else {
+			decim = 1;
+			codec = IQ_CODEC_RAW;
+		}
+
+		memset(&info, 0, sizeof(info));
+		memcpy(info.magic, "RTLX", 4);
+		info.version = htonl(1);
+		info.codec = htonl(codec);
+		info.decim = htonl(decim);
+		info.sample_rate = htonl(srv->sample_rate / decim);
+		info.center_freq = htonl(srv->center_freq +
+					 (decim > 1 ? c->offset_hz : 0));
+		info.block = htonl(IQ_STREAM_BLOCK);
+		memcpy(c->header + c->header_len, &info, sizeof(info));
+		c->header_len += sizeof(info);
+
+		logger_printf(LOGGER_INFO, "Client %s streams codec %u, decimation %u, %u Hz at %u Hz",
+			      c->name, codec, decim, srv->sample_rate / decim,
+			      srv->center_freq + (decim > 1 ? c->offset_hz : 0));
+	}
+
+	/* live from the next buffer on */
+	c->seq = __atomic_load_n(&srv->head, __ATOMIC_ACQUIRE);
+	flush_client(srv, c);
+}
+
+static void accept_clients(struct iq_server *srv)
+{
+	struct sockaddr_in remote;
+	socklen_t len;
+	struct epoll_event ev;
+	struct iq_client *c;
+	unsigned int i;
+	int fd;
+
+	for (;;) {
+		len = sizeof(remote);
+		fd = accept4(srv->listen_fd, (struct sockaddr *)&remote, &len,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+
+		c = NULL;
+		for (i = 0; i < IQ_SERVER_MAX_CLIENTS; i++) {
+			if (srv->clients[i].fd < 0) {
+				c = &srv->clients[i];
+				break;
+			}
+		}
+		if (!c) {
+			logger_printf(LOGGER_WARN, "Refusing client, %d connected already",
+				      IQ_SERVER_MAX_CLIENTS);
+			close(fd);
+			continue;
+		}
+
+		memset(c, 0, sizeof(*c));
+		c->fd = fd;
+		snprintf(c->name, sizeof(c->name), "%s:%d",
+			 inet_ntoa(remote.sin_addr), ntohs(remote.sin_port));
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			close(fd);
+			c->fd = -1;
+			continue;
+		}
+
+		/* the stream starts once the client had its say */
+		c->hello_end = lat_now() + IQ_SERVER_HELLO_MS * 1000000ULL;
+		__atomic_add_fetch(&srv->n_clients, 1, __ATOMIC_RELAXED);
+		logger_printf(LOGGER_INFO, "Client %s connected", c->name);
+	}
+}
+
+static void read_commands(struct iq_server *srv, struct iq_client *c)
+{
+	ssize_t n;
+	uint32_t param;
+
+	for (;;) {
+		n = recv(c->fd, c->cmd + c->cmd_len, sizeof(c->cmd) - c->cmd_len,
+			 MSG_DONTWAIT);
+		if (n == 0) {
+			close_client(srv, c, "closed");
+			return;
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				close_client(srv, c, strerror(errno));
+			return;
+		}
+
+		c->cmd_len += n;
+		if (c->cmd_len < sizeof(c->cmd))
+			continue;
+		c->cmd_len = 0;
+
+		memcpy(&param, c->cmd + 1, sizeof(param));
+		param = ntohl(param);
+
+		if (c->cmd[0] < IQ_CMD_DECIM || c->cmd[0] > IQ_CMD_START) {
+			if (srv->command)
+				srv->command(srv->ctx, c->cmd[0], param);
+			continue;
+		}
+
+		if (c->state != IQ_CLIENT_HELLO) {
+			logger_printf(LOGGER_WARN, "Client %s: stream mode 0x%02x after the start, ignored",
+				      c->name, c->cmd[0]);
+			continue;
+		}
+
+		switch (c->cmd[0]) {
+		case IQ_CMD_DECIM:
+			c->decim = param;
+			break;
+		case IQ_CMD_OFFSET:
+			c->offset_hz = (int32_t)param;
+			break;
+		case IQ_CMD_CODEC:
+			c->codec = param;
+			break;
+		case IQ_CMD_START:
+			start_client(srv, c, 1);
+			if (c->fd < 0)
+				return;
+			break;
+		}
+	}
+}
+
+static void *iq_server_fn(void *arg)
+{
+	struct iq_server *srv = arg;
+	struct epoll_event events[EPOLL_EVENTS];
+	struct iq_client *c;
+	uint64_t count, now;
+	unsigned int i;
+	int n, k, hello = 0;
+
+	while (!__atomic_load_n(&srv->stop, __ATOMIC_ACQUIRE)) {
+		n = epoll_wait(srv->epoll_fd, events, EPOLL_EVENTS,
+			       hello ? HELLO_WAIT_MS : EPOLL_WAIT_MS);
+
+		for (k = 0; k < n; k++) {
+			if (events[k].data.u32 == EV_LISTEN) {
+				accept_clients(srv);
+				continue;
+			}
+
+			if (events[k].data.u32 == EV_WAKE) {
+				if (read(srv->event_fd, &count, sizeof(count)) < 0)
+					count = 0;
+				for (i = 0; i < IQ_SERVER_MAX_CLIENTS; i++) {
+					c = &srv->clients[i];
+					if (c->fd < 0)
+						continue;
+					/* a full socket only gets checked for lag */
+					if (c->want_out)
+						evict_slow(srv, c, __atomic_load_n(&srv->head,
+										 __ATOMIC_ACQUIRE));
+					else
+						flush_client(srv, c);
+				}
+				continue;
+			}
+
+			c = &srv->clients[events[k].data.u32];
+			if (c->fd < 0)
+				continue;
+			if (events[k].events & (EPOLLERR | EPOLLHUP)) {
+				close_client(srv, c, "hangup");
+				continue;
+			}
+			if (events[k].events & EPOLLIN)
+				read_commands(srv, c);
+			if (c->fd >= 0 && (events[k].events & EPOLLOUT))
+				flush_client(srv, c);
+		}
+
+		/* clients that asked for nothing get plain IQ */
+		now = lat_now();
+		hello = 0;
+		for (i = 0; i < IQ_SERVER_MAX_CLIENTS; i++) {
+			c = &srv->clients[i];
+			if (c->fd < 0 || c->state != IQ_CLIENT_HELLO)
+				continue;
+			if (now >= c->hello_end)
+				start_client(srv, c, 0);
+			else
+				hello = 1;
+		}
+	}
+
+	return NULL;
+}
+
+int iq_server_start(struct iq_server *srv)
+{
+	if (pthread_create(&srv->thread, NULL, iq_server_fn, srv))
+		return -1;
+	srv->started = 1;
+
+	return 0;
+}
+
+void iq_server_stop(struct iq_server *srv)
+{
+	uint64_t one = 1;
+	unsigned int i;
+
+	if (!srv->started)
+		return;
+
+	__atomic_store_n(&srv->stop, 1, __ATOMIC_RELEASE);
+	if (write(srv->event_fd, &one, sizeof(one)) < 0)
+		one = 0;
+	pthread_join(srv->thread, NULL);
+	srv->started = 0;
+
+	for (i = 0; i < IQ_SERVER_MAX_CLIENTS; i++)
+		if (srv->clients[i].fd >= 0)
+			close_client(srv, &srv->clients[i], "shutdown");
+}
+
+void iq_server_free(struct iq_server *srv)
+{
+	if (srv->listen_fd >= 0)
+		close(srv->listen_fd);
+	if (srv->epoll_fd >= 0)
+		close(srv->epoll_fd);
+	if (srv->event_fd >= 0)
+		close(srv->event_fd);
+	srv->listen_fd = srv->epoll_fd = srv->event_fd = -1;
+
+	free(srv->pool);
+	free(srv->lens);
+	srv->pool = NULL;
+	srv->lens = NULL;
+}
+
+uint32_t iq_server_evicted(struct iq_server *srv)
+{
+	return srv->evicted;
+}
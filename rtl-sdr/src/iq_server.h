@@ -0,0 +1,182 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IQ_SERVER_H
+#define __IQ_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "iq_stream.h"
+
+/*
+ * rtl_tcp compatible IQ server for any number of clients on one dongle.
+ *
+ * The USB callback copies every buffer once into a broadcast ring and
+ * bumps its head; nothing else happens on that thread. A single epoll
+ * thread owns all sockets: every client has its own read position in the
+ * ring and is fed with non-blocking sendmsg() straight out of the ring
+ * slots, several slots per call.
+ *
+ * Nobody waits for a slow client. A client that falls more than
+ * slot_count - IQ_SERVER_GUARD buffers behind is disconnected, and so is
+ * one whose data was overwritten while it was being sent (checked after
+ * every send, like a seqlock reader).
+ *
+ * Every client first gets the header given at init (the dongle_info_t),
+ * then the live stream from the next buffer on. Five byte commands from
+ * the clients are handed to a callback on the server thread.
+ *
+ * Stream modes: the header goes out IQ_SERVER_HELLO_MS after connecting.
+ * Until then a client can ask for a reshaped stream (see iq_stream.h) with
+ * the commands below, none of which stock clients send:
+ *
+ *	0x40 decimation	channel of sample_rate / param, 1 for none
+ *	0x41 offset	channel center from the tuned frequency, Hz (int32)
+ *	0x42 codec	enum iq_codec
+ *	0x4f start	send the headers and start right away
+ *
+ * Once 0x4f arrived the dongle_info_t header is followed by a
+ * dongle_ext_info_t with what the server actually granted, then the
+ * reshaped stream. A client that sends nothing gets plain u8 IQ.
+ */
+
+#define IQ_SERVER_MAX_CLIENTS	8
+#define IQ_SERVER_GUARD		2	/* slots kept between writer and readers */
+#define IQ_SERVER_IOV		16	/* slots per sendmsg() */
+#define IQ_SERVER_HEADER	32
+#define IQ_SERVER_HELLO_MS	100
+#define IQ_SERVER_MAX_DECIM	256
+
+#define IQ_CMD_DECIM		0x40
+#define IQ_CMD_OFFSET		0x41
+#define IQ_CMD_CODEC		0x42
+#define IQ_CMD_START		0x4f
+
+typedef struct { /* integers in network byte order */
+	char magic[4];			/* "RTLX" */
+	uint32_t version;		/* 1 */
+	uint32_t codec;			/* enum iq_codec */
+	uint32_t decim;
+	uint32_t sample_rate;		/* of the stream, Hz */
+	uint32_t center_freq;		/* of the stream, Hz */
+	uint32_t block;			/* IQ_STREAM_BLOCK for IQ_CODEC_RICE */
+} dongle_ext_info_t;
+
+/* cmd and param (host byte order) of one client command */
+typedef void (*iq_server_command_t)(void *ctx, uint8_t cmd, uint32_t param);
+
+enum iq_client_state {
+	IQ_CLIENT_HELLO = 0,		/* waiting for stream mode commands */
+	IQ_CLIENT_RAW,			/* straight out of the ring */
+	IQ_CLIENT_STREAM		/* through its iq_stream */
+};
+
+struct iq_client {
+	int fd;
+	char name[64];			/* address:port, for the log */
+	enum iq_client_state state;
+	uint64_t hello_end;		/* ns, lat_now() clock */
+	unsigned char header[IQ_SERVER_HEADER + sizeof(dongle_ext_info_t)];
+	size_t header_len;
+	uint32_t seq;			/* next ring slot to send */
+	uint32_t offset;		/* bytes of the header, then of seq
+					   (or of chunk), sent */
+	int header_done;
+	int want_out;			/* socket full, waiting for EPOLLOUT */
+	unsigned char cmd[5];
+	unsigned int cmd_len;
+	uint64_t bytes;
+
+	/* requested with the stream mode commands */
+	uint32_t decim;
+	int32_t offset_hz;
+	uint32_t codec;
+	struct iq_stream stream;
+	const unsigned char *chunk;	/* reshaped slot being sent */
+	size_t chunk_len;
+};
+
+struct iq_server {
+	unsigned char *pool;
+	uint32_t *lens;
+	uint32_t slot_count;		/* power of two */
+	uint32_t slot_size;
+	uint32_t head;			/* slots published by the producer */
+
+	unsigned char header[IQ_SERVER_HEADER];
+	size_t header_len;
+
+	int listen_fd;
+	int epoll_fd;
+	int event_fd;
+
+	struct iq_client clients[IQ_SERVER_MAX_CLIENTS];
+	uint32_t n_clients;		/* read by the producer */
+	uint32_t evicted;
+
+	iq_server_command_t command;
+	void *ctx;
+
+	uint32_t center_freq;
+	uint32_t sample_rate;
+
+	pthread_t thread;
+	int started;
+	int stop;
+};
+
+/*!
+ * Allocate the ring and listen on addr:port.
+ *
+ * \param slot_count buffers kept for the clients, rounded up to a power of
+ *		     two
+ * \param slot_size largest buffer pushed, longer ones are truncated
+ * \param header sent first to every client, at most IQ_SERVER_HEADER bytes
+ * \return 0 on success, -1 on failure (the reason is printed)
+ */
+int iq_server_init(struct iq_server *srv, const char *addr, int port,
+		   uint32_t slot_count, uint32_t slot_size,
+		   const void *header, size_t header_len);
+
+/* command callback, set before iq_server_start() */
+void iq_server_set_command(struct iq_server *srv, iq_server_command_t command,
+			   void *ctx);
+
+/* what the dongle is tuned to, for stream modes; before iq_server_start() */
+void iq_server_set_tuning(struct iq_server *srv, uint32_t center_freq,
+			  uint32_t sample_rate);
+
+int iq_server_start(struct iq_server *srv);
+
+/*!
+ * Publish one buffer to every client. Producer (USB callback) side only,
+ * never blocks; does nothing while no client is connected.
+ */
+void iq_server_push(struct iq_server *srv, const unsigned char *buf,
+		    uint32_t len);
+
+/* disconnect everyone and join the thread */
+void iq_server_stop(struct iq_server *srv);
+
+void iq_server_free(struct iq_server *srv);
+
+/* number of clients dropped for being too slow */
+uint32_t iq_server_evicted(struct iq_server *srv);
+
+#endif /* __IQ_SERVER_H */
@@ -0,0 +1,347 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "iq_snapshot.h"
+#include "latency.h"
+#include "logger.h"
+
+int iq_snapshot_parse(unsigned int *pre_ms, unsigned int *post_ms,
+		      const char *arg)
+{
+	char *end;
+	long v;
+
+	v = strtol(arg, &end, 10);
+	if (end == arg || v < 0 || v > 60000 || (*end && *end != ':'))
+		return -1;
+	*pre_ms = (unsigned int)v;
+	if (!*end)
+		return 0;
+
+	arg = end + 1;
+	v = strtol(arg, &end, 10);
+	if (end == arg || *end || v < 0 || v > 60000)
+		return -1;
+	*post_ms = (unsigned int)v;
+
+	return 0;
+}
+
+static uint64_t ms_to_bytes(unsigned int ms, uint32_t sample_rate)
+{
+	return (uint64_t)ms * sample_rate / 1000 * 2;
+}
+
+int iq_snapshot_init(struct iq_snapshot *snap, const char *dir,
+		     uint32_t center_freq, uint32_t sample_rate,
+		     unsigned int pre_ms, unsigned int post_ms)
+{
+	memset(snap, 0, sizeof(*snap));
+
+	snap->center_freq = center_freq;
+	snap->sample_rate = sample_rate;
+	snap->pre = ms_to_bytes(pre_ms, sample_rate);
+	snap->post = ms_to_bytes(post_ms, sample_rate);
+	snap->size = (size_t)ms_to_bytes(pre_ms + post_ms + IQ_SNAPSHOT_SLACK_MS,
+					 sample_rate);
+
+	snap->dir = strdup(dir);
+	snap->hist = malloc(snap->size);
+	if (!snap->dir || !snap->hist) {
+		fprintf(stderr, "Failed to allocate %zu bytes of IQ history\n",
+			snap->size);
+		iq_snapshot_free(snap);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *iq_snapshot_fn(void *arg);
+
+int iq_snapshot_start(struct iq_snapshot *snap)
+{
+	pthread_mutex_init(&snap->lock, NULL);
+	pthread_cond_init(&snap->cond, NULL);
+
+	snap->started = 1;
+	if (pthread_create(&snap->thread, NULL, iq_snapshot_fn, snap)) {
+		snap->started = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+void iq_snapshot_push(struct iq_snapshot *snap, const unsigned char *buf,
+		      uint32_t len, uint64_t stamp)
+{
+	struct iq_snapshot_mark *mark;
+	uint64_t head = snap->head;
+	size_t off, n;
+
+	if (len > snap->size)
+		len = (uint32_t)snap->size;
+
+	/* announce the overwrite before doing it, the writer checks fill
+	 * after every write() */
+	__atomic_store_n(&snap->fill, head + len, __ATOMIC_SEQ_CST);
+
+	off = head % snap->size;
+	n = snap->size - off < len ? snap->size - off : len;
+	memcpy(snap->hist + off, buf, n);
+	memcpy(snap->hist, buf + n, len - n);
+
+	pthread_mutex_lock(&snap->lock);
+	snap->head = head + len;
+	mark = &snap->marks[snap->n_marks++ & (IQ_SNAPSHOT_MARKS - 1)];
+	mark->stamp = stamp;
+	mark->end = snap->head;
+	if (snap->waiting)
+		pthread_cond_signal(&snap->cond);
+	pthread_mutex_unlock(&snap->lock);
+}
+
+int iq_snapshot_trigger(struct iq_snapshot *snap, uint64_t t_usb,
+			const char *name)
+{
+	struct iq_snapshot_request *req;
+
+	pthread_mutex_lock(&snap->lock);
+	if (snap->p_head - snap->p_tail == IQ_SNAPSHOT_PENDING) {
+		snap->dropped++;
+		pthread_mutex_unlock(&snap->lock);
+		return -1;
+	}
+
+	req = &snap->pending[snap->p_head++ & (IQ_SNAPSHOT_PENDING - 1)];
+	req->t_usb = t_usb;
+	snprintf(req->name, sizeof(req->name), "%s", name ? name : "detection");
+	pthread_cond_signal(&snap->cond);
+	pthread_mutex_unlock(&snap->lock);
+
+	return 0;
+}
+
+/* history position at the end of the buffer stamped t_usb, under lock */
+static uint64_t find_trigger(struct iq_snapshot *snap, uint64_t t_usb)
+{
+	uint32_t n = snap->n_marks < IQ_SNAPSHOT_MARKS ?
+		     snap->n_marks : IQ_SNAPSHOT_MARKS;
+	uint64_t end = snap->head;
+	struct iq_snapshot_mark *mark;
+	uint32_t i;
+
+	if (!t_usb)
+		return end;
+
+	/* oldest buffer that completed at or after t_usb */
+	for (i = 1; i <= n; i++) {
+		mark = &snap->marks[(snap->n_marks - i) & (IQ_SNAPSHOT_MARKS - 1)];
+		if (mark->stamp < t_usb)
+			break;
+		end = mark->end;
+	}
+
+	return end;
+}
+
+static int open_file(struct iq_snapshot *snap,
+		     const struct iq_snapshot_request *req,
+		     char *path, size_t path_len)
+{
+	uint64_t wall = lat_to_wall(req->t_usb ? req->t_usb : lat_now());
+	time_t secs = (time_t)(wall / 1000000000ULL);
+	char name[IQ_SNAPSHOT_NAME], stamp[32];
+	struct tm tm;
+	size_t i;
+
+	/* rule names come from the rules file, keep them to one path level */
+	snprintf(name, sizeof(name), "%s", req->name);
+	for (i = 0; name[i]; i++)
+		if (name[i] == '/' || name[i] == ' ')
+			name[i] = '_';
+
+	gmtime_r(&secs, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%dT%H%M%S", &tm);
+	snprintf(path, path_len, "%s/%s_%s.%03uZ_%uHz_%usps.cu8", snap->dir,
+		 name, stamp, (unsigned int)(wall / 1000000 % 1000),
+		 snap->center_freq, snap->sample_rate);
+
+	return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+static int write_range(struct iq_snapshot *snap, int fd, uint64_t from,
+		       uint64_t to)
+{
+	size_t off, n;
+	ssize_t r;
+
+	while (from < to) {
+		off = from % snap->size;
+		n = snap->size - off;
+		if (n > to - from)
+			n = (size_t)(to - from);
+
+		r = write(fd, snap->hist + off, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		from += (uint64_t)r;
+	}
+
+	return 0;
+}
+
+/* the oldest position that is still intact */
+static uint64_t oldest(struct iq_snapshot *snap)
+{
+	uint64_t fill = __atomic_load_n(&snap->fill, __ATOMIC_SEQ_CST);
+
+	return fill > snap->size ? fill - snap->size : 0;
+}
+
+static void capture(struct iq_snapshot *snap,
+		    const struct iq_snapshot_request *req)
+{
+	char path[512];
+	uint64_t trig, start, end, cursor, avail;
+	int fd, short_read = 0;
+
+	pthread_mutex_lock(&snap->lock);
+	trig = find_trigger(snap, req->t_usb);
+	pthread_mutex_unlock(&snap->lock);
+
+	start = trig > snap->pre ? trig - snap->pre : 0;
+	end = trig + snap->post;
+	if (start < oldest(snap)) {
+		start = oldest(snap);
+		short_read = 1;
+	}
+	avail = start;
+
+	fd = open_file(snap, req, path, sizeof(path));
+	if (fd < 0) {
+		logger_printf(LOGGER_WARN, "Snapshot %s: %s", path, strerror(errno));
+		return;
+	}
+
+	for (cursor = start; cursor < end; cursor = avail) {
+		pthread_mutex_lock(&snap->lock);
+		while (snap->head <= cursor && !snap->stop) {
+			snap->waiting = 1;
+			pthread_cond_wait(&snap->cond, &snap->lock);
+			snap->waiting = 0;
+		}
+		avail = snap->head < end ? snap->head : end;
+		pthread_mutex_unlock(&snap->lock);
+
+		if (avail <= cursor) {
+			short_read = 1;		/* stopping */
+			break;
+		}
+
+		if (write_range(snap, fd, cursor, avail) < 0) {
+			logger_printf(LOGGER_WARN, "Snapshot %s: %s", path,
+				      strerror(errno));
+			short_read = 1;
+			avail = cursor;
+			break;
+		}
+
+		/* like a seqlock reader: was it overwritten while we wrote? */
+		if (cursor < oldest(snap)) {
+			if (ftruncate(fd, (off_t)(cursor - start)) < 0)
+				logger_printf(LOGGER_WARN, "Snapshot %s: %s", path,
+					      strerror(errno));
+			short_read = 1;
+			avail = cursor;
+			break;
+		}
+	}
+
+	/* SD cards: get it out now and keep the page cache for the detector */
+	fdatasync(fd);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+
+	snap->written++;
+	if (short_read)
+		snap->truncated++;
+	logger_printf(LOGGER_INFO, "Snapshot %s: %.1f ms%s", path,
+		      (double)(avail - start) / 2 * 1000 / snap->sample_rate,
+		      short_read ? " (truncated)" : "");
+}
+
+static void *iq_snapshot_fn(void *arg)
+{
+	struct iq_snapshot *snap = arg;
+	struct iq_snapshot_request req;
+
+	pthread_mutex_lock(&snap->lock);
+	for (;;) {
+		while (snap->p_head == snap->p_tail && !snap->stop)
+			pthread_cond_wait(&snap->cond, &snap->lock);
+		if (snap->p_head == snap->p_tail)
+			break;
+
+		req = snap->pending[snap->p_tail & (IQ_SNAPSHOT_PENDING - 1)];
+		pthread_mutex_unlock(&snap->lock);
+
+		capture(snap, &req);
+
+		pthread_mutex_lock(&snap->lock);
+		snap->p_tail++;
+	}
+	pthread_mutex_unlock(&snap->lock);
+
+	return NULL;
+}
+
+void iq_snapshot_stop(struct iq_snapshot *snap)
+{
+	if (!snap->started)
+		return;
+
+	pthread_mutex_lock(&snap->lock);
+	snap->stop = 1;
+	pthread_cond_signal(&snap->cond);
+	pthread_mutex_unlock(&snap->lock);
+	pthread_join(snap->thread, NULL);
+
+	pthread_cond_destroy(&snap->cond);
+	pthread_mutex_destroy(&snap->lock);
+	snap->started = 0;
+}
+
+void iq_snapshot_free(struct iq_snapshot *snap)
+{
+	free(snap->hist);
+	free(snap->dir);
+	snap->hist = NULL;
+	snap->dir = NULL;
+}
@@ -0,0 +1,127 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IQ_SNAPSHOT_H
+#define __IQ_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Raw IQ around each detection, for offline classification.
+ *
+ * Every sample buffer is copied into a history ring holding pre + post +
+ * IQ_SNAPSHOT_SLACK_MS worth of u8 IQ. A trigger names the t_usb of the
+ * detecting frame; a background thread then writes pre ms before the end
+ * of that buffer and post ms after it to
+ *
+ *	<dir>/<name>_<YYYYmmddTHHMMSS.mmm>Z_<center>Hz_<rate>sps.cu8
+ *
+ * as plain interleaved u8 IQ. The pre-trigger part is written right away,
+ * the rest as it arrives, straight out of the ring. A part that was
+ * overwritten before it made it to the file (the writer stalled for more
+ * than the slack) ends the snapshot early; it is counted as truncated.
+ *
+ * Files are synced and dropped from the page cache once complete, so a
+ * burst of snapshots doesn't push the detector out of memory.
+ */
+
+#define IQ_SNAPSHOT_PENDING	8	/* queued triggers, power of two */
+#define IQ_SNAPSHOT_MARKS	512	/* buffers remembered, power of two */
+#define IQ_SNAPSHOT_SLACK_MS	500
+#define IQ_SNAPSHOT_NAME	32
+
+struct iq_snapshot_mark {
+	uint64_t stamp;			/* USB completion of the buffer */
+	uint64_t end;			/* history position after it */
+};
+
+struct iq_snapshot_request {
+	uint64_t t_usb;
+	char name[IQ_SNAPSHOT_NAME];
+};
+
+struct iq_snapshot {
+	unsigned char *hist;
+	size_t size;
+	uint64_t head;			/* bytes published, under lock */
+	uint64_t fill;			/* bytes being written, atomic */
+
+	struct iq_snapshot_mark marks[IQ_SNAPSHOT_MARKS];
+	uint32_t n_marks;
+
+	char *dir;
+	uint32_t center_freq;
+	uint32_t sample_rate;
+	uint64_t pre;			/* bytes */
+	uint64_t post;
+
+	struct iq_snapshot_request pending[IQ_SNAPSHOT_PENDING];
+	uint32_t p_head;
+	uint32_t p_tail;
+
+	uint32_t written;
+	uint32_t dropped;		/* triggers that found the queue full */
+	uint32_t truncated;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int waiting;
+	int started;
+	int stop;
+};
+
+/*!
+ * Parse "pre_ms[:post_ms]".
+ *
+ * \return 0 on success, -1 on a malformed string
+ */
+int iq_snapshot_parse(unsigned int *pre_ms, unsigned int *post_ms,
+		      const char *arg);
+
+/*!
+ * Allocate the history for snapshots into dir.
+ *
+ * \return 0 on success, -1 on failure (the reason is printed)
+ */
+int iq_snapshot_init(struct iq_snapshot *snap, const char *dir,
+		     uint32_t center_freq, uint32_t sample_rate,
+		     unsigned int pre_ms, unsigned int post_ms);
+
+int iq_snapshot_start(struct iq_snapshot *snap);
+
+/* append one sample buffer, stamp as in fft_pipeline_push() */
+void iq_snapshot_push(struct iq_snapshot *snap, const unsigned char *buf,
+		      uint32_t len, uint64_t stamp);
+
+/*!
+ * Ask for a snapshot around the frame stamped t_usb. Never waits for the
+ * writer.
+ *
+ * \return 0 on success, -1 if too many snapshots are pending already
+ */
+int iq_snapshot_trigger(struct iq_snapshot *snap, uint64_t t_usb,
+			const char *name);
+
+/* finish what can be finished with the samples at hand, join the thread */
+void iq_snapshot_stop(struct iq_snapshot *snap);
+
+void iq_snapshot_free(struct iq_snapshot *snap);
+
+#endif /* __IQ_SNAPSHOT_H */
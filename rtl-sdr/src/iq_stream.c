@@ -0,0 +1,224 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "iq_stream.h"
+#include "iq_convert.h"
+
+#define CHAN_TAPS_PER_PHASE	8
+#define CHAN_CHUNK		16384	/* complex samples per channelizer run */
+
+#ifdef USE_FFTWF
+#define iq_u8_to_fft	iq_u8_to_f32
+#else
+#define iq_u8_to_fft	iq_u8_to_f64
+#endif
+
+int iq_stream_init(struct iq_stream *st, unsigned int decim, double offset,
+		   enum iq_codec codec, uint32_t max_len)
+{
+	memset(st, 0, sizeof(*st));
+
+	if (codec >= IQ_CODECS || !decim)
+		return -1;
+	st->codec = codec;
+	st->decim = decim;
+
+	if (decim > 1) {
+		if (channelizer_init(&st->chan, decim, CHAN_TAPS_PER_PHASE,
+				     offset, CHAN_CHUNK) < 0)
+			return -1;
+		st->chan_in = FFTW(malloc)(sizeof(fft_complex) * CHAN_CHUNK);
+		st->chan_out = FFTW(malloc)(sizeof(fft_complex) *
+					    (CHAN_CHUNK / decim + 1));
+		st->iq = malloc(max_len / decim + 2 * (max_len / (2 * CHAN_CHUNK) + 1));
+		if (!st->chan_in || !st->chan_out || !st->iq)
+			goto fail;
+	}
+
+	/* worst case: every block stored uncoded behind its header */
+	st->out_size = max_len + 3 * (max_len / IQ_STREAM_BLOCK + 1);
+	st->out = malloc(st->out_size);
+	if (!st->out)
+		goto fail;
+
+	return 0;
+
+fail:
+	iq_stream_free(st);
+	return -1;
+}
+
+void iq_stream_free(struct iq_stream *st)
+{
+	if (st->decim > 1)
+		channelizer_free(&st->chan);
+	if (st->chan_in)
+		FFTW(free)(st->chan_in);
+	if (st->chan_out)
+		FFTW(free)(st->chan_out);
+	free(st->iq);
+	free(st->out);
+	memset(st, 0, sizeof(*st));
+}
+
+static unsigned char requantize(fft_real v)
+{
+	long q = lrint(v + 128);
+
+	if (q < 0)
+		return 0;
+	if (q > 255)
+		return 255;
+	return (unsigned char)q;
+}
+
+static size_t channel_run(struct iq_stream *st, const unsigned char *in,
+			  uint32_t len)
+{
+	unsigned long n, n_out, i;
+	size_t pos = 0;
+
+	while (len >= 2) {
+		n = len / 2;
+		if (n > CHAN_CHUNK)
+			n = CHAN_CHUNK;
+
+		iq_u8_to_fft((fft_real *)st->chan_in, in, 2 * n, 128);
+		n_out = channelizer_run(&st->chan, st->chan_in, n, st->chan_out);
+		for (i = 0; i < n_out; i++) {
+			st->iq[pos++] = requantize(st->chan_out[i][0]);
+			st->iq[pos++] = requantize(st->chan_out[i][1]);
+		}
+
+		in += 2 * n;
+		len -= 2 * n;
+	}
+
+	return pos;
+}
+
+static size_t pack4(unsigned char *out, const unsigned char *in, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		*out++ = (in[i] & 0xf0) | (in[i + 1] >> 4);
+
+	return len / 2;
+}
+
+static inline unsigned int zigzag(unsigned char v)
+{
+	int s = (int)v - 128;
+
+	return s >= 0 ? (unsigned int)s << 1 : ((unsigned int)-s << 1) - 1;
+}
+
+/* one Rice coded block, uncoded if that comes out shorter */
+static size_t rice_block(unsigned char *out, const unsigned char *in, size_t n)
+{
+	unsigned char *p = out + 3;
+	unsigned long sum = 0, bits = 0;
+	uint32_t acc = 0;
+	unsigned int k = 0, z, q, used = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sum += zigzag(in[i]);
+	while (k < 7 && ((unsigned long)n << (k + 1)) <= sum)
+		k++;
+
+	for (i = 0; i < n; i++)
+		bits += (zigzag(in[i]) >> k) + 1 + k;
+
+	out[0] = (unsigned char)(n >> 8);
+	out[1] = (unsigned char)n;
+
+	if ((bits + 7) / 8 >= n) {
+		out[2] = IQ_STREAM_RAW_BLOCK;
+		memcpy(p, in, n);
+		return 3 + n;
+	}
+	out[2] = (unsigned char)k;
+
+	for (i = 0; i < n; i++) {
+		z = zigzag(in[i]);
+
+		/* unary part, flushed a byte at a time */
+		for (q = z >> k; q; q--) {
+			acc = acc << 1 | 1;
+			if (++used == 8) {
+				*p++ = (unsigned char)acc;
+				acc = used = 0;
+			}
+		}
+
+		/* the stop bit and the k low bits, at most 8 bits */
+		acc = acc << (k + 1) | (z & ((1U << k) - 1));
+		used += k + 1;
+		while (used >= 8) {
+			used -= 8;
+			*p++ = (unsigned char)(acc >> used);
+		}
+		acc &= (1U << used) - 1;
+	}
+	if (used)
+		*p++ = (unsigned char)(acc << (8 - used));
+
+	return p - out;
+}
+
+static size_t rice(unsigned char *out, const unsigned char *in, size_t len)
+{
+	size_t pos = 0, n;
+
+	while (len) {
+		n = len > IQ_STREAM_BLOCK ? IQ_STREAM_BLOCK : len;
+		pos += rice_block(out + pos, in, n);
+		in += n;
+		len -= n;
+	}
+
+	return pos;
+}
+
+size_t iq_stream_run(struct iq_stream *st, const unsigned char *in,
+		     uint32_t len, const unsigned char **out)
+{
+	size_t n = len;
+
+	if (st->decim > 1) {
+		n = channel_run(st, in, len);
+		in = st->iq;
+	}
+
+	switch (st->codec) {
+	case IQ_CODEC_PACK4:
+		*out = st->out;
+		return pack4(st->out, in, n);
+	case IQ_CODEC_RICE:
+		*out = st->out;
+		return rice(st->out, in, n);
+	default:
+		*out = in;
+		return n;
+	}
+}
@@ -0,0 +1,93 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IQ_STREAM_H
+#define __IQ_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "channelizer.h"
+
+/*
+ * Per client reshaping of the u8 IQ stream for slow links: an optional
+ * channel of rate / decim around an offset, then one of the codecs below.
+ * The output is always whole bytes per input buffer, a client can decode
+ * each chunk as it comes.
+ *
+ * IQ_CODEC_RAW	  interleaved u8 IQ as from the dongle
+ *
+ * IQ_CODEC_PACK4 the upper four bits of every u8, two per byte, the
+ *		  earlier one in the high nibble (lossy, half the size);
+ *		  decode as (nibble << 4) | 8
+ *
+ * IQ_CODEC_RICE  lossless, in blocks of up to IQ_STREAM_BLOCK bytes:
+ *		  uint16 n (network order), uint8 k, then for each of the n
+ *		  bytes v the zigzag folded z of (int8)(v - 128) as Rice code
+ *		  with parameter k: z >> k one bits, a zero bit, the low k
+ *		  bits of z; MSB first, padded to a byte. k == 0xff means the
+ *		  n bytes follow uncoded.
+ *
+ * With decimation the channel is requantized to u8 at unity gain before
+ * the codec.
+ */
+
+#define IQ_STREAM_BLOCK		4096
+#define IQ_STREAM_RAW_BLOCK	0xff
+
+enum iq_codec {
+	IQ_CODEC_RAW = 0,
+	IQ_CODEC_PACK4,
+	IQ_CODEC_RICE,
+	IQ_CODECS
+};
+
+struct iq_stream {
+	enum iq_codec codec;
+	unsigned int decim;		/* 1 for the full rate */
+	struct channelizer chan;
+	fft_complex *chan_in;
+	fft_complex *chan_out;
+	unsigned char *iq;		/* requantized channel */
+
+	unsigned char *out;
+	size_t out_size;
+};
+
+/*!
+ * Allocate the buffers for input chunks of up to max_len bytes.
+ *
+ * \param decim channel decimation, 1 for none
+ * \param offset channel center relative to the tuned center, in cycles per
+ *		 input sample (-0.5 to 0.5)
+ * \return 0 on success, -1 on bad parameters or allocation failure
+ */
+int iq_stream_init(struct iq_stream *st, unsigned int decim, double offset,
+		   enum iq_codec codec, uint32_t max_len);
+
+void iq_stream_free(struct iq_stream *st);
+
+/*!
+ * Reshape one chunk of u8 IQ.
+ *
+ * \param out set to the result, valid until the next call
+ * \return number of bytes in out
+ */
+size_t iq_stream_run(struct iq_stream *st, const unsigned char *in,
+		     uint32_t len, const unsigned char **out);
+
+#endif /* __IQ_STREAM_H */
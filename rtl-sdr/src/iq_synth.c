@@ -0,0 +1,204 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "iq_synth.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+void iq_synth_init(struct iq_synth *syn, uint32_t sample_rate,
+		   double noise_rms, uint64_t seed)
+{
+	memset(syn, 0, sizeof(*syn));
+	syn->sample_rate = sample_rate;
+	syn->noise_rms = noise_rms;
+	syn->rng = seed ? seed : 0x9e3779b97f4a7c15ULL;
+}
+
+int iq_synth_add(struct iq_synth *syn, const char *spec)
+{
+	struct iq_synth_signal *sig;
+	double v[5];
+	unsigned int n = 0, want;
+	const char *p;
+	char *end;
+
+	if (syn->n_signals == IQ_SYNTH_MAX)
+		return -1;
+	sig = &syn->signals[syn->n_signals];
+	memset(sig, 0, sizeof(*sig));
+
+	if (!strncmp(spec, "tone:", 5)) {
+		sig->kind = IQ_SYNTH_TONE;
+		want = 2;
+	} else if (!strncmp(spec, "burst:", 6)) {
+		sig->kind = IQ_SYNTH_BURST;
+		want = 4;
+	} else if (!strncmp(spec, "chirp:", 6)) {
+		sig->kind = IQ_SYNTH_CHIRP;
+		want = 5;
+	} else {
+		return -1;
+	}
+
+	p = strchr(spec, ':') + 1;
+	while (n < want) {
+		v[n++] = strtod(p, &end);
+		if (end == p || (n < want && *end != ':') || (n == want && *end))
+			return -1;
+		p = end + 1;
+	}
+
+	sig->freq = v[0];
+	if (sig->kind == IQ_SYNTH_CHIRP) {
+		sig->freq_end = v[1];
+		sig->snr_db = v[2];
+		sig->on = v[3];
+		sig->period = v[4];
+	} else {
+		sig->snr_db = v[1];
+		if (sig->kind == IQ_SYNTH_BURST) {
+			sig->on = v[2];
+			sig->period = v[3];
+		}
+	}
+	if (sig->kind != IQ_SYNTH_TONE &&
+	    (sig->on <= 0 || sig->period < sig->on))
+		return -1;
+
+	/* tone power A^2 over the complex noise power 2 * rms^2 */
+	sig->amplitude = sqrt(2 * syn->noise_rms * syn->noise_rms *
+			      pow(10, sig->snr_db / 10));
+	syn->n_signals++;
+
+	return 0;
+}
+
+/* xorshift64*, uniform in (0, 1) */
+static double uniform(struct iq_synth *syn)
+{
+	syn->rng ^= syn->rng >> 12;
+	syn->rng ^= syn->rng << 25;
+	syn->rng ^= syn->rng >> 27;
+	return ((syn->rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / 9007199254740992.0) +
+	       (0.5 / 9007199254740992.0);
+}
+
+static double gaussian(struct iq_synth *syn)
+{
+	double r, a;
+
+	if (syn->have_spare) {
+		syn->have_spare = 0;
+		return syn->spare;
+	}
+
+	r = sqrt(-2 * log(uniform(syn)));
+	a = 2 * M_PI * uniform(syn);
+	syn->spare = r * sin(a);
+	syn->have_spare = 1;
+
+	return r * cos(a);
+}
+
+/* seconds into the current on period of sig, negative while off */
+static double on_time(const struct iq_synth_signal *sig, double t)
+{
+	double in;
+
+	if (sig->kind == IQ_SYNTH_TONE)
+		return t;
+
+	in = fmod(t, sig->period);
+	return in < sig->on ? in : -1;
+}
+
+static unsigned char quantize(double v)
+{
+	long q = lrint(v + 127.5);
+
+	if (q < 0)
+		return 0;
+	if (q > 255)
+		return 255;
+	return (unsigned char)q;
+}
+
+void iq_synth_run(struct iq_synth *syn, unsigned char *buf, uint32_t len)
+{
+	struct iq_synth_signal *sig;
+	double t, in, f, re, im;
+	uint32_t i;
+	unsigned int k;
+
+	for (i = 0; i + 1 < len; i += 2, syn->pos++) {
+		t = (double)syn->pos / syn->sample_rate;
+		re = syn->noise_rms * gaussian(syn);
+		im = syn->noise_rms * gaussian(syn);
+
+		for (k = 0; k < syn->n_signals; k++) {
+			sig = &syn->signals[k];
+			in = on_time(sig, t);
+			if (in < 0)
+				continue;
+
+			f = sig->freq;
+			if (sig->kind == IQ_SYNTH_CHIRP)
+				f += (sig->freq_end - sig->freq) * in / sig->on;
+
+			/* phase accumulates, so chirps and bursts stay continuous */
+			sig->phase += f / syn->sample_rate;
+			sig->phase -= floor(sig->phase);
+			re += sig->amplitude * cos(2 * M_PI * sig->phase);
+			im += sig->amplitude * sin(2 * M_PI * sig->phase);
+		}
+
+		buf[i] = quantize(re);
+		buf[i + 1] = quantize(im);
+	}
+}
+
+double iq_synth_on_fraction(const struct iq_synth *syn, unsigned int sig,
+			    uint64_t from, uint64_t to)
+{
+	const struct iq_synth_signal *s = &syn->signals[sig];
+	double a = (double)from / syn->sample_rate;
+	double b = (double)to / syn->sample_rate;
+	double start, on = 0;
+
+	if (to <= from)
+		return 0;
+	if (s->kind == IQ_SYNTH_TONE)
+		return 1;
+
+	/* every on window that can overlap [a, b) */
+	for (start = floor(a / s->period) * s->period; start < b;
+	     start += s->period) {
+		double lo = start > a ? start : a;
+		double hi = start + s->on < b ? start + s->on : b;
+
+		if (hi > lo)
+			on += hi - lo;
+	}
+
+	return on / (b - a);
+}
@@ -0,0 +1,95 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __IQ_SYNTH_H
+#define __IQ_SYNTH_H
+
+#include <stdint.h>
+
+/*
+ * Synthetic u8 IQ as a dongle would deliver it: white Gaussian noise plus
+ * any number of signals, quantized around 127.5. The same parameters and
+ * seed always give the same samples.
+ *
+ * Signals, frequencies in Hz from the tuned center, snr in dB of the
+ * signal power over the noise power in the full sample rate bandwidth
+ * (a 2^n point FFT adds 10 * log10(2^n) dB of processing gain on a tone):
+ *
+ *	tone:freq:snr				always on
+ *	burst:freq:snr:on_s:period_s		tone on for on_s every period_s
+ *	chirp:freq:freq_end:snr:on_s:period_s	linear sweep over on_s every
+ *						period_s
+ *
+ * Every signal knows when it is on, which gives the detection benchmark
+ * its ground truth.
+ */
+
+#define IQ_SYNTH_MAX		8
+
+enum iq_synth_kind {
+	IQ_SYNTH_TONE = 0,
+	IQ_SYNTH_BURST,
+	IQ_SYNTH_CHIRP
+};
+
+struct iq_synth_signal {
+	enum iq_synth_kind kind;
+	double freq;			/* Hz from the center */
+	double freq_end;		/* chirp only */
+	double snr_db;
+	double on;			/* s, bursts and chirps */
+	double period;			/* s */
+
+	double amplitude;		/* u8 steps */
+	double phase;			/* cycles */
+};
+
+struct iq_synth {
+	uint32_t sample_rate;
+	double noise_rms;		/* per component, u8 steps */
+	struct iq_synth_signal signals[IQ_SYNTH_MAX];
+	unsigned int n_signals;
+
+	uint64_t pos;			/* samples generated */
+	uint64_t rng;
+	double spare;			/* second Box-Muller output */
+	int have_spare;
+};
+
+/* noise_rms per I and Q component in u8 steps, 0 < noise_rms < 40 */
+void iq_synth_init(struct iq_synth *syn, uint32_t sample_rate,
+		   double noise_rms, uint64_t seed);
+
+/*!
+ * Add a signal, see above for the syntax.
+ *
+ * \return 0 on success, -1 on a malformed spec or too many signals
+ */
+int iq_synth_add(struct iq_synth *syn, const char *spec);
+
+/* len bytes (len / 2 samples) of u8 IQ */
+void iq_synth_run(struct iq_synth *syn, unsigned char *buf, uint32_t len);
+
+/*!
+ * How much of samples [from, to) signal sig was on for.
+ *
+ * \return fraction from 0 to 1
+ */
+double iq_synth_on_fraction(const struct iq_synth *syn, unsigned int sig,
+			    uint64_t from, uint64_t to);
+
+#endif /* __IQ_SYNTH_H */
@@ -0,0 +1,142 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <time.h>
+
+#include "latency.h"
+
+#define HALF_SUB	(LAT_SUB_BUCKETS / 2)
+
+uint64_t lat_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t lat_to_wall(uint64_t mono)
+{
+	struct timespec ts;
+	uint64_t now, wall;
+
+	now = lat_now();
+	clock_gettime(CLOCK_REALTIME, &ts);
+	wall = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	return mono <= now ? wall - (now - mono) : wall;
+}
+
+static unsigned int msb64(uint64_t v)
+{
+	unsigned int n = 0;
+
+	while (v >>= 1)
+		n++;
+
+	return n;
+}
+
+/*
+ * Values below LAT_SUB_BUCKETS are counted exactly. Above that, a value
+ * with its top bit at position m keeps its LAT_SUB_BITS leading bits, which
+ * leaves HALF_SUB distinct buckets per power of two.
+ */
+static unsigned int lat_index(uint64_t v)
+{
+	unsigned int m, shift;
+
+	if (v < LAT_SUB_BUCKETS)
+		return (unsigned int)v;
+
+	m = msb64(v);
+	if (m >= LAT_MAX_BITS)
+		return LAT_BUCKETS - 1;
+
+	shift = m - LAT_SUB_BITS + 1;
+	return LAT_SUB_BUCKETS + (m - LAT_SUB_BITS) * HALF_SUB +
+	       (unsigned int)(v >> shift) - HALF_SUB;
+}
+
+/* largest value that lands in bucket idx */
+static uint64_t lat_upper(unsigned int idx)
+{
+	unsigned int octave, sub;
+
+	if (idx < LAT_SUB_BUCKETS)
+		return idx;
+
+	octave = (idx - LAT_SUB_BUCKETS) / HALF_SUB;
+	sub = (idx - LAT_SUB_BUCKETS) % HALF_SUB + HALF_SUB;
+
+	return (((uint64_t)sub + 1) << (octave + 1)) - 1;
+}
+
+void lat_record(struct lat_hist *h, uint64_t ns)
+{
+	__atomic_add_fetch(&h->counts[lat_index(ns)], 1, __ATOMIC_RELAXED);
+}
+
+uint64_t lat_percentile(const struct lat_hist *h, double pct, uint32_t *total)
+{
+	uint32_t counts[LAT_BUCKETS];
+	uint64_t sum = 0, rank, seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		counts[i] = __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+		sum += counts[i];
+	}
+
+	if (total)
+		*total = (uint32_t)sum;
+	if (!sum)
+		return 0;
+
+	rank = (uint64_t)(pct / 100.0 * sum + 0.5);
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < LAT_BUCKETS; i++) {
+		seen += counts[i];
+		if (seen >= rank)
+			return lat_upper(i);
+	}
+
+	return lat_upper(LAT_BUCKETS - 1);
+}
+
+void lat_dump(FILE *f, struct lat_hist *hists, unsigned int n)
+{
+	static const double pcts[] = { 50, 90, 99, 99.9, 100 };
+	unsigned int i, k;
+	uint32_t total;
+
+	fprintf(f, "%-24s %10s %10s %10s %10s %10s %10s\n", "latency (us)",
+		"count", "p50", "p90", "p99", "p99.9", "max");
+
+	for (i = 0; i < n; i++) {
+		lat_percentile(&hists[i], 0, &total);
+		fprintf(f, "%-24s %10u", hists[i].name, total);
+		for (k = 0; k < sizeof(pcts) / sizeof(pcts[0]); k++)
+			fprintf(f, " %10.1f",
+				lat_percentile(&hists[i], pcts[k], NULL) / 1000.0);
+		fprintf(f, "\n");
+	}
+
+	fflush(f);
+}
@@ -0,0 +1,79 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Latency histograms in the style of HdrHistogram: every power of two range
+ * is split into LAT_SUB_BUCKETS / 2 linear buckets, so any value is kept
+ * with about 3% precision from 1 ns up to 2^LAT_MAX_BITS ns (18 minutes)
+ * in a fixed 4.5 KB of counters.
+ *
+ * Recording is one relaxed atomic increment, any thread may record into any
+ * histogram and a dump may run concurrently. Counters are 32 bit so ARMv6
+ * doesn't need libatomic. A dump sees a snapshot that is at most a few
+ * samples stale.
+ *
+ * All times are CLOCK_MONOTONIC nanoseconds, the same clock librtlsdr
+ * stamps buffers with (see rtlsdr_get_buffer_time()).
+ */
+
+#define LAT_SUB_BITS		6
+#define LAT_SUB_BUCKETS		(1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS		40
+#define LAT_BUCKETS		(LAT_SUB_BUCKETS + \
+				 (LAT_MAX_BITS - LAT_SUB_BITS) * (LAT_SUB_BUCKETS / 2))
+
+struct lat_hist {
+	const char *name;
+	uint32_t counts[LAT_BUCKETS];
+};
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t lat_now(void);
+
+/* CLOCK_REALTIME in nanoseconds of a lat_now() stamp from the past */
+uint64_t lat_to_wall(uint64_t mono);
+
+/* add one sample, lock free */
+void lat_record(struct lat_hist *h, uint64_t ns);
+
+/* record end - start, ignoring samples where a stamp is missing */
+static inline void lat_record_span(struct lat_hist *h, uint64_t start,
+				   uint64_t end)
+{
+	if (start && end >= start)
+		lat_record(h, end - start);
+}
+
+/*!
+ * Value at a percentile.
+ *
+ * \param pct percentile, 0-100
+ * \param total set to the number of samples, may be NULL
+ * \return the upper edge of the bucket holding the percentile, in ns
+ */
+uint64_t lat_percentile(const struct lat_hist *h, double pct, uint32_t *total);
+
+/* print one line per histogram: count and the usual percentiles in us */
+void lat_dump(FILE *f, struct lat_hist *hists, unsigned int n);
+
+#endif /* __LATENCY_H */
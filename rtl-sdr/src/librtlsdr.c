@@ -24,10 +24,12 @@
 #include <stdlib.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <time.h>
 #define min(a, b) (((a) < (b)) ? (a) : (b))
 #endif
 
 #include <libusb.h>
+#include <pthread.h>
 
 /*
  * All libusb callback functions should be marked with the LIBUSB_CALL macro
@@ -96,8 +98,19 @@ struct rtlsdr_dev {
 	struct libusb_transfer **xfer;
 	unsigned char **xfer_buf;
 	rtlsdr_read_async_cb_t cb;
+	rtlsdr_read_async_zc_cb_t zc_cb;
 	void *cb_ctx;
 	enum rtlsdr_async_status async_status;
+	/* zero-copy buffer lending, all protected by xfer_lock */
+	pthread_mutex_t xfer_lock;
+	uint32_t xfer_pool_num;	/* xfer_buf_num + spare buffers */
+	unsigned char **xfer_spare;	/* buffers ready to be submitted */
+	uint32_t xfer_spare_cnt;
+	struct libusb_transfer **xfer_parked; /* completed, waiting for a buffer */
+	uint32_t xfer_parked_cnt;
+	uint32_t xfer_lent;
+	int xfer_pool_orphaned;	/* async stopped while buffers were lent */
+	uint64_t xfer_time;	/* completion of the buffer being delivered, ns */
 	/* rtl demod context */
 	uint32_t rate; /* Hz */
 	uint32_t rtl_xtal; /* Hz */
@@ -121,6 +134,7 @@ struct rtlsdr_dev {
 };
 
 void rtlsdr_set_gpio_bit(rtlsdr_dev_t *dev, uint8_t gpio, int val);
+static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev);
 
 /* generic tuner interface functions, shall be moved to the tuner implementations */
 int e4000_init(void *dev) {
@@ -1398,6 +1412,7 @@ int rtlsdr_open(rtlsdr_dev_t **out_dev, uint32_t index)
 
 	memset(dev, 0, sizeof(rtlsdr_dev_t));
 	memcpy(dev->fir, fir_default, sizeof(fir_default));
+	pthread_mutex_init(&dev->xfer_lock, NULL);
 
 	libusb_init(&dev->ctx);
 
@@ -1569,6 +1584,7 @@ err:
 		if (dev->ctx)
 			libusb_exit(dev->ctx);
 
+		pthread_mutex_destroy(&dev->xfer_lock);
 		free(dev);
 	}
 
@@ -1609,6 +1625,12 @@ int rtlsdr_close(rtlsdr_dev_t *dev)
 
 	libusb_close(dev->devh);
 	libusb_exit(dev->ctx);
+
+	/* buffers still lent to the application become invalid here */
+	dev->xfer_lent = 0;
+	_rtlsdr_free_async_buffers(dev);
+	pthread_mutex_destroy(&dev->xfer_lock);
+
 	free(dev);
 	return 0;
 }
@@ -1635,9 +1657,41 @@ int rtlsdr_read_sync(rtlsdr_dev_t *dev, void *buf, int len, int *n_read)
 static void LIBUSB_CALL _libusb_callback(struct libusb_transfer *xfer)
 {
 	rtlsdr_dev_t *dev = (rtlsdr_dev_t *)xfer->user_data;
+	int kept;
+#ifndef _WIN32
+	struct timespec ts;
+#endif
 
 	if (LIBUSB_TRANSFER_COMPLETED == xfer->status) {
-		if (dev->cb)
+#ifndef _WIN32
+		/* stamped before anything else so queueing shows up as latency */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		dev->xfer_time = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+		if (dev->zc_cb) {
+			/* count the buffer as lent up front, the application
+			 * may release it before the callback even returns */
+			pthread_mutex_lock(&dev->xfer_lock);
+			dev->xfer_lent++;
+			pthread_mutex_unlock(&dev->xfer_lock);
+
+			kept = dev->zc_cb(xfer->buffer, xfer->actual_length,
+					  dev->cb_ctx);
+
+			pthread_mutex_lock(&dev->xfer_lock);
+			if (!kept) {
+				dev->xfer_lent--;
+			} else if (dev->xfer_spare_cnt) {
+				/* application keeps the buffer, swap in a spare */
+				xfer->buffer = dev->xfer_spare[--dev->xfer_spare_cnt];
+			} else {
+				/* resubmitted by the next rtlsdr_release_buffer() */
+				dev->xfer_parked[dev->xfer_parked_cnt++] = xfer;
+				pthread_mutex_unlock(&dev->xfer_lock);
+				return;
+			}
+			pthread_mutex_unlock(&dev->xfer_lock);
+		} else if (dev->cb)
 			dev->cb(xfer->buffer, xfer->actual_length, dev->cb_ctx);
 
 		libusb_submit_transfer(xfer); /* resubmit transfer */
@@ -1665,7 +1719,7 @@ int rtlsdr_wait_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx)
 	return rtlsdr_read_async(dev, cb, ctx, 0, 0);
 }
 
-static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
+static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev, uint32_t spare_num)
 {
 	unsigned int i;
 
@@ -1681,13 +1735,27 @@ static int _rtlsdr_alloc_async_buffers(rtlsdr_dev_t *dev)
 	}
 
 	if (!dev->xfer_buf) {
-		dev->xfer_buf = malloc(dev->xfer_buf_num *
+		dev->xfer_pool_num = dev->xfer_buf_num + spare_num;
+		dev->xfer_buf = malloc(dev->xfer_pool_num *
 					   sizeof(unsigned char *));
 
-		for(i = 0; i < dev->xfer_buf_num; ++i)
+		for(i = 0; i < dev->xfer_pool_num; ++i)
 			dev->xfer_buf[i] = malloc(dev->xfer_buf_len);
 	}
 
+	/* the buffers past xfer_buf_num are the spares for lending, the stack
+	 * is sized for the whole pool since parked transfers hold no buffer */
+	dev->xfer_spare = malloc(dev->xfer_pool_num * sizeof(unsigned char *));
+	for(i = 0; i < spare_num; ++i)
+		dev->xfer_spare[i] = dev->xfer_buf[dev->xfer_buf_num + i];
+	dev->xfer_spare_cnt = spare_num;
+
+	dev->xfer_parked = malloc(dev->xfer_buf_num *
+				  sizeof(struct libusb_transfer *));
+	dev->xfer_parked_cnt = 0;
+	dev->xfer_lent = 0;
+	dev->xfer_pool_orphaned = 0;
+
 	return 0;
 }
 
@@ -1709,8 +1777,22 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 		dev->xfer = NULL;
 	}
 
+	free(dev->xfer_parked);
+	dev->xfer_parked = NULL;
+	dev->xfer_parked_cnt = 0;
+
+	/* lent buffers stay valid until the application gives them back */
+	if (dev->xfer_lent) {
+		dev->xfer_pool_orphaned = 1;
+		return 0;
+	}
+
+	free(dev->xfer_spare);
+	dev->xfer_spare = NULL;
+	dev->xfer_spare_cnt = 0;
+
 	if (dev->xfer_buf) {
-		for(i = 0; i < dev->xfer_buf_num; ++i) {
+		for(i = 0; i < dev->xfer_pool_num; ++i) {
 			if (dev->xfer_buf[i])
 				free(dev->xfer_buf[i]);
 		}
@@ -1719,11 +1801,16 @@ static int _rtlsdr_free_async_buffers(rtlsdr_dev_t *dev)
 		dev->xfer_buf = NULL;
 	}
 
+	dev->xfer_pool_num = 0;
+	dev->xfer_pool_orphaned = 0;
+
 	return 0;
 }
 
-int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
-			  uint32_t buf_num, uint32_t buf_len)
+static int _rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb,
+			      rtlsdr_read_async_zc_cb_t zc_cb, void *ctx,
+			      uint32_t buf_num, uint32_t buf_len,
+			      uint32_t spare_num)
 {
 	unsigned int i;
 	int r = 0;
@@ -1733,12 +1820,13 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	if (!dev)
 		return -1;
 
-	if (RTLSDR_INACTIVE != dev->async_status)
+	if (RTLSDR_INACTIVE != dev->async_status || dev->xfer_pool_orphaned)
 		return -2;
 
 	dev->async_status = RTLSDR_RUNNING;
 
 	dev->cb = cb;
+	dev->zc_cb = zc_cb;
 	dev->cb_ctx = ctx;
 
 	if (buf_num > 0)
@@ -1751,7 +1839,7 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 	else
 		dev->xfer_buf_len = DEFAULT_BUF_LENGTH;
 
-	_rtlsdr_alloc_async_buffers(dev);
+	_rtlsdr_alloc_async_buffers(dev, spare_num);
 
 	for(i = 0; i < dev->xfer_buf_num; ++i) {
 		libusb_fill_bulk_transfer(dev->xfer[i],
@@ -1786,6 +1874,10 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 			if (!dev->xfer)
 				break;
 
+			/* keep rtlsdr_release_buffer() from resubmitting a
+			 * parked transfer behind our back */
+			pthread_mutex_lock(&dev->xfer_lock);
+			dev->xfer_parked_cnt = 0;
 			for(i = 0; i < dev->xfer_buf_num; ++i) {
 				if (!dev->xfer[i])
 					continue;
@@ -1799,6 +1891,7 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 					next_status = RTLSDR_CANCELING;
 				}
 			}
+			pthread_mutex_unlock(&dev->xfer_lock);
 
 			if (dev->dev_lost || RTLSDR_INACTIVE == next_status) {
 				libusb_handle_events_timeout(dev->ctx, &tv);
@@ -1807,9 +1900,81 @@ int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
 		}
 	}
 
+	pthread_mutex_lock(&dev->xfer_lock);
 	_rtlsdr_free_async_buffers(dev);
-
 	dev->async_status = next_status;
+	pthread_mutex_unlock(&dev->xfer_lock);
+
+	return r;
+}
+
+int rtlsdr_read_async(rtlsdr_dev_t *dev, rtlsdr_read_async_cb_t cb, void *ctx,
+			  uint32_t buf_num, uint32_t buf_len)
+{
+	return _rtlsdr_read_async(dev, cb, NULL, ctx, buf_num, buf_len, 0);
+}
+
+int rtlsdr_read_async_zerocopy(rtlsdr_dev_t *dev,
+			       rtlsdr_read_async_zc_cb_t cb, void *ctx,
+			       uint32_t buf_num, uint32_t buf_len,
+			       uint32_t spare_num)
+{
+	if (!cb)
+		return -1;
+
+	return _rtlsdr_read_async(dev, NULL, cb, ctx, buf_num, buf_len,
+				  spare_num ? spare_num : DEFAULT_BUF_NUMBER);
+}
+
+int rtlsdr_get_buffer_time(rtlsdr_dev_t *dev, uint64_t *ns)
+{
+#ifndef _WIN32
+	if (!dev || !ns)
+		return -1;
+
+	*ns = dev->xfer_time;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int rtlsdr_release_buffer(rtlsdr_dev_t *dev, unsigned char *buf)
+{
+	struct libusb_transfer *xfer = NULL;
+	unsigned int i;
+	int r = 0;
+
+	if (!dev || !buf)
+		return -1;
+
+	pthread_mutex_lock(&dev->xfer_lock);
+
+	for (i = 0; i < dev->xfer_pool_num; ++i)
+		if (dev->xfer_buf[i] == buf)
+			break;
+
+	if (i == dev->xfer_pool_num || !dev->xfer_lent) {
+		pthread_mutex_unlock(&dev->xfer_lock);
+		return -1;
+	}
+
+	dev->xfer_lent--;
+
+	if (dev->xfer_pool_orphaned) {
+		/* streaming is over, the last release frees the pool */
+		if (!dev->xfer_lent)
+			_rtlsdr_free_async_buffers(dev);
+	} else if (RTLSDR_RUNNING == dev->async_status &&
+		   dev->xfer_parked_cnt) {
+		xfer = dev->xfer_parked[--dev->xfer_parked_cnt];
+		xfer->buffer = buf;
+		r = libusb_submit_transfer(xfer);
+	} else {
+		dev->xfer_spare[dev->xfer_spare_cnt++] = buf;
+	}
+
+	pthread_mutex_unlock(&dev->xfer_lock);
 
 	return r;
 }
@@ -1836,6 +2001,14 @@ int rtlsdr_cancel_async(rtlsdr_dev_t *dev)
 	return -2;
 }
 
+int rtlsdr_is_device_lost(rtlsdr_dev_t *dev)
+{
+	if (!dev)
+		return -1;
+
+	return dev->dev_lost ? 1 : 0;
+}
+
 uint32_t rtlsdr_get_tuner_clock(void *dev)
 {
 	uint32_t tuner_freq;
@@ -0,0 +1,291 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* SCHED_IDLE */
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "logger.h"
+#include "latency.h"
+
+#define DRAIN_INTERVAL_US	20000
+
+/*
+ * Bounded MPSC queue after Dmitry Vyukov: a slot is free for the producer
+ * whose position equals its seq, and holds a message for the consumer once
+ * seq is position + 1.
+ */
+struct log_slot {
+	uint32_t seq;
+	int status;
+	char text[LOGGER_LINE];
+};
+
+static struct {
+	struct log_slot *slots;
+	uint32_t mask;
+	uint32_t head;		/* next position to claim, producers */
+	uint32_t tail;		/* next position to print, drain thread */
+	uint32_t dropped;
+
+	uint32_t status_ms;
+	uint32_t status_due;	/* ms clock, wraps */
+	int status_shown;	/* a status line is on screen without newline */
+	int tty;
+
+	FILE *out;
+	pthread_t thread;
+	int stop;
+} lg;
+
+enum logger_level logger_max_level = LOGGER_INFO;
+
+static const char *level_names[] = { "error", "warn", "info", "debug" };
+
+int logger_parse_level(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(level_names) / sizeof(level_names[0]); i++)
+		if (!strcmp(name, level_names[i]))
+			return (int)i;
+
+	return -1;
+}
+
+static uint32_t now_ms(void)
+{
+	return (uint32_t)(lat_now() / 1000000);
+}
+
+static void write_line(const struct log_slot *slot)
+{
+	if (slot->status && lg.tty) {
+		fprintf(lg.out, "\r%s\033[K", slot->text);
+		lg.status_shown = 1;
+		return;
+	}
+
+	if (lg.status_shown) {
+		fputc('\n', lg.out);
+		lg.status_shown = 0;
+	}
+
+	fprintf(lg.out, "%s\n", slot->text);
+}
+
+/* print everything published so far, drain thread only */
+static int drain(void)
+{
+	struct log_slot *slot;
+	uint32_t seq;
+	int n = 0;
+
+	for (;;) {
+		slot = &lg.slots[lg.tail & lg.mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq != lg.tail + 1)
+			break;
+
+		write_line(slot);
+
+		__atomic_store_n(&slot->seq, lg.tail + lg.mask + 1,
+				 __ATOMIC_RELEASE);
+		lg.tail++;
+		n++;
+	}
+
+	return n;
+}
+
+static void *drain_fn(void *arg)
+{
+	uint32_t reported = 0, dropped;
+	int stop;
+#ifdef SCHED_IDLE
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+	(void)arg;
+
+	do {
+		stop = __atomic_load_n(&lg.stop, __ATOMIC_ACQUIRE);
+
+		if (drain()) {
+			dropped = __atomic_load_n(&lg.dropped, __ATOMIC_RELAXED);
+			if (dropped != reported) {
+				if (lg.status_shown)
+					fputc('\n', lg.out);
+				lg.status_shown = 0;
+				fprintf(lg.out, "[%u log lines dropped]\n",
+					dropped - reported);
+				reported = dropped;
+			}
+			fflush(lg.out);
+		}
+
+		if (!stop)
+			usleep(DRAIN_INTERVAL_US);
+	} while (!stop);
+
+	if (lg.status_shown)
+		fputc('\n', lg.out);
+	fflush(lg.out);
+
+	return NULL;
+}
+
+int logger_init(uint32_t slots, enum logger_level level, uint32_t status_ms,
+		FILE *out)
+{
+	uint32_t n = 1, i;
+
+	while (n < slots)
+		n <<= 1;
+
+	logger_max_level = level;
+
+	memset(&lg, 0, sizeof(lg));
+	lg.out = out;
+	lg.status_ms = status_ms;
+	lg.status_due = now_ms();
+#ifndef _WIN32
+	lg.tty = isatty(fileno(out));
+#endif
+
+	lg.slots = calloc(n, sizeof(struct log_slot));
+	if (!lg.slots)
+		return -1;
+
+	lg.mask = n - 1;
+	for (i = 0; i < n; i++)
+		lg.slots[i].seq = i;
+
+	if (pthread_create(&lg.thread, NULL, drain_fn, NULL)) {
+		free(lg.slots);
+		lg.slots = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void logger_stop(void)
+{
+	struct log_slot *slots = lg.slots;
+
+	if (!slots)
+		return;
+
+	__atomic_store_n(&lg.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(lg.thread, NULL);
+
+	/* late producers now go straight to the output */
+	__atomic_store_n(&lg.slots, NULL, __ATOMIC_RELEASE);
+	free(slots);
+}
+
+uint32_t logger_dropped(void)
+{
+	return __atomic_load_n(&lg.dropped, __ATOMIC_RELAXED);
+}
+
+static void logger_vqueue(int status, const char *fmt, va_list ap)
+{
+	struct log_slot *slots = __atomic_load_n(&lg.slots, __ATOMIC_ACQUIRE);
+	struct log_slot *slot;
+	uint32_t pos, seq;
+	int32_t diff;
+
+	if (!slots) {
+		vfprintf(stdout, fmt, ap);
+		fputc('\n', stdout);
+		return;
+	}
+
+	pos = __atomic_load_n(&lg.head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &slots[pos & lg.mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t)(seq - pos);
+
+		if (!diff) {
+			if (__atomic_compare_exchange_n(&lg.head, &pos, pos + 1,
+							1, __ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* full, the drain thread hasn't caught up */
+			__atomic_add_fetch(&lg.dropped, 1, __ATOMIC_RELAXED);
+			return;
+		} else {
+			pos = __atomic_load_n(&lg.head, __ATOMIC_RELAXED);
+		}
+	}
+
+	vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+	slot->status = status;
+
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void logger_printf(enum logger_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (!logger_enabled(level))
+		return;
+
+	va_start(ap, fmt);
+	logger_vqueue(0, fmt, ap);
+	va_end(ap);
+}
+
+void logger_status(const char *fmt, ...)
+{
+	uint32_t now, due;
+	va_list ap;
+
+	if (!logger_enabled(LOGGER_INFO))
+		return;
+
+	now = now_ms();
+	due = __atomic_load_n(&lg.status_due, __ATOMIC_RELAXED);
+	if ((int32_t)(now - due) < 0)
+		return;
+
+	/* only the caller that moves the deadline gets to print */
+	if (!__atomic_compare_exchange_n(&lg.status_due, &due,
+					 now + lg.status_ms, 0,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+
+	va_start(ap, fmt);
+	logger_vqueue(1, fmt, ap);
+	va_end(ap);
+}
@@ -0,0 +1,90 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LOGGER_H
+#define __LOGGER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Console output for the real time threads.
+ *
+ * Messages are formatted straight into a slot of a bounded lock-free ring
+ * (any number of producers, one consumer) and written out by a drain thread
+ * running at idle priority. A producer never blocks, takes a lock or makes
+ * a system call; when the ring is full the message is counted and dropped.
+ * Messages above the run time level are discarded before formatting.
+ *
+ * Status lines are rate limited: at most one per interval is queued, the
+ * rest return right away. On a terminal the status line is redrawn in
+ * place instead of scrolling.
+ */
+
+enum logger_level {
+	LOGGER_ERROR = 0,
+	LOGGER_WARN,
+	LOGGER_INFO,
+	LOGGER_DEBUG
+};
+
+#define LOGGER_LINE		256
+
+extern enum logger_level logger_max_level;
+
+/*!
+ * Allocate the ring and start the drain thread. Before this (and after
+ * logger_stop()) messages are written directly.
+ *
+ * \param slots number of queued messages, rounded up to a power of two
+ * \param level most verbose level that is kept
+ * \param status_ms shortest interval between two status lines
+ * \param out where the drain thread writes
+ * \return 0 on success, -1 on failure
+ */
+int logger_init(uint32_t slots, enum logger_level level, uint32_t status_ms,
+		FILE *out);
+
+/* write out everything queued, stop the drain thread and free the ring;
+ * only once the threads that log are done */
+void logger_stop(void);
+
+/*!
+ * Map a level name to its value.
+ *
+ * \param name "error", "warn", "info" or "debug"
+ * \return the level, -1 for an unknown name
+ */
+int logger_parse_level(const char *name);
+
+static inline int logger_enabled(enum logger_level level)
+{
+	return level <= logger_max_level;
+}
+
+/* queue one message, a trailing newline is added */
+void logger_printf(enum logger_level level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* queue an INFO status line unless one went out less than status_ms ago */
+void logger_status(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/* messages lost because the ring was full */
+uint32_t logger_dropped(void);
+
+#endif /* __LOGGER_H */
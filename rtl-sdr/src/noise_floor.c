@@ -0,0 +1,362 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "noise_floor.h"
+#include "detector.h"
+
+#define DEFAULT_EMA_ALPHA	0.1
+#define DEFAULT_MEDIAN_FRAMES	15
+#define DEFAULT_CFAR_TRAIN	32
+#define DEFAULT_CFAR_GUARD	4
+
+static const char *method_names[] = { "max", "ema", "median", "cfar" };
+
+void noise_floor_defaults(struct noise_floor_config *cfg)
+{
+	cfg->method = NOISE_FLOOR_MAX;
+	cfg->ema_alpha = DEFAULT_EMA_ALPHA;
+	cfg->median_frames = DEFAULT_MEDIAN_FRAMES;
+	cfg->cfar_train = DEFAULT_CFAR_TRAIN;
+	cfg->cfar_guard = DEFAULT_CFAR_GUARD;
+}
+
+const char *noise_floor_name(enum noise_floor_method method)
+{
+	return method_names[method];
+}
+
+int noise_floor_parse(struct noise_floor_config *cfg, const char *spec)
+{
+	size_t len = strcspn(spec, ":");
+	const char *arg = spec[len] ? spec + len + 1 : NULL;
+	char *end;
+	unsigned int i;
+	long v;
+
+	for (i = 0; i < sizeof(method_names) / sizeof(method_names[0]); i++)
+		if (strlen(method_names[i]) == len &&
+		    !strncmp(spec, method_names[i], len))
+			break;
+	if (i == sizeof(method_names) / sizeof(method_names[0]))
+		return -1;
+
+	cfg->method = (enum noise_floor_method)i;
+	if (!arg)
+		return 0;
+
+	switch (cfg->method) {
+	case NOISE_FLOOR_EMA:
+		cfg->ema_alpha = strtod(arg, &end);
+		if (*end || cfg->ema_alpha <= 0 || cfg->ema_alpha > 1)
+			return -1;
+		break;
+	case NOISE_FLOOR_MEDIAN:
+		v = strtol(arg, &end, 10);
+		if (*end || v < 1 || v > 1024)
+			return -1;
+		cfg->median_frames = (unsigned int)v;
+		break;
+	case NOISE_FLOOR_CFAR:
+		v = strtol(arg, &end, 10);
+		if ((*end && *end != ':') || v < 1)
+			return -1;
+		cfg->cfar_train = (unsigned int)v;
+		if (*end) {
+			v = strtol(end + 1, &end, 10);
+			if (*end || v < 0)
+				return -1;
+			cfg->cfar_guard = (unsigned int)v;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+static unsigned int bucket_count(unsigned long lo, unsigned long hi,
+				 unsigned int max_buckets)
+{
+	return hi - lo < max_buckets ? (unsigned int)(hi - lo) : max_buckets;
+}
+
+size_t noise_floor_size(const struct noise_floor_config *cfg,
+			unsigned long lo, unsigned long hi,
+			unsigned int max_buckets, unsigned long win_lo,
+			unsigned long win_hi)
+{
+	size_t buckets = bucket_count(lo, hi, max_buckets);
+
+	switch (cfg->method) {
+	case NOISE_FLOOR_EMA:
+		return 2 * DETECTOR_ALIGN_UP(sizeof(double) * buckets);
+	case NOISE_FLOOR_MEDIAN:
+		return DETECTOR_ALIGN_UP(sizeof(double) * buckets) + 2 *
+		       DETECTOR_ALIGN_UP(sizeof(double) * buckets *
+					 cfg->median_frames);
+	case NOISE_FLOOR_CFAR:
+		return DETECTOR_ALIGN_UP(sizeof(fft_real) * (win_hi - win_lo));
+	default:
+		return DETECTOR_ALIGN_UP(sizeof(double) * buckets);
+	}
+}
+
+int noise_floor_init(struct noise_floor *nf, struct detector_arena *arena,
+		     const struct noise_floor_config *cfg, unsigned long n_points,
+		     unsigned long lo, unsigned long hi, unsigned int max_buckets,
+		     unsigned long win_lo, unsigned long win_hi)
+{
+	size_t frames = cfg->median_frames;
+
+	memset(nf, 0, sizeof(*nf));
+	nf->cfg = *cfg;
+	nf->n_points = n_points;
+	nf->lo = lo;
+	nf->hi = hi > lo ? hi : lo;
+	nf->win_lo = win_lo;
+	nf->win_hi = win_hi > win_lo ? win_hi : win_lo;
+
+	if (NOISE_FLOOR_CFAR == cfg->method) {
+		nf->cfar = detector_arena_alloc(arena, sizeof(fft_real) *
+						(nf->win_hi - nf->win_lo));
+		return nf->cfar || nf->win_hi == nf->win_lo ? 0 : -1;
+	}
+
+	nf->n_buckets = bucket_count(nf->lo, nf->hi, max_buckets);
+	if (!nf->n_buckets)
+		return 0;
+
+	nf->bucket = detector_arena_alloc(arena, sizeof(double) * nf->n_buckets);
+	if (!nf->bucket)
+		return -1;
+
+	if (NOISE_FLOOR_EMA == cfg->method &&
+	    !(nf->ema = detector_arena_alloc(arena,
+					      sizeof(double) * nf->n_buckets)))
+		return -1;
+
+	if (NOISE_FLOOR_MEDIAN == cfg->method) {
+		nf->med_ring = detector_arena_alloc(arena, sizeof(double) *
+						    nf->n_buckets * frames);
+		nf->med_sorted = detector_arena_alloc(arena, sizeof(double) *
+						      nf->n_buckets * frames);
+		if (!nf->med_ring || !nf->med_sorted)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* maximum of every bucket of the threshold window in this frame */
+static void bucket_maxima(struct noise_floor *nf, const fft_real *power)
+{
+	unsigned long width = nf->hi - nf->lo;
+	unsigned long start, end, i;
+	unsigned int b;
+	fft_real m;
+
+	for (b = 0; b < nf->n_buckets; b++) {
+		start = nf->lo + width * b / nf->n_buckets;
+		end = nf->lo + width * (b + 1) / nf->n_buckets;
+		m = power[start];
+		for (i = start + 1; i < end; i++)
+			m = power[i] > m ? power[i] : m;
+		nf->bucket[b] = m;
+	}
+}
+
+static double mean(const double *v, unsigned int n)
+{
+	double sum = 0;
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		sum += v[i];
+
+	return sum / n;
+}
+
+static void ema_update(struct noise_floor *nf)
+{
+	double alpha = nf->cfg.ema_alpha;
+	unsigned int b;
+
+	if (!nf->frames) {
+		memcpy(nf->ema, nf->bucket, sizeof(double) * nf->n_buckets);
+	} else {
+		for (b = 0; b < nf->n_buckets; b++)
+			nf->ema[b] += alpha * (nf->bucket[b] - nf->ema[b]);
+	}
+
+	nf->floor = mean(nf->ema, nf->n_buckets);
+}
+
+/* index of the first element of sorted[0..n) that is >= v */
+static unsigned int lower_bound(const double *sorted, unsigned int n, double v)
+{
+	unsigned int lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (sorted[mid] < v)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Each bucket keeps its last median_frames maxima in a ring and the same
+ * values in a sorted array. A frame replaces the oldest value: remove it
+ * from the sorted array, insert the new one, read the middle element. With
+ * the short windows used here the memmove is cheaper than a pair of
+ * indexed heaps.
+ */
+static void median_update(struct noise_floor *nf)
+{
+	unsigned int frames = nf->cfg.median_frames;
+	unsigned int b, pos, cur;
+	double *ring, *sorted, sum = 0;
+
+	for (b = 0; b < nf->n_buckets; b++) {
+		ring = nf->med_ring + (size_t)b * frames;
+		sorted = nf->med_sorted + (size_t)b * frames;
+		cur = nf->med_fill;
+
+		if (cur == frames) {
+			pos = lower_bound(sorted, cur, ring[nf->med_pos]);
+			cur--;
+			memmove(sorted + pos, sorted + pos + 1,
+				sizeof(double) * (cur - pos));
+		}
+
+		ring[nf->med_pos] = nf->bucket[b];
+		pos = lower_bound(sorted, cur, nf->bucket[b]);
+		memmove(sorted + pos + 1, sorted + pos,
+			sizeof(double) * (cur - pos));
+		sorted[pos] = nf->bucket[b];
+		cur++;
+
+		sum += sorted[cur / 2];
+	}
+
+	if (nf->med_fill < frames)
+		nf->med_fill++;
+	nf->med_pos = (nf->med_pos + 1) % frames;
+
+	nf->floor = sum / nf->n_buckets;
+}
+
+/*
+ * Cell averaging CFAR over the detection window. The two training windows
+ * slide along with the bin under test, so each bin costs two additions and
+ * two subtractions however wide the windows are. Windows are clipped at the
+ * ends of the spectrum.
+ */
+static void cfar_update(struct noise_floor *nf, const fft_real *power)
+{
+	long n = (long)nf->n_points;
+	long train = nf->cfg.cfar_train;
+	long guard = nf->cfg.cfar_guard;
+	long i = (long)nf->win_lo, end = (long)nf->win_hi, k;
+	double left = 0, right = 0, total = 0;
+	long n_left = 0, n_right = 0;
+
+	if (i == end)
+		return;
+
+	/* left: [i - guard - train, i - guard), right: (i + guard, i + guard + train] */
+	for (k = i - guard - train; k < i - guard; k++)
+		if (k >= 0 && k < n) {
+			left += power[k];
+			n_left++;
+		}
+	for (k = i + guard + 1; k <= i + guard + train; k++)
+		if (k >= 0 && k < n) {
+			right += power[k];
+			n_right++;
+		}
+
+	for (;;) {
+		nf->cfar[i - (long)nf->win_lo] = n_left + n_right ?
+			(fft_real)((left + right) / (n_left + n_right)) : 0;
+		total += nf->cfar[i - (long)nf->win_lo];
+
+		if (++i == end)
+			break;
+
+		/* bin i - guard - 1 joins the left window, the oldest leaves */
+		k = i - guard - 1;
+		if (k >= 0 && k < n) {
+			left += power[k];
+			n_left++;
+		}
+		k = i - guard - train - 1;
+		if (k >= 0 && k < n) {
+			left -= power[k];
+			n_left--;
+		}
+
+		/* bin i + guard becomes a guard bin, a new one joins */
+		k = i + guard;
+		if (k >= 0 && k < n) {
+			right -= power[k];
+			n_right--;
+		}
+		k = i + guard + train;
+		if (k >= 0 && k < n) {
+			right += power[k];
+			n_right++;
+		}
+	}
+
+	nf->floor = total / (double)(end - (long)nf->win_lo);
+}
+
+void noise_floor_update(struct noise_floor *nf, const fft_real *power)
+{
+	if (NOISE_FLOOR_CFAR == nf->cfg.method) {
+		cfar_update(nf, power);
+		nf->frames++;
+		return;
+	}
+
+	if (!nf->n_buckets)
+		return;
+
+	bucket_maxima(nf, power);
+
+	switch (nf->cfg.method) {
+	case NOISE_FLOOR_EMA:
+		ema_update(nf);
+		break;
+	case NOISE_FLOOR_MEDIAN:
+		median_update(nf);
+		break;
+	default:
+		nf->floor = mean(nf->bucket, nf->n_buckets);
+		break;
+	}
+
+	nf->frames++;
+}
@@ -0,0 +1,133 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __NOISE_FLOOR_H
+#define __NOISE_FLOOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft_types.h"
+
+struct detector_arena;
+
+/*
+ * Streaming noise floor estimate the detector compares the window against.
+ *
+ * The bucketed methods split the threshold window into up to n_buckets
+ * buckets and take the maximum of each bucket in the current frame:
+ *
+ *  max:     mean of this frame's bucket maxima
+ *  ema:     mean of a per bucket exponential moving average of the maxima
+ *  median:  mean of a per bucket median over the last median_frames frames
+ *
+ * cfar is a cell averaging CFAR: every bin of the detection window gets its
+ * own level, the mean of cfar_train bins on either side of it after skipping
+ * cfar_guard bins next to it. It ignores the threshold window.
+ *
+ * All state is updated incrementally once per frame, nothing is rescanned
+ * from history.
+ */
+enum noise_floor_method {
+	NOISE_FLOOR_MAX = 0,
+	NOISE_FLOOR_EMA,
+	NOISE_FLOOR_MEDIAN,
+	NOISE_FLOOR_CFAR
+};
+
+struct noise_floor_config {
+	enum noise_floor_method method;
+	double ema_alpha;		/* weight of the newest frame, 0-1 */
+	unsigned int median_frames;	/* frames in the sliding median */
+	unsigned int cfar_train;	/* training bins per side */
+	unsigned int cfar_guard;	/* guard bins per side */
+};
+
+struct noise_floor {
+	struct noise_floor_config cfg;
+	unsigned long n_points;
+
+	/* threshold window, bucketed methods */
+	unsigned long lo;
+	unsigned long hi;
+	unsigned int n_buckets;
+	double *bucket;		/* maxima of the current frame */
+	double *ema;
+
+	/* sliding median, per bucket a ring in arrival order and the same
+	 * values kept sorted */
+	double *med_ring;
+	double *med_sorted;
+	unsigned int med_fill;
+	unsigned int med_pos;
+
+	/* detection window, cfar */
+	unsigned long win_lo;
+	unsigned long win_hi;
+	fft_real *cfar;		/* level of each bin in the window */
+
+	double floor;		/* overall level, also the mean for cfar */
+	uint64_t frames;
+};
+
+/* fill in the defaults for every method */
+void noise_floor_defaults(struct noise_floor_config *cfg);
+
+/*!
+ * Parse an estimator spec.
+ *
+ * \param spec "max", "ema[:alpha]", "median[:frames]" or
+ *	       "cfar[:train[:guard]]"
+ * \return 0 on success, -1 on a malformed spec
+ */
+int noise_floor_parse(struct noise_floor_config *cfg, const char *spec);
+
+/* bytes of arena space noise_floor_init() needs */
+size_t noise_floor_size(const struct noise_floor_config *cfg,
+			unsigned long lo, unsigned long hi,
+			unsigned int max_buckets, unsigned long win_lo,
+			unsigned long win_hi);
+
+/*!
+ * Set up the estimator, buffers come from the arena.
+ *
+ * \param lo first bin of the threshold window
+ * \param hi end of the threshold window, lo == hi leaves the bucketed
+ *	     methods with a floor of 0
+ * \param max_buckets number of buckets to split the threshold window into
+ * \param win_lo first bin of the detection window
+ * \param win_hi end of the detection window
+ * \return 0 on success, -1 if the arena is too small
+ */
+int noise_floor_init(struct noise_floor *nf, struct detector_arena *arena,
+		     const struct noise_floor_config *cfg, unsigned long n_points,
+		     unsigned long lo, unsigned long hi, unsigned int max_buckets,
+		     unsigned long win_lo, unsigned long win_hi);
+
+/* fold one FFT shifted power spectrum into the estimate */
+void noise_floor_update(struct noise_floor *nf, const fft_real *power);
+
+/* noise level to compare a detection window bin against */
+static inline double noise_floor_level(const struct noise_floor *nf,
+				       unsigned long bin)
+{
+	return nf->cfar ? nf->cfar[bin - nf->win_lo] : nf->floor;
+}
+
+const char *noise_floor_name(enum noise_floor_method method);
+
+#endif /* __NOISE_FLOOR_H */
@@ -0,0 +1,268 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "output_sched.h"
+#include "latency.h"
+
+#define IDLE_WAIT_NS	1000000000ULL
+
+void output_sched_init(struct output_sched *s, output_write_t write,
+		       output_notify_t notify, void *ctx)
+{
+	memset(s, 0, sizeof(*s));
+	s->write = write;
+	s->notify = notify;
+	s->ctx = ctx;
+}
+
+int output_sched_add_pin(struct output_sched *s, unsigned int pin,
+			 unsigned int min_pulse_us)
+{
+	struct output_pin *p;
+	uint64_t min_pulse = (uint64_t)min_pulse_us * 1000;
+	unsigned int i;
+
+	for (i = 0; i < s->n_pins; i++) {
+		p = &s->pins[i];
+		if (p->pin == pin) {
+			if (min_pulse > p->min_pulse)
+				p->min_pulse = min_pulse;
+			return 0;
+		}
+	}
+
+	if (s->n_pins == OUTPUT_MAX_PINS)
+		return -1;
+
+	p = &s->pins[s->n_pins++];
+	p->pin = pin;
+	p->min_pulse = min_pulse;
+
+	return 0;
+}
+
+static struct output_pin *find_pin(struct output_sched *s, unsigned int pin)
+{
+	unsigned int i;
+
+	for (i = 0; i < s->n_pins; i++)
+		if (s->pins[i].pin == pin)
+			return &s->pins[i];
+
+	return NULL;
+}
+
+static void set_level(struct output_sched *s, struct output_pin *p, int level,
+		      uint64_t now)
+{
+	p->level = level;
+	if (level)
+		p->high_since = now;
+	if (s->write)
+		s->write(s->ctx, p->pin, level, p->t_usb);
+}
+
+static void apply_event(struct output_sched *s, const struct output_event *ev)
+{
+	struct output_pin *p;
+
+	p = find_pin(s, ev->pin);
+	if (!p)
+		return;
+
+	p->t_usb = ev->t_usb;
+
+	if (ev->active) {
+		p->holders++;
+		p->release = 0;
+		if (p->level)
+			p->retrigger = 1;
+		else if (!p->high_at)
+			set_level(s, p, 1, lat_now());
+		/* in a retrigger gap the edge is already coming */
+		return;
+	}
+
+	if (p->holders)
+		p->holders--;
+	if (!p->holders) {
+		p->release = 1;
+		p->retrigger = 0;
+		p->high_at = 0;
+	}
+}
+
+/* carry out what is due, return the nearest deadline left or 0 */
+static uint64_t run_timers(struct output_sched *s, uint64_t now)
+{
+	struct output_pin *p;
+	uint64_t next = 0, t;
+	unsigned int i;
+
+	for (i = 0; i < s->n_pins; i++) {
+		p = &s->pins[i];
+
+		if (p->level && (p->release || p->retrigger)) {
+			t = p->high_since + p->min_pulse;
+			if (now >= t) {
+				if (p->retrigger && p->holders)
+					p->high_at = now + OUTPUT_RETRIGGER_US * 1000ULL;
+				p->release = 0;
+				p->retrigger = 0;
+				set_level(s, p, 0, now);
+			} else if (!next || t < next) {
+				next = t;
+			}
+		}
+
+		if (!p->level && p->high_at) {
+			t = p->high_at;
+			if (now >= t) {
+				p->high_at = 0;
+				set_level(s, p, 1, now);
+			} else if (!next || t < next) {
+				next = t;
+			}
+		}
+	}
+
+	return next;
+}
+
+static void ns_to_timespec(uint64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = (time_t)(ns / 1000000000ULL);
+	ts->tv_nsec = (long)(ns % 1000000000ULL);
+}
+
+static void *output_sched_fn(void *arg)
+{
+	struct output_sched *s = arg;
+	struct timespec abs_time;
+	uint64_t next;
+	uint32_t tail, head;
+
+	for (;;) {
+		/* pins first, the notify callbacks may block on I/O */
+		tail = s->tail;
+		head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+		for (; tail != head; tail++)
+			apply_event(s, &s->events[tail & (OUTPUT_EVENTS - 1)]);
+
+		next = run_timers(s, lat_now());
+
+		/* the slots stay ours until tail moves past them */
+		if (tail != s->tail) {
+			for (tail = s->tail; tail != head; tail++) {
+				if (s->notify)
+					s->notify(s->ctx, &s->events[tail &
+						  (OUTPUT_EVENTS - 1)]);
+				__atomic_store_n(&s->tail, tail + 1,
+						 __ATOMIC_RELEASE);
+			}
+			/* time went by in the callbacks */
+			next = run_timers(s, lat_now());
+		}
+		if (!next)
+			next = lat_now() + IDLE_WAIT_NS;
+		ns_to_timespec(next, &abs_time);
+
+		/*
+		 * Announce the sleep before the last look at head: a producer
+		 * either sees sleeping and signals under the lock, or its event
+		 * is seen here. Either way nothing waits for the timeout.
+		 */
+		pthread_mutex_lock(&s->lock);
+		if (s->stop) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		__atomic_store_n(&s->sleeping, 1, __ATOMIC_SEQ_CST);
+		if (tail == __atomic_load_n(&s->head, __ATOMIC_SEQ_CST))
+			pthread_cond_timedwait(&s->cond, &s->lock, &abs_time);
+		__atomic_store_n(&s->sleeping, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return NULL;
+}
+
+int output_sched_start(struct output_sched *s)
+{
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&s->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	s->started = 1;
+	if (pthread_create(&s->thread, NULL, output_sched_fn, s)) {
+		s->started = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+int output_sched_post(struct output_sched *s, const struct output_event *ev)
+{
+	uint32_t head = s->head;
+
+	if (head - __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE) == OUTPUT_EVENTS) {
+		__atomic_add_fetch(&s->dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	s->events[head & (OUTPUT_EVENTS - 1)] = *ev;
+	__atomic_store_n(&s->head, head + 1, __ATOMIC_SEQ_CST);
+
+	/* only take the lock when the thread is (about to be) asleep */
+	if (__atomic_load_n(&s->sleeping, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&s->lock);
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return 0;
+}
+
+void output_sched_stop(struct output_sched *s)
+{
+	unsigned int i;
+
+	if (!s->started)
+		return;
+
+	pthread_mutex_lock(&s->lock);
+	s->stop = 1;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thread, NULL);
+
+	for (i = 0; i < s->n_pins; i++)
+		if (s->pins[i].level)
+			set_level(s, &s->pins[i], 0, 0);
+
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	s->started = 0;
+}
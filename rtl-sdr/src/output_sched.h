@@ -0,0 +1,132 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OUTPUT_SCHED_H
+#define __OUTPUT_SCHED_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Output scheduler: the only thread that drives the detection pins.
+ *
+ * The detector posts rule transitions (a rule on a pin became active or
+ * cleared) into a single-producer ring and never waits. The scheduler
+ * thread turns them into pin levels on its own clock:
+ *
+ *  - a pin is HIGH while any rule on it is active
+ *  - a HIGH pulse lasts at least min_pulse_us, an earlier release is held
+ *    back until then
+ *  - a rule becoming active while its pin is already HIGH produces a fresh
+ *    rising edge: LOW for OUTPUT_RETRIGGER_US, then HIGH again
+ *
+ * Every event is also handed to a notify callback on the same thread, so
+ * event outputs (sockets, log files) stay off the detector thread too. The
+ * callbacks run once the pins and timers of a batch are done, a sink that
+ * blocks on I/O never holds back an edge that was already due.
+ *
+ * Deadlines are kept per pin and the thread sleeps on CLOCK_MONOTONIC
+ * until the nearest one or the next posted event.
+ */
+
+#define OUTPUT_MAX_PINS		32
+#define OUTPUT_EVENTS		256	/* power of two */
+#define OUTPUT_RETRIGGER_US	90
+#define OUTPUT_NO_PIN		(~0U)
+
+struct output_event {
+	unsigned int pin;	/* OUTPUT_NO_PIN if the rule drives no pin */
+	int active;
+	uint64_t t_usb;		/* USB completion of the deciding frame */
+
+	/* what was detected, for the notify callback */
+	unsigned int rule;
+	const char *name;	/* must outlive the scheduler */
+	unsigned long bin;
+	uint32_t freq;		/* Hz */
+	float snr_db;
+};
+
+/* called on the scheduler thread for every level change */
+typedef void (*output_write_t)(void *ctx, unsigned int pin, int level,
+			       uint64_t t_usb);
+
+/* called on the scheduler thread for every posted event */
+typedef void (*output_notify_t)(void *ctx, const struct output_event *ev);
+
+struct output_pin {
+	unsigned int pin;
+	uint64_t min_pulse;	/* ns */
+	unsigned int holders;	/* active rules on this pin */
+	int level;
+	uint64_t high_since;
+	uint64_t high_at;	/* end of a retrigger gap, 0 if none */
+	int release;		/* go LOW once the minimum width is met */
+	int retrigger;		/* new edge wanted once the width is met */
+	uint64_t t_usb;		/* of the event behind the pending edge */
+};
+
+struct output_sched {
+	struct output_pin pins[OUTPUT_MAX_PINS];
+	unsigned int n_pins;
+
+	/* detector -> scheduler */
+	struct output_event events[OUTPUT_EVENTS];
+	uint32_t head;
+	uint32_t tail;
+	uint32_t dropped;
+
+	output_write_t write;
+	output_notify_t notify;
+	void *ctx;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int sleeping;
+	int started;
+	int stop;
+};
+
+/* either callback may be NULL */
+void output_sched_init(struct output_sched *s, output_write_t write,
+		       output_notify_t notify, void *ctx);
+
+/*!
+ * Register a pin before output_sched_start(), registering it again keeps
+ * the longer minimum pulse.
+ *
+ * \return 0 on success, -1 once OUTPUT_MAX_PINS pins are registered
+ */
+int output_sched_add_pin(struct output_sched *s, unsigned int pin,
+			 unsigned int min_pulse_us);
+
+/* start the thread, every pin starts LOW */
+int output_sched_start(struct output_sched *s);
+
+/*!
+ * Queue a rule transition. Detector thread only, never waits for the
+ * scheduler; the lock is only taken to wake it up when it sleeps.
+ *
+ * \return 0 on success, -1 if the ring was full and the event dropped
+ */
+int output_sched_post(struct output_sched *s, const struct output_event *ev);
+
+/* join the thread and drive every pin LOW */
+void output_sched_stop(struct output_sched *s);
+
+#endif /* __OUTPUT_SCHED_H */
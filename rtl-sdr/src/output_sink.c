@@ -0,0 +1,440 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/un.h>
+
+#ifdef __linux__
+#include <linux/gpio.h>
+#endif
+
+#ifdef HAVE_BCM2835
+#include <bcm2835.h>
+#endif
+
+#include "output_sink.h"
+#include "latency.h"
+
+/* the packet goes out as is, no padding may sneak in */
+typedef char detection_packet_size_check[
+	sizeof(struct detection_packet) == 80 ? 1 : -1];
+
+#define GPIOCHIP_DEFAULT	"/dev/gpiochip0"
+#define GPIOCHIP_CONSUMER	"rtl_tcp"
+
+static int add_pin(struct output_sink *sink, unsigned int pin, int line)
+{
+	unsigned int i;
+
+	for (i = 0; i < sink->n_pins; i++)
+		if (sink->pins[i] == pin)
+			return 1;
+
+	if (sink->n_pins == OUTPUT_MAX_PINS)
+		return -1;
+
+	sink->pins[sink->n_pins] = pin;
+	sink->lines[sink->n_pins] = line;
+	sink->n_pins++;
+
+	return 0;
+}
+
+#ifdef HAVE_BCM2835
+static int bcm2835_sink_open(struct output_sink *sink, const char *arg)
+{
+	if (!bcm2835_init()) {
+		fprintf(stderr, "Could not initialize bcm2835\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bcm2835_sink_claim(struct output_sink *sink, unsigned int pin)
+{
+	if (add_pin(sink, pin, -1) < 0)
+		return -1;
+
+	bcm2835_gpio_fsel(pin, BCM2835_GPIO_FSEL_OUTP);
+	bcm2835_gpio_write(pin, LOW);
+
+	return 0;
+}
+
+static void bcm2835_sink_write(struct output_sink *sink, unsigned int pin,
+			       int level)
+{
+	bcm2835_gpio_write(pin, level ? HIGH : LOW);
+}
+
+static void bcm2835_sink_close(struct output_sink *sink)
+{
+	unsigned int i;
+
+	for (i = 0; i < sink->n_pins; i++) {
+		bcm2835_gpio_clr(sink->pins[i]);
+		bcm2835_gpio_fsel(sink->pins[i], BCM2835_GPIO_FSEL_INPT);
+	}
+	bcm2835_close();
+}
+#endif
+
+#ifdef __linux__
+static int gpiochip_open(struct output_sink *sink, const char *arg)
+{
+	const char *path = arg ? arg : GPIOCHIP_DEFAULT;
+
+	sink->fd = open(path, O_RDWR | O_CLOEXEC);
+	if (sink->fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/* one line handle per pin, so every pin is set on its own */
+static int gpiochip_claim(struct output_sink *sink, unsigned int pin)
+{
+	struct gpiohandle_request req;
+	int r;
+
+	memset(&req, 0, sizeof(req));
+	req.lineoffsets[0] = pin;
+	req.lines = 1;
+	req.flags = GPIOHANDLE_REQUEST_OUTPUT;
+	req.default_values[0] = 0;
+	strncpy(req.consumer_label, GPIOCHIP_CONSUMER,
+		sizeof(req.consumer_label) - 1);
+
+	r = add_pin(sink, pin, -1);
+	if (r)
+		return r < 0 ? -1 : 0;
+
+	if (ioctl(sink->fd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+		fprintf(stderr, "gpiochip line %u: %s\n", pin, strerror(errno));
+		sink->n_pins--;
+		return -1;
+	}
+	sink->lines[sink->n_pins - 1] = req.fd;
+
+	return 0;
+}
+
+static void gpiochip_write(struct output_sink *sink, unsigned int pin,
+			   int level)
+{
+	struct gpiohandle_data data;
+	unsigned int i;
+
+	for (i = 0; i < sink->n_pins; i++) {
+		if (sink->pins[i] != pin)
+			continue;
+
+		memset(&data, 0, sizeof(data));
+		data.values[0] = level ? 1 : 0;
+		if (ioctl(sink->lines[i], GPIOHANDLE_SET_LINE_VALUES_IOCTL,
+			  &data) < 0)
+			sink->lost++;
+		return;
+	}
+}
+
+static void gpiochip_close(struct output_sink *sink)
+{
+	unsigned int i;
+
+	for (i = 0; i < sink->n_pins; i++) {
+		gpiochip_write(sink, sink->pins[i], 0);
+		close(sink->lines[i]);
+	}
+	close(sink->fd);
+}
+#endif
+
+static int udp_open(struct output_sink *sink, const char *arg)
+{
+	struct addrinfo hints, *res;
+	char host[256];
+	const char *port;
+	size_t len;
+	int r;
+
+	port = arg ? strrchr(arg, ':') : NULL;
+	if (!port || port == arg || !port[1]) {
+		fprintf(stderr, "udp sink wants host:port\n");
+		return -1;
+	}
+
+	len = port - arg;
+	if (len >= sizeof(host))
+		len = sizeof(host) - 1;
+	memcpy(host, arg, len);
+	host[len] = '\0';
+	port++;
+
+	/* [::1]:port style */
+	if (host[0] == '[' && host[len - 1] == ']') {
+		memmove(host, host + 1, len - 2);
+		host[len - 2] = '\0';
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	r = getaddrinfo(host, port, &hints, &res);
+	if (r) {
+		fprintf(stderr, "udp sink %s: %s\n", arg, gai_strerror(r));
+		return -1;
+	}
+
+	sink->fd = socket(res->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sink->fd < 0) {
+		fprintf(stderr, "udp sink %s: %s\n", arg, strerror(errno));
+		freeaddrinfo(res);
+		return -1;
+	}
+	memcpy(&sink->addr, res->ai_addr, res->ai_addrlen);
+	sink->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+static int unix_open(struct output_sink *sink, const char *arg)
+{
+	struct sockaddr_un *sun = (struct sockaddr_un *)&sink->addr;
+
+	if (!arg || !arg[0] || strlen(arg) >= sizeof(sun->sun_path)) {
+		fprintf(stderr, "unix sink wants a socket path\n");
+		return -1;
+	}
+
+	sink->fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sink->fd < 0) {
+		fprintf(stderr, "unix sink %s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, arg);
+	sink->addr_len = sizeof(*sun);
+
+	return 0;
+}
+
+/* never waits: without a listener or with a full buffer the packet is lost */
+static int socket_send(struct output_sink *sink, const void *buf, size_t len)
+{
+	if (sendto(sink->fd, buf, len, MSG_DONTWAIT,
+		   (struct sockaddr *)&sink->addr, sink->addr_len) < 0)
+		return -1;
+
+	return 0;
+}
+
+static int file_open(struct output_sink *sink, const char *arg)
+{
+	if (!arg || !arg[0]) {
+		fprintf(stderr, "file sink wants a path\n");
+		return -1;
+	}
+
+	sink->fd = open(arg, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (sink->fd < 0) {
+		fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int file_send(struct output_sink *sink, const void *buf, size_t len)
+{
+	if (write(sink->fd, buf, len) != (ssize_t)len)
+		return -1;
+
+	return 0;
+}
+
+static void fd_close(struct output_sink *sink)
+{
+	close(sink->fd);
+}
+
+static const struct output_sink_iface sink_ifaces[] = {
+#ifdef HAVE_BCM2835
+	{ "gpio", bcm2835_sink_open, bcm2835_sink_claim, bcm2835_sink_write,
+	  NULL, bcm2835_sink_close },
+#endif
+#ifdef __linux__
+	{ "gpiochip", gpiochip_open, gpiochip_claim, gpiochip_write,
+	  NULL, gpiochip_close },
+#endif
+	{ "udp", udp_open, NULL, NULL, socket_send, fd_close },
+	{ "unix", unix_open, NULL, NULL, socket_send, fd_close },
+	{ "file", file_open, NULL, NULL, file_send, fd_close },
+};
+
+int output_sinks_open(struct output_sinks *set, const char *spec)
+{
+	const struct output_sink_iface *iface = NULL;
+	struct output_sink *sink;
+	const char *arg;
+	size_t len;
+	unsigned int i;
+
+	arg = strchr(spec, ':');
+	len = arg ? (size_t)(arg - spec) : strlen(spec);
+	if (arg)
+		arg++;
+
+	for (i = 0; i < sizeof(sink_ifaces) / sizeof(sink_ifaces[0]); i++) {
+		if (strlen(sink_ifaces[i].type) == len &&
+		    !strncmp(sink_ifaces[i].type, spec, len)) {
+			iface = &sink_ifaces[i];
+			break;
+		}
+	}
+	if (!iface) {
+		fprintf(stderr, "Unknown output \"%s\"\n", spec);
+		return -1;
+	}
+
+	if (set->n_sinks == OUTPUT_SINK_MAX) {
+		fprintf(stderr, "At most %d outputs\n", OUTPUT_SINK_MAX);
+		return -1;
+	}
+
+	sink = &set->sinks[set->n_sinks];
+	memset(sink, 0, sizeof(*sink));
+	sink->iface = iface;
+	sink->fd = -1;
+	if (iface->open(sink, arg) < 0)
+		return -1;
+	set->n_sinks++;
+
+	return 0;
+}
+
+int output_sinks_have_pins(const struct output_sinks *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->n_sinks; i++)
+		if (set->sinks[i].iface->claim)
+			return 1;
+
+	return 0;
+}
+
+int output_sinks_claim(struct output_sinks *set, unsigned int pin)
+{
+	struct output_sink *sink;
+	unsigned int i;
+	int r = 0;
+
+	for (i = 0; i < set->n_sinks; i++) {
+		sink = &set->sinks[i];
+		if (sink->iface->claim && sink->iface->claim(sink, pin) < 0)
+			r = -1;
+	}
+
+	return r;
+}
+
+void output_sinks_write(void *ctx, unsigned int pin, int level, uint64_t t_usb)
+{
+	struct output_sinks *set = ctx;
+	struct output_sink *sink;
+	unsigned int i;
+
+	for (i = 0; i < set->n_sinks; i++) {
+		sink = &set->sinks[i];
+		if (sink->iface->write)
+			sink->iface->write(sink, pin, level);
+	}
+}
+
+void output_sinks_notify(void *ctx, const struct output_event *ev)
+{
+	struct output_sinks *set = ctx;
+	struct detection_packet pkt;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.magic = htonl(DETECTION_MAGIC);
+	pkt.version = htons(DETECTION_VERSION);
+	pkt.size = htons(sizeof(pkt));
+	pkt.seq = htonl(set->seq++);
+	pkt.active = ev->active ? 1 : 0;
+	pkt.rule = (uint8_t)ev->rule;
+	pkt.pin = htons(ev->pin == OUTPUT_NO_PIN ? 0xffff : (uint16_t)ev->pin);
+	pkt.t_usb = output_hton64(ev->t_usb);
+	pkt.t_wall = output_hton64(lat_to_wall(ev->t_usb));
+	pkt.freq = htonl(ev->freq);
+	pkt.bin = htonl((uint32_t)ev->bin);
+	pkt.snr_mdb = (int32_t)htonl((uint32_t)(int32_t)(ev->snr_db * 1000));
+	if (ev->name)
+		snprintf(pkt.name, sizeof(pkt.name), "%s", ev->name);
+
+	output_sinks_send(set, &pkt, sizeof(pkt));
+}
+
+unsigned int output_sinks_send(struct output_sinks *set, const void *buf,
+			       size_t len)
+{
+	struct output_sink *sink;
+	unsigned int i, lost = 0;
+
+	for (i = 0; i < set->n_sinks; i++) {
+		sink = &set->sinks[i];
+		if (sink->iface->send && sink->iface->send(sink, buf, len) < 0) {
+			sink->lost++;
+			lost++;
+		}
+	}
+
+	return lost;
+}
+
+uint32_t output_sinks_lost(const struct output_sinks *set)
+{
+	uint32_t lost = 0;
+	unsigned int i;
+
+	for (i = 0; i < set->n_sinks; i++)
+		lost += set->sinks[i].lost;
+
+	return lost;
+}
+
+void output_sinks_close(struct output_sinks *set)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->n_sinks; i++)
+		set->sinks[i].iface->close(&set->sinks[i]);
+	set->n_sinks = 0;
+}
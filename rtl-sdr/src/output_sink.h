@@ -0,0 +1,148 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __OUTPUT_SINK_H
+#define __OUTPUT_SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "output_sched.h"
+
+/*
+ * Where detections go. A sink either drives pins (bcm2835, gpiochip) or
+ * receives one packet per detection change (udp, unix, file); every call
+ * comes from the output scheduler thread, which already did the pulse
+ * timing.
+ *
+ * Sinks are given as "type[:argument]":
+ *
+ *	gpio			BCM GPIO through libbcm2835 (/dev/mem)
+ *	gpiochip[:/dev/gpiochipN] line numbers of a GPIO character device,
+ *				default /dev/gpiochip0
+ *	udp:host:port		one datagram per detection change
+ *	unix:/path		the same to a Unix datagram socket
+ *	file:/path		the same packets appended to a file
+ *
+ * Packet and file records are a struct detection_packet each, integers in
+ * network byte order. A sink that can't deliver (no listener, full socket
+ * buffer) counts the packet as lost and never blocks.
+ */
+
+#define OUTPUT_SINK_MAX		8
+#define DETECTION_MAGIC		0x4455434bU	/* "DUCK" */
+#define DETECTION_VERSION	1
+#define DETECTION_NAME_LEN	32
+
+struct detection_packet {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;		/* sizeof(struct detection_packet) */
+	uint32_t seq;		/* per sink set, gaps are lost packets */
+	uint8_t active;		/* 1 signal seen, 0 signal gone */
+	uint8_t rule;		/* index in the rules file */
+	uint16_t pin;		/* 0xffff if the rule drives no pin */
+	uint64_t t_usb;		/* ns, CLOCK_MONOTONIC of the deciding USB transfer */
+	uint64_t t_wall;	/* ns since the epoch, same instant */
+	uint32_t freq;		/* Hz, of the strongest bin */
+	uint32_t bin;
+	int32_t snr_mdb;	/* strongest bin over the floor, 1/1000 dB */
+	uint32_t reserved;
+	char name[DETECTION_NAME_LEN];	/* rule name, NUL padded */
+};
+
+/* 64 bit counterpart of htonl() for the packet stamps */
+static inline uint64_t output_hton64(uint64_t v)
+{
+	if (htonl(1) == 1)
+		return v;
+
+	return (uint64_t)htonl((uint32_t)v) << 32 | htonl((uint32_t)(v >> 32));
+}
+
+struct output_sink;
+
+struct output_sink_iface {
+	const char *type;
+	/* open with the text after "type:", NULL if there was none */
+	int (*open)(struct output_sink *sink, const char *arg);
+	/* pin sinks: take a pin as an output driven LOW */
+	int (*claim)(struct output_sink *sink, unsigned int pin);
+	void (*write)(struct output_sink *sink, unsigned int pin, int level);
+	/* event sinks, one datagram or file record per call */
+	int (*send)(struct output_sink *sink, const void *buf, size_t len);
+	void (*close)(struct output_sink *sink);
+};
+
+struct output_sink {
+	const struct output_sink_iface *iface;
+	int fd;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+
+	/* claimed pins, with their line handle for gpiochip */
+	unsigned int pins[OUTPUT_MAX_PINS];
+	int lines[OUTPUT_MAX_PINS];
+	unsigned int n_pins;
+
+	uint32_t lost;
+};
+
+struct output_sinks {
+	struct output_sink sinks[OUTPUT_SINK_MAX];
+	unsigned int n_sinks;
+	uint32_t seq;
+};
+
+/*!
+ * Open one more sink.
+ *
+ * \param spec "type[:argument]" as listed above
+ * \return 0 on success, -1 on a bad spec or when the sink can't be opened
+ *	   (the reason is printed)
+ */
+int output_sinks_open(struct output_sinks *set, const char *spec);
+
+/* nonzero if any sink drives pins */
+int output_sinks_have_pins(const struct output_sinks *set);
+
+/* claim pin on every pin sink, -1 if one of them refused */
+int output_sinks_claim(struct output_sinks *set, unsigned int pin);
+
+/* output_write_t for the scheduler, ctx is the sink set */
+void output_sinks_write(void *ctx, unsigned int pin, int level, uint64_t t_usb);
+
+/* output_notify_t for the scheduler, ctx is the sink set */
+void output_sinks_notify(void *ctx, const struct output_event *ev);
+
+/*!
+ * Send any record to every event sink, e.g. a spectrum summary.
+ *
+ * \return number of sinks that lost it
+ */
+unsigned int output_sinks_send(struct output_sinks *set, const void *buf,
+			       size_t len);
+
+/* packets and pin writes lost over all sinks */
+uint32_t output_sinks_lost(const struct output_sinks *set);
+
+/* release the pins driven LOW and close everything */
+void output_sinks_close(struct output_sinks *set);
+
+#endif /* __OUTPUT_SINK_H */
@@ -0,0 +1,228 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "power_spectrum.h"
+#include "detector.h"
+
+/*
+ * The fused loop for one half of the spectrum. It is always inlined with
+ * a constant average, so every mode becomes its own branch free loop
+ * the compiler can vectorize. Only the FFTW output is interleaved, all
+ * other arrays are plain aligned arrays that don't alias.
+ */
+static inline __attribute__((always_inline))
+void spectrum_half(fft_real *__restrict power,
+		   const fft_complex *__restrict out,
+		   fft_real *__restrict hist_re, fft_real *__restrict hist_im,
+		   fft_real *__restrict hist_pow, fft_real *__restrict sum,
+		   fft_real *__restrict lap, fft_real scale, unsigned long n,
+		   const enum spectrum_average average)
+{
+	unsigned long i;
+	fft_real re, im, p, cur, s;
+
+	for (i = 0; i < n; i++) {
+		re = out[i][0];
+		im = out[i][1];
+
+		if (SPECTRUM_AVG_COHERENT == average) {
+			re += hist_re[i];
+			im += hist_im[i];
+			hist_re[i] = out[i][0];
+			hist_im[i] = out[i][1];
+		}
+
+		p = re * re + im * im;
+
+		if (SPECTRUM_AVG_INCOHERENT == average) {
+			cur = p;
+			p += hist_pow[i];
+			hist_pow[i] = cur;
+		}
+
+		/* hist_pow is the ring slot this frame replaces */
+		if (SPECTRUM_AVG_WELCH == average) {
+			s = sum[i] + p - hist_pow[i];
+			hist_pow[i] = p;
+			lap[i] += p;
+			sum[i] = s;
+			p = s * scale;
+		}
+
+		power[i] = p;
+	}
+}
+
+#define SPECTRUM_MODE(name, avg) \
+	static void name(fft_real *power, const fft_complex *out, \
+			 fft_real *hist_re, fft_real *hist_im, \
+			 fft_real *hist_pow, fft_real *sum, fft_real *lap, \
+			 fft_real scale, unsigned long n) \
+	{ \
+		spectrum_half(power, out, hist_re, hist_im, hist_pow, \
+			      sum, lap, scale, n, avg); \
+	}
+
+SPECTRUM_MODE(spectrum_plain, SPECTRUM_AVG_NONE)
+SPECTRUM_MODE(spectrum_coherent, SPECTRUM_AVG_COHERENT)
+SPECTRUM_MODE(spectrum_incoherent, SPECTRUM_AVG_INCOHERENT)
+SPECTRUM_MODE(spectrum_welch, SPECTRUM_AVG_WELCH)
+
+typedef void (*spectrum_half_t)(fft_real *power,
+				const fft_complex *out, fft_real *hist_re,
+				fft_real *hist_im, fft_real *hist_pow,
+				fft_real *sum, fft_real *lap, fft_real scale,
+				unsigned long n);
+
+/* indexed by average */
+static const spectrum_half_t spectrum_modes[4] = {
+	spectrum_plain,
+	spectrum_coherent,
+	spectrum_incoherent,
+	spectrum_welch,
+};
+
+size_t power_spectrum_size(unsigned long n_points,
+			   enum spectrum_average average, unsigned int depth)
+{
+	size_t bins = DETECTOR_ALIGN_UP(sizeof(fft_real) * n_points);
+	size_t n = 1;
+
+	if (SPECTRUM_AVG_COHERENT == average)
+		n += 2;
+	if (SPECTRUM_AVG_INCOHERENT == average)
+		n++;
+	if (SPECTRUM_AVG_WELCH == average)
+		n += 2 + (size_t)depth;
+
+	return n * bins;
+}
+
+int power_spectrum_init(struct power_spectrum *ps, struct detector_arena *arena,
+			unsigned long n_points, enum spectrum_average average,
+			unsigned int depth)
+{
+	size_t bins = sizeof(fft_real) * n_points;
+
+	memset(ps, 0, sizeof(*ps));
+	ps->n_points = n_points;
+	ps->average = average;
+
+	ps->power = detector_arena_alloc(arena, bins);
+	if (!ps->power)
+		return -1;
+
+	if (SPECTRUM_AVG_COHERENT == average) {
+		ps->hist_re = detector_arena_alloc(arena, bins);
+		ps->hist_im = detector_arena_alloc(arena, bins);
+		if (!ps->hist_re || !ps->hist_im)
+			return -1;
+	}
+
+	if (SPECTRUM_AVG_INCOHERENT == average &&
+	    !(ps->hist_pow = detector_arena_alloc(arena, bins)))
+		return -1;
+
+	/* one allocation per slot keeps every slot on its own cache line */
+	if (SPECTRUM_AVG_WELCH == average) {
+		if (depth < 1)
+			return -1;
+		ps->depth = depth;
+		ps->sum = detector_arena_alloc(arena, bins);
+		ps->lap = detector_arena_alloc(arena, bins);
+		ps->ring = detector_arena_alloc(arena,
+						DETECTOR_ALIGN_UP(bins) * depth);
+		if (!ps->sum || !ps->lap || !ps->ring)
+			return -1;
+	}
+
+	return 0;
+}
+
+void power_spectrum_run(struct power_spectrum *ps, const fft_complex *out)
+{
+	spectrum_half_t half_fn = spectrum_modes[ps->average];
+	unsigned long n = ps->n_points;
+	unsigned long half = n / 2;
+	unsigned long neg = n - half;
+	fft_real *hist_pow = ps->hist_pow;
+	fft_real scale = 0;
+	fft_real *swap;
+
+	if (ps->ring) {
+		hist_pow = (fft_real *)((unsigned char *)ps->ring + ps->slot *
+			   DETECTOR_ALIGN_UP(sizeof(fft_real) * n));
+		scale = (fft_real)1 / ps->depth;
+	}
+
+	/*
+	 * FFT shift: the negative frequencies (upper half of the output) come
+	 * first. The complex history follows the FFT output, the power history
+	 * follows the shifted power array.
+	 */
+	half_fn(ps->power, out + half,
+		ps->hist_re ? ps->hist_re + half : NULL,
+		ps->hist_im ? ps->hist_im + half : NULL,
+		hist_pow, ps->sum, ps->lap, scale, neg);
+	half_fn(ps->power + neg, out,
+		ps->hist_re, ps->hist_im,
+		hist_pow ? hist_pow + neg : NULL,
+		ps->sum ? ps->sum + neg : NULL,
+		ps->lap ? ps->lap + neg : NULL, scale, half);
+
+	/* the ring turned over, the lap sum is exact and takes over */
+	if (ps->ring && ++ps->slot == ps->depth) {
+		ps->slot = 0;
+		swap = ps->sum;
+		ps->sum = ps->lap;
+		ps->lap = swap;
+		memset(ps->lap, 0, sizeof(fft_real) * n);
+	}
+}
+
+int spectrum_parse_average(const char *name, unsigned int *depth)
+{
+	char *end;
+	unsigned long k;
+
+	if (!strncasecmp(name, "welch", 5)) {
+		k = SPECTRUM_DEFAULT_DEPTH;
+		if (name[5] && name[5] != ':')
+			return -2;
+		if (name[5]) {
+			k = strtoul(name + 6, &end, 10);
+			if (end == name + 6 || *end)
+				return -2;
+		}
+		if (k < 1 || k > SPECTRUM_MAX_DEPTH)
+			return -2;
+		*depth = (unsigned int)k;
+		return SPECTRUM_AVG_WELCH;
+	}
+	if (!strcasecmp(name, "off"))
+		return SPECTRUM_AVG_NONE;
+	if (!strcasecmp(name, "coherent"))
+		return SPECTRUM_AVG_COHERENT;
+	if (!strcasecmp(name, "incoherent"))
+		return SPECTRUM_AVG_INCOHERENT;
+
+	return -1;
+}
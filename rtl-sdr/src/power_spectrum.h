@@ -0,0 +1,104 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POWER_SPECTRUM_H
+#define __POWER_SPECTRUM_H
+
+#include <stddef.h>
+
+#include "fft_types.h"
+
+struct detector_arena;
+
+enum spectrum_average {
+	SPECTRUM_AVG_NONE = 0,
+	SPECTRUM_AVG_COHERENT,		/* add the previous complex frame */
+	SPECTRUM_AVG_INCOHERENT,	/* add the previous frame's power */
+	SPECTRUM_AVG_WELCH		/* mean power of the last depth frames */
+};
+
+#define SPECTRUM_DEFAULT_DEPTH		8
+#define SPECTRUM_MAX_DEPTH		256
+
+/*
+ * Power spectrum stage between the FFT and the detector. One pass over the
+ * FFT output does the fftshift, |X|^2 and the averaging with the previous
+ * frame, so every bin is read and written once.
+ * The threshold and detection stages work on the power array in place.
+ *
+ * Welch averaging keeps the power of the last depth frames in a ring and a
+ * running sum over it, so a frame costs the same O(bins) whatever the
+ * depth: add the new power, subtract the power that falls out of the ring.
+ * The rounding that leaves in the sum is dropped once per lap: a second sum
+ * restarts at every lap and, once the ring has turned over, holds exactly
+ * the frames in it and takes over. Together with a window and overlapping
+ * frames (see fft_pipeline.h) this is Welch's method; noise variance drops
+ * by the depth, so a bin's SNR spread narrows by about sqrt(depth). The
+ * first depth - 1 frames are averaged with silence. The ring costs depth
+ * times the bins in memory.
+ */
+struct power_spectrum {
+	unsigned long n_points;
+	enum spectrum_average average;
+
+	fft_real *power;	/* FFT shifted linear power */
+
+	/* previous frame, the complex one is kept unshifted and split into
+	 * re/im, the incoherent one is shifted like power */
+	fft_real *hist_re;
+	fft_real *hist_im;
+	fft_real *hist_pow;
+
+	/* Welch: depth frames of shifted power, the running sum and the sum of
+	 * the current lap */
+	unsigned int depth;
+	unsigned int slot;
+	fft_real *ring;
+	fft_real *sum;
+	fft_real *lap;
+};
+
+/* bytes of arena space power_spectrum_init() needs */
+size_t power_spectrum_size(unsigned long n_points,
+			   enum spectrum_average average, unsigned int depth);
+
+/*!
+ * Carve the spectrum buffers out of an arena, zeroed so the first frame is
+ * averaged with silence.
+ *
+ * \param depth frames averaged by SPECTRUM_AVG_WELCH, ignored otherwise
+ * \return 0 on success, -1 if the arena is too small
+ */
+int power_spectrum_init(struct power_spectrum *ps, struct detector_arena *arena,
+			unsigned long n_points, enum spectrum_average average,
+			unsigned int depth);
+
+/* turn one FFT output frame into ps->power */
+void power_spectrum_run(struct power_spectrum *ps, const fft_complex *out);
+
+/*!
+ * Map an averaging mode name to its value.
+ *
+ * \param name "off", "coherent", "incoherent" or "welch[:depth]"
+ * \param depth set to the Welch depth (default SPECTRUM_DEFAULT_DEPTH),
+ *		left alone for the other modes
+ * \return the mode, -1 for an unknown name, -2 for a name starting with
+ *	   welch that is malformed or has a depth out of range
+ */
+int spectrum_parse_average(const char *name, unsigned int *depth);
+
+#endif /* __POWER_SPECTRUM_H */
@@ -0,0 +1,235 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "replay.h"
+#include "latency.h"
+
+#define WAIT_MS		100	/* for a free buffer, between cancel checks */
+
+int replay_open(struct replay *rp, const char *path, uint32_t center_freq,
+		uint32_t sample_rate, int realtime, uint32_t buf_len,
+		uint32_t buf_count)
+{
+	uint32_t i;
+
+	memset(rp, 0, sizeof(*rp));
+	rp->fd = -1;
+
+	if (!sample_rate || !buf_count || buf_len < 2) {
+		fprintf(stderr, "Bad replay parameters\n");
+		return -1;
+	}
+
+	rp->center_freq = center_freq;
+	rp->sample_rate = sample_rate;
+	rp->realtime = realtime;
+	rp->buf_len = buf_len & ~1u;
+	rp->buf_count = buf_count;
+	pthread_mutex_init(&rp->lock, NULL);
+	pthread_cond_init(&rp->cond, NULL);
+
+	rp->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (rp->fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		replay_close(rp);
+		return -1;
+	}
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(rp->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	rp->pool = malloc((size_t)rp->buf_len * buf_count);
+	rp->free_bufs = calloc(buf_count, sizeof(*rp->free_bufs));
+	if (!rp->pool || !rp->free_bufs) {
+		fprintf(stderr, "Failed to allocate %u replay buffers\n", buf_count);
+		replay_close(rp);
+		return -1;
+	}
+
+	for (i = 0; i < buf_count; i++)
+		rp->free_bufs[i] = rp->pool + (size_t)i * rp->buf_len;
+	rp->n_free = buf_count;
+
+	return 0;
+}
+
+void replay_guess_tuning(const char *path, uint32_t *center_freq,
+			 uint32_t *sample_rate)
+{
+	const char *base = strrchr(path, '/');
+	const char *tok;
+	char *end;
+	double v;
+
+	base = base ? base + 1 : path;
+
+	for (tok = base; *tok; tok++) {
+		if (tok != base && tok[-1] != '_')
+			continue;
+
+		v = strtod(tok, &end);
+		if (end == tok || v <= 0)
+			continue;
+
+		if (!strncmp(end, "Hz", 2))
+			*center_freq = (uint32_t)v;
+		else if (!strncmp(end, "sps", 3))
+			*sample_rate = (uint32_t)v;
+		else if (*end == 'M' || *end == 'G')
+			*center_freq = (uint32_t)(v * (*end == 'M' ? 1e6 : 1e9));
+		else if (*end == 'k')
+			*sample_rate = (uint32_t)(v * 1e3);
+	}
+}
+
+static unsigned char *get_buffer(struct replay *rp)
+{
+	struct timespec ts;
+	unsigned char *buf = NULL;
+
+	pthread_mutex_lock(&rp->lock);
+	while (!rp->n_free && !rp->cancel) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += WAIT_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&rp->cond, &rp->lock, &ts);
+	}
+	if (rp->n_free)
+		buf = rp->free_bufs[--rp->n_free];
+	pthread_mutex_unlock(&rp->lock);
+
+	return buf;
+}
+
+void replay_release_buffer(struct replay *rp, unsigned char *buf)
+{
+	pthread_mutex_lock(&rp->lock);
+	rp->free_bufs[rp->n_free++] = buf;
+	pthread_cond_signal(&rp->cond);
+	pthread_mutex_unlock(&rp->lock);
+}
+
+static ssize_t read_full(int fd, unsigned char *buf, size_t len)
+{
+	size_t pos = 0;
+	ssize_t r;
+
+	while (pos < len) {
+		r = read(fd, buf + pos, len - pos);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return -1;
+		if (!r)
+			break;
+		pos += (size_t)r;
+	}
+
+	return (ssize_t)pos;
+}
+
+/* in real time mode, wait for when the dongle would have delivered it */
+static void pace(struct replay *rp, uint64_t end)
+{
+	uint64_t due = rp->t_start + end * 1000000000ULL / rp->sample_rate;
+	uint64_t now = lat_now();
+	struct timespec ts;
+
+	if (now >= due) {
+		if (now - due > (uint64_t)rp->buf_len / 2 * 1000000000ULL /
+				rp->sample_rate)
+			rp->late++;
+		return;
+	}
+
+	ts.tv_sec = (time_t)(due / 1000000000ULL);
+	ts.tv_nsec = (long)(due % 1000000000ULL);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR &&
+	       !rp->cancel)
+		;
+}
+
+int replay_run(struct replay *rp, rtlsdr_read_async_zc_cb_t cb, void *ctx)
+{
+	unsigned char *buf;
+	ssize_t len;
+	int ret = 0;
+
+	rp->t_start = lat_now();
+
+	while (!rp->cancel) {
+		buf = get_buffer(rp);
+		if (!buf)
+			break;
+
+		len = read_full(rp->fd, buf, rp->buf_len);
+		len &= ~(ssize_t)1;
+		if (len <= 0) {
+			if (len < 0) {
+				fprintf(stderr, "Replay: %s\n", strerror(errno));
+				ret = -1;
+			}
+			replay_release_buffer(rp, buf);
+			break;
+		}
+
+		rp->samples += (uint64_t)len / 2;
+		if (rp->realtime)
+			pace(rp, rp->samples);
+
+		rp->stamp = lat_now();
+
+		if (!cb(buf, (uint32_t)len, ctx))
+			replay_release_buffer(rp, buf);
+	}
+
+	return rp->cancel && !ret ? 1 : ret;
+}
+
+uint64_t replay_buffer_time(struct replay *rp)
+{
+	return rp->stamp;
+}
+
+void replay_cancel(struct replay *rp)
+{
+	rp->cancel = 1;
+}
+
+void replay_close(struct replay *rp)
+{
+	if (rp->fd >= 0)
+		close(rp->fd);
+	pthread_cond_destroy(&rp->cond);
+	pthread_mutex_destroy(&rp->lock);
+	free(rp->pool);
+	free(rp->free_bufs);
+	rp->fd = -1;
+	rp->pool = NULL;
+	rp->free_bufs = NULL;
+}
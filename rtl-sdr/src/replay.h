@@ -0,0 +1,102 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __REPLAY_H
+#define __REPLAY_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "rtl-sdr.h"
+
+/*
+ * Recorded u8 IQ (.cu8) in place of the dongle, for benchmarks and
+ * regression runs without hardware.
+ *
+ * replay_run() behaves like rtlsdr_read_async_zerocopy(): the file is read
+ * into a fixed pool of buffers that are handed to the same callback, which
+ * may keep a buffer (non-zero return) until replay_release_buffer(). When
+ * every buffer is held, reading waits instead of dropping, so the detector
+ * sees every sample of the file and the results only depend on the file.
+ *
+ * Buffers are stamped with CLOCK_MONOTONIC when they are handed out, which
+ * keeps the stage latency histograms meaningful. In real time mode they are
+ * handed out when the dongle would have completed them; otherwise as fast
+ * as the consumer takes them.
+ */
+
+struct replay {
+	int fd;
+	uint32_t center_freq;
+	uint32_t sample_rate;
+	int realtime;
+
+	unsigned char *pool;
+	uint32_t buf_len;
+	uint32_t buf_count;
+	unsigned char **free_bufs;
+	uint32_t n_free;
+
+	uint64_t stamp;			/* of the buffer in the callback */
+	uint64_t samples;		/* read so far */
+	uint64_t t_start;
+	uint32_t late;			/* real time buffers handed out late */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	volatile int cancel;
+};
+
+/*!
+ * Open a recording.
+ *
+ * \param buf_len bytes per buffer, even
+ * \param buf_count buffers in the pool, at most what the callback may hold
+ * \return 0 on success, -1 on failure (the reason is printed)
+ */
+int replay_open(struct replay *rp, const char *path, uint32_t center_freq,
+		uint32_t sample_rate, int realtime, uint32_t buf_len,
+		uint32_t buf_count);
+
+/*!
+ * Guess the tuning from a file name like the IQ snapshots' or rtl_433's,
+ * "..._434000000Hz_2048000sps.cu8" or "..._434.0M_2048k.cu8". Fields not
+ * found are left alone.
+ */
+void replay_guess_tuning(const char *path, uint32_t *center_freq,
+			 uint32_t *sample_rate);
+
+/*!
+ * Feed the whole file to cb, see rtlsdr_read_async_zerocopy().
+ *
+ * \return 0 at the end of the file, 1 if cancelled, -1 on a read error
+ */
+int replay_run(struct replay *rp, rtlsdr_read_async_zc_cb_t cb, void *ctx);
+
+/* give back a buffer kept by the callback, any thread */
+void replay_release_buffer(struct replay *rp, unsigned char *buf);
+
+/* like rtlsdr_get_buffer_time(), only meaningful inside the callback */
+uint64_t replay_buffer_time(struct replay *rp);
+
+/* stop replay_run() soon, async signal safe */
+void replay_cancel(struct replay *rp);
+
+/* after a successful replay_open() */
+void replay_close(struct replay *rp);
+
+#endif /* __REPLAY_H */
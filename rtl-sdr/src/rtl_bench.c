@@ -0,0 +1,528 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * rtl_bench: offline benchmark of the rtl_tcp detector
+ *
+ * Synthetic IQ (see iq_synth.h) goes through the same FFT pipeline, power
+ * spectrum, noise floors and rules rtl_tcp runs, once for every combination
+ * of FFT size, overlap and worker count, as fast as the pipeline takes it.
+ * No dongle is needed and the same options always give the same samples,
+ * so runs on different boards or builds can be compared line by line.
+ *
+ * Every threshold becomes its own rule on the same band, so one pass gives
+ * a point of the detection/false alarm curve per threshold. A frame counts
+ * as signal when a signal in the band was on for at least half of it, as
+ * noise when none was on in it or in the frames averaged with it; anything
+ * in between is not scored. Signals outside the band are
+ * interferers, whatever they trigger is a false alarm.
+ *
+ * Output is one line per configuration and threshold, '#' lines are
+ * comments, ready for gnuplot or a spreadsheet.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#else
+#include "getopt/getopt.h"
+#endif
+
+#include "fft_pipeline.h"
+#include "detector.h"
+#include "iq_convert.h"
+#include "iq_synth.h"
+#include "latency.h"
+
+#define DEFAULT_BUF_LENGTH		(16 * 32 * 512)
+#define DEFAULT_SAMPLE_RATE		2048000
+#define DEFAULT_CENTER_FREQ		434000000
+#define DEFAULT_SECONDS			5.0
+#define DEFAULT_NOISE_RMS		4.0
+#define DEFAULT_SIGNAL			"burst:250000:-15:0.05:0.2"
+#define MAX_LIST			16
+
+enum bench_stage {
+	BENCH_FILL,
+	BENCH_FFT,
+	BENCH_POWER,
+	BENCH_FLOOR,
+	BENCH_COMPARE,
+	BENCH_FRAME,
+	BENCH_STAGES
+};
+
+static struct lat_hist hists[BENCH_STAGES] = {
+	[BENCH_FILL] = { "fill" },
+	[BENCH_FFT] = { "fft" },
+	[BENCH_POWER] = { "power spectrum" },
+	[BENCH_FLOOR] = { "noise floor" },
+	[BENCH_COMPARE] = { "threshold compare" },
+	[BENCH_FRAME] = { "push -> frame done" },
+};
+
+struct bench_score {
+	uint64_t signal_frames;
+	uint64_t detected;
+	uint64_t noise_frames;
+	uint64_t false_alarms;
+};
+
+struct bench_run {
+	struct ducky_detector det;
+	const struct iq_synth *truth;
+	double band_lo;			/* Hz from the center */
+	double band_hi;
+	unsigned long n_points;
+	unsigned long memory;		/* samples averaging reaches back */
+	uint64_t frames;
+	struct bench_score score[RULE_MAX];
+};
+
+void usage(void)
+{
+	fprintf(stderr,
+		"rtl_bench, offline benchmark of the rtl_tcp detector on synthetic IQ\n\n"
+		"Use:\trtl_bench [-options]\n"
+		"\t[-s sample rate (default: %d Hz)]\n"
+		"\t[-n seconds of signal per run (default: %.0f)]\n"
+		"\t[-g signal, repeatable (default: %s)]\n"
+		"\t  tone:freq:snr\n"
+		"\t  burst:freq:snr:on_s:period_s\n"
+		"\t  chirp:freq:freq_end:snr:on_s:period_s\n"
+		"\t  (freq in Hz from the center, snr in dB over the noise in the\n"
+		"\t   whole sample rate, the FFT adds 10*log10(points) dB on a tone)\n"
+		"\t[-N noise rms per component in u8 steps (default: %.0f)]\n"
+		"\t[-S random seed (default: 1)]\n"
+		"\t[-x FFT sizes, comma separated (default: 1024,4096,16384,65536,262144)]\n"
+		"\t[-l overlaps in percent (default: 0,50,75)]\n"
+		"\t[-t FFT worker threads (default: 1,2,4)]\n"
+		"\t[-u thresholds in dB, one rule each (default: 3,6,10)]\n"
+		"\t[-b band, low:high Hz from the center (default: 200000:300000)]\n"
+		"\t[-r reference band, low:high Hz from the center (default: -600000:-400000)]\n"
+		"\t[-a frame averaging: off, coherent, incoherent or welch[:frames] (default: coherent)]\n"
+		"\t[-m noise floor estimator, as rtl_tcp -m (default: max)]\n"
+		"\t[-e FFTW planner effort (default: measure)]\n"
+		"\t[-w FFT window, as rtl_power -w (default: rectangle)]\n"
+		"\t[-W FFTW wisdom file, loaded before planning and updated afterwards]\n",
+		DEFAULT_SAMPLE_RATE, DEFAULT_SECONDS, DEFAULT_SIGNAL, DEFAULT_NOISE_RMS);
+	exit(1);
+}
+
+static int parse_list(const char *s, unsigned long *out)
+{
+	int n = 0;
+	char *end;
+
+	while (n < MAX_LIST) {
+		out[n++] = strtoul(s, &end, 10);
+		if (end == s)
+			return -1;
+		if (!*end)
+			return n;
+		if (*end != ',')
+			return -1;
+		s = end + 1;
+	}
+	return -1;
+}
+
+static int parse_dlist(const char *s, double *out)
+{
+	int n = 0;
+	char *end;
+
+	while (n < MAX_LIST) {
+		out[n++] = strtod(s, &end);
+		if (end == s)
+			return -1;
+		if (!*end)
+			return n;
+		if (*end != ',')
+			return -1;
+		s = end + 1;
+	}
+	return -1;
+}
+
+static int parse_band(const char *s, double *lo, double *hi)
+{
+	char *end;
+
+	*lo = strtod(s, &end);
+	if (end == s || *end != ':')
+		return -1;
+	s = end + 1;
+	*hi = strtod(s, &end);
+	if (end == s || *end || *hi <= *lo)
+		return -1;
+	return 0;
+}
+
+/* largest on fraction over [from, to) of any signal that reaches the band */
+static double truth_on(const struct bench_run *run, uint64_t from, uint64_t to)
+{
+	const struct iq_synth *syn = run->truth;
+	const struct iq_synth_signal *sig;
+	double f, lo, hi, on = 0;
+	unsigned int k;
+
+	for (k = 0; k < syn->n_signals; k++) {
+		sig = &syn->signals[k];
+		lo = hi = sig->freq;
+		if (sig->kind == IQ_SYNTH_CHIRP) {
+			lo = sig->freq < sig->freq_end ? sig->freq : sig->freq_end;
+			hi = sig->freq < sig->freq_end ? sig->freq_end : sig->freq;
+		}
+		if (hi < run->band_lo || lo > run->band_hi)
+			continue;
+
+		f = iq_synth_on_fraction(syn, k, from, to);
+		if (f > on)
+			on = f;
+	}
+	return on;
+}
+
+/* the detector stage of rtl_tcp without the outputs */
+static void bench_detect(void *ctx, struct fft_job *job)
+{
+	struct bench_run *run = ctx;
+	struct rule_engine *eng = run->det.rules;
+	struct bench_score *sc;
+	uint64_t t0, t1, t2, t3, start, prev;
+	double on;
+	unsigned int k;
+
+	t0 = lat_now();
+	power_spectrum_run(&run->det.spec, job->out);
+	t1 = lat_now();
+	rule_engine_update(eng, run->det.spec.power);
+	t2 = lat_now();
+	rule_engine_run(eng, run->det.spec.power);
+	t3 = lat_now();
+
+	lat_record_span(&hists[BENCH_FILL], job->t_fill_start, job->t_fill_end);
+	lat_record_span(&hists[BENCH_FFT], job->t_fft_start, job->t_fft_end);
+	lat_record_span(&hists[BENCH_POWER], t0, t1);
+	lat_record_span(&hists[BENCH_FLOOR], t1, t2);
+	lat_record_span(&hists[BENCH_COMPARE], t2, t3);
+	lat_record_span(&hists[BENCH_FRAME], job->t_usb, t3);
+
+	run->frames++;
+	start = job->end_sample > run->n_points ? job->end_sample - run->n_points : 0;
+	prev = start > run->memory ? start - run->memory : 0;
+
+	on = truth_on(run, start, job->end_sample);
+	if (on < 0.5 && (on > 0 || truth_on(run, prev, start) > 0))
+		return;
+
+	for (k = 0; k < eng->n_rules; k++) {
+		sc = &run->score[k];
+		if (on >= 0.5) {
+			sc->signal_frames++;
+			sc->detected += eng->rules[k].active;
+		} else {
+			sc->noise_frames++;
+			sc->false_alarms += eng->rules[k].active;
+		}
+	}
+}
+
+static double p50_us(const struct lat_hist *h)
+{
+	uint32_t total;
+	uint64_t ns = lat_percentile(h, 50, &total);
+
+	return total ? ns / 1000.0 : 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct iq_synth synth;
+	struct rule_engine rules;
+	struct detection_rule rule;
+	struct detector_config cfg;
+	struct fft_pipeline pipeline;
+	struct noise_floor_config floor_cfg;
+	struct bench_run *run;
+	unsigned char *iq;
+	uint64_t len, off, t_plan, t_start, t_end;
+	uint32_t n, chunk;
+	uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+	uint32_t center = DEFAULT_CENTER_FREQ;
+	double seconds = DEFAULT_SECONDS;
+	double noise_rms = DEFAULT_NOISE_RMS;
+	uint64_t seed = 1;
+	char *signals[IQ_SYNTH_MAX];
+	unsigned int n_signals = 0;
+	unsigned long points[MAX_LIST] = {1024, 4096, 16384, 65536, 262144};
+	unsigned long overlaps[MAX_LIST] = {0, 50, 75};
+	unsigned long threads[MAX_LIST] = {1, 2, 4};
+	double thresholds[MAX_LIST] = {3, 6, 10};
+	int n_points = 5, n_overlaps = 3, n_threads = 3, n_thresholds = 3;
+	double band_lo = 200000, band_hi = 300000;
+	double ref_lo = -600000, ref_hi = -400000;
+	enum spectrum_average average = SPECTRUM_AVG_COHERENT;
+	unsigned int depth = SPECTRUM_DEFAULT_DEPTH;
+	int plan_flags = FFTW_MEASURE;
+	char *wisdom_file = NULL;
+	window_fn_t window = rectangle;
+	int opt, r, ip, io, it, k;
+	double secs, rate;
+	struct bench_score *sc;
+
+	noise_floor_defaults(&floor_cfg);
+
+	while ((opt = getopt(argc, argv, "a:b:e:g:l:m:n:N:r:s:S:t:u:w:W:x:")) != -1) {
+		switch (opt) {
+		case 'a':
+			r = spectrum_parse_average(optarg, &depth);
+			if (r < 0)
+				usage();
+			average = (enum spectrum_average)r;
+			break;
+		case 'b':
+			if (parse_band(optarg, &band_lo, &band_hi) < 0)
+				usage();
+			break;
+		case 'e':
+			plan_flags = fft_parse_effort(optarg);
+			if (plan_flags < 0)
+				usage();
+			break;
+		case 'g':
+			if (n_signals == IQ_SYNTH_MAX)
+				usage();
+			signals[n_signals++] = optarg;
+			break;
+		case 'l':
+			n_overlaps = parse_list(optarg, overlaps);
+			if (n_overlaps < 0)
+				usage();
+			break;
+		case 'm':
+			if (noise_floor_parse(&floor_cfg, optarg) < 0) {
+				fprintf(stderr, "Unknown noise floor estimator %s\n", optarg);
+				usage();
+			}
+			break;
+		case 'n':
+			seconds = atof(optarg);
+			break;
+		case 'N':
+			noise_rms = atof(optarg);
+			break;
+		case 'r':
+			if (parse_band(optarg, &ref_lo, &ref_hi) < 0)
+				usage();
+			break;
+		case 's':
+			sample_rate = (uint32_t)atof(optarg);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			n_threads = parse_list(optarg, threads);
+			if (n_threads < 0)
+				usage();
+			break;
+		case 'u':
+			n_thresholds = parse_dlist(optarg, thresholds);
+			if (n_thresholds < 0 || n_thresholds > RULE_MAX)
+				usage();
+			break;
+		case 'w':
+			window = window_lookup(optarg);
+			if (!window)
+				usage();
+			break;
+		case 'W':
+			wisdom_file = optarg;
+			break;
+		case 'x':
+			n_points = parse_list(optarg, points);
+			if (n_points < 0)
+				usage();
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (sample_rate < 1000 || seconds <= 0 || noise_rms <= 0 || noise_rms >= 40 ||
+	    fabs(band_lo) > sample_rate / 2 || fabs(band_hi) > sample_rate / 2 ||
+	    fabs(ref_lo) > sample_rate / 2 || fabs(ref_hi) > sample_rate / 2) {
+		fprintf(stderr, "Bands must lie within +-sample rate / 2\n");
+		usage();
+	}
+	for (k = 0; k < n_overlaps; k++) {
+		if (overlaps[k] > 90)
+			usage();
+	}
+	for (k = 0; k < n_threads; k++) {
+		if (threads[k] < 1)
+			usage();
+	}
+
+	iq_convert_init();
+
+	iq_synth_init(&synth, sample_rate, noise_rms, seed);
+	if (!n_signals)
+		signals[n_signals++] = DEFAULT_SIGNAL;
+	for (k = 0; k < (int)n_signals; k++) {
+		if (iq_synth_add(&synth, signals[k]) < 0) {
+			fprintf(stderr, "Bad signal %s\n", signals[k]);
+			usage();
+		}
+	}
+
+	/* generated once, every configuration sees the same samples */
+	len = 2 * (uint64_t)(seconds * sample_rate);
+	iq = malloc(len);
+	if (!iq) {
+		fprintf(stderr, "Failed to allocate %llu bytes of IQ\n", (unsigned long long)len);
+		return 1;
+	}
+	fprintf(stderr, "Generating %.1f s of IQ at %u sps...\n", seconds, sample_rate);
+	for (off = 0; off < len; off += chunk) {
+		chunk = len - off > DEFAULT_BUF_LENGTH ? DEFAULT_BUF_LENGTH : (uint32_t)(len - off);
+		iq_synth_run(&synth, iq + off, chunk);
+	}
+
+	if (wisdom_file && fft_wisdom_load(wisdom_file) < 0)
+		fprintf(stderr, "No usable FFTW wisdom in %s, planning from scratch\n", wisdom_file);
+
+	run = malloc(sizeof(*run));
+	if (!run) {
+		free(iq);
+		return 1;
+	}
+
+	printf("# rtl_bench: %u sps, %.1f s, noise rms %.1f, %s precision, %s conversion\n",
+	       sample_rate, seconds, noise_rms, FFT_PRECISION_NAME, iq_convert_name());
+	for (k = 0; k < (int)n_signals; k++)
+		printf("# signal %s\n", signals[k]);
+	printf("# band %.0f:%.0f Hz, reference %.0f:%.0f Hz, %s floor, %s window\n",
+	       band_lo, band_hi, ref_lo, ref_hi, noise_floor_name(floor_cfg.method),
+	       window_name(window));
+	printf("# stage times are medians in us\n");
+	printf("# points overlap threads  threshold   samples/s  realtime   plan_s"
+	       "    fill     fft   power   floor compare    frames  pd       pfa\n");
+
+	for (ip = 0; ip < n_points; ip++)
+	for (io = 0; io < n_overlaps; io++)
+	for (it = 0; it < n_threads; it++) {
+		/* fresh rules every run, their floors and hysteresis keep state */
+		memset(&rules, 0, sizeof(rules));
+		for (k = 0; k < n_thresholds; k++) {
+			memset(&rule, 0, sizeof(rule));
+			snprintf(rule.name, sizeof(rule.name), "%gdB", thresholds[k]);
+			rule.band_lo = (uint32_t)(center + band_lo);
+			rule.band_hi = (uint32_t)(center + band_hi);
+			rule.ref_lo = (uint32_t)(center + ref_lo);
+			rule.ref_hi = (uint32_t)(center + ref_hi);
+			rule.threshold_db = thresholds[k];
+			rule_engine_add(&rules, &rule);
+		}
+		rule_engine_layout(&rules, center - sample_rate / 2, sample_rate, points[ip], 0.01);
+
+		memset(run, 0, sizeof(*run));
+		for (k = 0; k < BENCH_STAGES; k++)
+			memset(hists[k].counts, 0, sizeof(hists[k].counts));
+		run->truth = &synth;
+		run->band_lo = band_lo;
+		run->band_hi = band_hi;
+		run->n_points = points[ip];
+		run->memory = points[ip] - points[ip] * overlaps[io] / 100;
+		if (average == SPECTRUM_AVG_WELCH)
+			run->memory *= depth - 1;
+		else if (average == SPECTRUM_AVG_NONE)
+			run->memory = 0;
+
+		cfg.n_points = points[ip];
+		cfg.average = average;
+		cfg.depth = depth;
+		cfg.floor = floor_cfg;
+		cfg.rules = &rules;
+		if (ducky_detector_init(&run->det, &cfg) < 0) {
+			fprintf(stderr, "Failed to allocate detector buffers for %lu points\n", points[ip]);
+			continue;
+		}
+
+		t_plan = lat_now();
+		if (fft_pipeline_init(&pipeline, points[ip], (unsigned int)overlaps[io],
+				      (unsigned int)threads[it], plan_flags, bench_detect, run) < 0 ||
+		    fft_pipeline_set_window(&pipeline, window) < 0) {
+			fprintf(stderr, "Failed to set up the FFT pipeline for %lu points\n", points[ip]);
+			fft_pipeline_stop(&pipeline);
+			fft_pipeline_free(&pipeline);
+			ducky_detector_free(&run->det);
+			continue;
+		}
+
+		t_start = lat_now();
+		for (off = 0; off < len; off += n) {
+			n = len - off > DEFAULT_BUF_LENGTH ? DEFAULT_BUF_LENGTH : (uint32_t)(len - off);
+			fft_pipeline_push(&pipeline, iq + off, n, lat_now());
+		}
+		fft_pipeline_drain(&pipeline);
+		t_end = lat_now();
+
+		fft_pipeline_stop(&pipeline);
+		fft_pipeline_free(&pipeline);
+
+		secs = (t_end - t_start) / 1e9;
+		rate = secs > 0 ? len / 2 / secs : 0;
+
+		for (k = 0; k < n_thresholds; k++) {
+			sc = &run->score[k];
+			printf("%8lu %7lu %7lu %10.1f %11.0f %9.2f %8.3f %7.1f %7.1f %7.1f %7.1f %7.1f %9llu  ",
+			       points[ip], overlaps[io], threads[it], thresholds[k], rate,
+			       rate / sample_rate, (t_start - t_plan) / 1e9,
+			       p50_us(&hists[BENCH_FILL]), p50_us(&hists[BENCH_FFT]),
+			       p50_us(&hists[BENCH_POWER]), p50_us(&hists[BENCH_FLOOR]),
+			       p50_us(&hists[BENCH_COMPARE]), (unsigned long long)run->frames);
+			if (sc->signal_frames)
+				printf("%-8.4f ", (double)sc->detected / sc->signal_frames);
+			else
+				printf("%-8s ", "-");
+			if (sc->noise_frames)
+				printf("%.6f\n", (double)sc->false_alarms / sc->noise_frames);
+			else
+				printf("-\n");
+		}
+		fflush(stdout);
+
+		ducky_detector_free(&run->det);
+	}
+
+	if (wisdom_file && fft_wisdom_save(wisdom_file) < 0)
+		fprintf(stderr, "Could not write FFTW wisdom to %s\n", wisdom_file);
+
+	free(run);
+	free(iq);
+	return 0;
+}
@@ -68,12 +68,14 @@
 #include <libusb.h>
 
 #include "rtl-sdr.h"
+#include "iq_convert.h"
 
 #define DEFAULT_SAMPLE_RATE		24000
 #define DEFAULT_ASYNC_BUF_NUMBER	32
 #define DEFAULT_BUF_LENGTH		(1 * 16384)
 #define MAXIMUM_OVERSAMPLE		16
 #define MAXIMUM_BUF_LENGTH		(MAXIMUM_OVERSAMPLE * DEFAULT_BUF_LENGTH)
+#define LOW_PASS_CHUNK			512
 #define AUTO_GAIN			-100
 #define BUFFER_DUMP			4096
 
@@ -221,21 +223,29 @@ void rotate_90(unsigned char *buf, uint32_t len)
 void low_pass(struct fm_state *fm, unsigned char *buf, uint32_t len)
 /* simple square window FIR */
 {
-	int i=0, i2=0;
-	while (i < (int)len) {
-		fm->now_r += ((int)buf[i]   - 127);
-		fm->now_j += ((int)buf[i+1] - 127);
-		i += 2;
-		fm->prev_index++;
-		if (fm->prev_index < fm->downsample) {
-			continue;
+	int16_t iq[LOW_PASS_CHUNK];
+	uint32_t i, n;
+	int i2=0;
+	while (len) {
+		/* convert a chunk at a time with the vector kernels */
+		n = len < LOW_PASS_CHUNK ? len : LOW_PASS_CHUNK;
+		iq_u8_to_s16(iq, buf, n, 127);
+		for (i=0; i<n; i+=2) {
+			fm->now_r += iq[i];
+			fm->now_j += iq[i+1];
+			fm->prev_index++;
+			if (fm->prev_index < fm->downsample) {
+				continue;
+			}
+			fm->signal[i2]   = fm->now_r; // * fm->output_scale;
+			fm->signal[i2+1] = fm->now_j; // * fm->output_scale;
+			fm->prev_index = 0;
+			fm->now_r = 0;
+			fm->now_j = 0;
+			i2 += 2;
 		}
-		fm->signal[i2]   = fm->now_r; // * fm->output_scale;
-		fm->signal[i2+1] = fm->now_j; // * fm->output_scale;
-		fm->prev_index = 0;
-		fm->now_r = 0;
-		fm->now_j = 0;
-		i2 += 2;
+		buf += n;
+		len -= n;
 	}
 	fm->signal_len = i2;
 }
@@ -954,6 +964,8 @@ int main(int argc, char **argv)
 	fprintf(stderr, "Using device %d: %s\n",
 		dev_index, rtlsdr_get_device_name(dev_index));
 
+	iq_convert_init();
+
 	r = rtlsdr_open(&dev, dev_index);
 	if (r < 0) {
 		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
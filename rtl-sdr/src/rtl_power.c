@@ -64,6 +64,8 @@
 #include <libusb.h>
 
 #include "rtl-sdr.h"
+#include "iq_convert.h"
+#include "window.h"
 
 #define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
@@ -137,8 +139,7 @@ void usage(void)
 		"\n"
 		"Experimental options:\n"
 		"\t[-w window (default: rectangle)]\n"
-		"\t (hamming, blackman, blackman-harris, hann-poisson, bartlett, youssef)\n"
-		// kaiser
+		"\t (hamming, blackman, blackman-harris, hann-poisson, bartlett, youssef, kaiser)\n"
 		"\t[-c crop_percent (default: 0%%, recommended: 20%%-50%%)]\n"
 		"\t (discards data at the edges, 100%% discards everything)\n"
 		"\t (has no effect for bins larger than 1MHz)\n"
@@ -314,87 +315,6 @@ int fix_fft(int16_t iq[], int m)
 	return 0;
 }
 
-double rectangle(int i, int length)
-{
-	return 1.0;
-}
-
-double hamming(int i, int length)
-{
-	double a, b, w, N1;
-	a = 25.0/46.0;
-	b = 21.0/46.0;
-	N1 = (double)(length-1);
-	w = a - b*cos(2*i*M_PI/N1);
-	return w;
-}
-
-double blackman(int i, int length)
-{
-	double a0, a1, a2, w, N1;
-	a0 = 7938.0/18608.0;
-	a1 = 9240.0/18608.0;
-	a2 = 1430.0/18608.0;
-	N1 = (double)(length-1);
-	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1);
-	return w;
-}
-
-double blackman_harris(int i, int length)
-{
-	double a0, a1, a2, a3, w, N1;
-	a0 = 0.35875;
-	a1 = 0.48829;
-	a2 = 0.14128;
-	a3 = 0.01168;
-	N1 = (double)(length-1);
-	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1) - a3*cos(6*i*M_PI/N1);
-	return w;
-}
-
-double hann_poisson(int i, int length)
-{
-	double a, N1, w;
-	a = 2.0;
-	N1 = (double)(length-1);
-	w = 0.5 * (1 - cos(2*M_PI*i/N1)) * \
-	    pow(M_E, (-a*(double)abs((int)(N1-1-2*i)))/N1);
-	return w;
-}
-
-double youssef(int i, int length)
-/* really a blackman-harris-poisson window, but that is a mouthful */
-{
-	double a, a0, a1, a2, a3, w, N1;
-	a0 = 0.35875;
-	a1 = 0.48829;
-	a2 = 0.14128;
-	a3 = 0.01168;
-	N1 = (double)(length-1);
-	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1) - a3*cos(6*i*M_PI/N1);
-	a = 0.0025;
-	w *= pow(M_E, (-a*(double)abs((int)(N1-1-2*i)))/N1);
-	return w;
-}
-
-double kaiser(int i, int length)
-// todo, become more smart
-{
-	return 1.0;
-}
-
-double bartlett(int i, int length)
-{
-	double N1, L, w;
-	L = (double)length;
-	N1 = L - 1;
-	w = (i - N1/2) / (L/2);
-	if (w < 0) {
-		w = -w;}
-	w = 1 - w;
-	return w;
-}
-
 void rms_power(struct tuning_state *ts)
 /* for bins between 1MHz and 2MHz */
 {
@@ -741,9 +661,7 @@ void scanner(void)
 			continue;
 		}
 		/* prep for fft */
-		for (j=0; j<buf_len; j++) {
-			fft_buf[j] = (int16_t)ts->buf8[j] - 127;
-		}
+		iq_u8_to_s16(fft_buf, ts->buf8, buf_len, 127);
 		ds = ts->downsample;
 		ds_p = ts->downsample_passes;
 		if (boxcar && ds > 1) {
@@ -900,22 +818,8 @@ int main(int argc, char **argv)
 				smoothing = 1;}
 			break;
 		case 'w':
-			if (strcmp("rectangle",  optarg) == 0) {
-				window_fn = rectangle;}
-			if (strcmp("hamming",  optarg) == 0) {
-				window_fn = hamming;}
-			if (strcmp("blackman",  optarg) == 0) {
-				window_fn = blackman;}
-			if (strcmp("blackman-harris",  optarg) == 0) {
-				window_fn = blackman_harris;}
-			if (strcmp("hann-poisson",  optarg) == 0) {
-				window_fn = hann_poisson;}
-			if (strcmp("youssef",  optarg) == 0) {
-				window_fn = youssef;}
-			if (strcmp("kaiser",  optarg) == 0) {
-				window_fn = kaiser;}
-			if (strcmp("bartlett",  optarg) == 0) {
-				window_fn = bartlett;}
+			if (window_lookup(optarg)) {
+				window_fn = window_lookup(optarg);}
 			break;
 		case 't':
 			fft_threads = atoi(optarg);
@@ -988,6 +892,8 @@ int main(int argc, char **argv)
 	fprintf(stderr, "Using device %d: %s\n",
 		dev_index, rtlsdr_get_device_name(dev_index));
 
+	iq_convert_init();
+
 	r = rtlsdr_open(&dev, dev_index);
 	if (r < 0) {
 		fprintf(stderr, "Failed to open rtlsdr device #%d.\n", dev_index);
@@ -28,7 +28,8 @@
 //Quack
 #include <math.h>
 #include <time.h>
-#include <fftw3.h>
+
+#ifdef HAVE_BCM2835
 #include <bcm2835.h>
 
 //Definitions to make it easier to program GPIO Pins
@@ -41,7 +42,10 @@
 #define PIN11 RPI_GPIO_P1_11
 
 #define DETECTION_PIN PIN11
-#define MAX_BINS_FOR_MEDIAN 100
+#else
+//Ducky: BCM number of header pin 11 (RPI_GPIO_P1_11), also its gpiochip0 line
+#define DETECTION_PIN 17
+#endif
 
 #ifndef _WIN32
 #include <unistd.h>
@@ -57,23 +61,41 @@
 #include <pthread.h>
 
 #include "rtl-sdr.h"
-
-//Quack - Debug global variable
-static unsigned int ll_counter = 0;
+#include "sample_ring.h"
+#include "fft_pipeline.h"
+#include "detector.h"
+#include "detector_state.h"
+#include "thread_sched.h"
+#include "iq_convert.h"
+#include "latency.h"
+#include "logger.h"
+#include "output_sched.h"
+#include "output_sink.h"
+#include "iq_server.h"
+#include "spectrum_stream.h"
+#include "iq_snapshot.h"
+#include "replay.h"
+
+#define DEFAULT_BUF_LENGTH		(16 * 32 * 512)
+#define DEFAULT_RING_SLOTS		32
+#define CHANNEL_TAPS_PER_PHASE		8
+#define CHANNEL_BLOCK			16384
+#define LOG_SLOTS			256
+#define LOG_STATUS_MS			1000
+#define DEFAULT_STREAM_SLOTS		32
+#define DEFAULT_SNAPSHOT_PRE_MS		250
+#define DEFAULT_SNAPSHOT_POST_MS	250
+#define DEFAULT_STATE_INTERVAL		60
+#define PREFAULT_STACK			(256 * 1024)
+#define RECONNECT_POLL_MS		500
 
 static pthread_t ducky_fft_thread;
 
 static pthread_cond_t exit_cond;
 static pthread_mutex_t exit_cond_lock;
 
-static pthread_mutex_t ll_mutex;
-static pthread_cond_t cond;
-
-struct llist {
-    unsigned char *data;
-	size_t len;
-	struct llist *next;
-};
+//Ducky: Hands the USB buffers lent by librtlsdr from the callback to ducky_fft
+static struct sample_ring ring;
 
 typedef struct { /* structure size must be multiple of 2 bytes */
 	char magic[4];
@@ -83,6 +105,97 @@ typedef struct { /* structure size must be multiple of 2 bytes */
 
 static rtlsdr_dev_t *dev = NULL;
 
+//Ducky: A lost dongle is reopened by serial (-U), dev only changes under dev_lock
+static pthread_mutex_t dev_lock = PTHREAD_MUTEX_INITIALIZER;
+static char dev_serial[256];
+static uint32_t dev_index = 0;
+static int source_lent = 0;		//buffers the ring holds, all must be back before a close
+static volatile int source_stopped = 0;	//main is out of the read loop
+int reconnect_timeout = -1;
+unsigned int usb_losses = 0;
+unsigned int usb_attempts = 0;
+uint64_t usb_gap_total = 0;
+uint64_t usb_gap_max = 0;
+
+//Ducky: What the dongle is set to, from the options and later client commands, reapplied after a reconnect
+struct dongle_tuning {
+	uint32_t frequency;
+	uint32_t samp_rate;
+	int gain_mode;		//0 automatic
+	int gain;		//tenths of a dB
+	int ppm;
+	int agc;
+	int ppm_set;
+	int agc_set;
+};
+
+static struct dongle_tuning dongle_tuning;
+
+//Ducky: A recording (-F) instead of the dongle, for benchmarks and regression runs
+static struct replay replay;
+char *replay_file = NULL;
+int replay_realtime = 0;
+char *event_file = NULL;
+static FILE *event_out = NULL;
+static volatile int replay_done = 0;
+
+static void sleep_ms(unsigned int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+} //sleep_ms()
+
+//Ducky: Everything that talks to the sample source goes through these
+
+//Ducky: Signal handlers only set do_exit, ducky_fft stops the source from here. Under
+//	dev_lock so reconnect_dongle can't close the handle in between, and repeated until
+//	main is out of the read, a cancel misses a reopened dongle that isn't streaming yet.
+static void source_stop(void)
+{
+	while (!source_stopped) {
+		pthread_mutex_lock(&dev_lock);
+		if (replay_file) {
+			replay_cancel(&replay);
+		} else if (dev) {
+			rtlsdr_cancel_async(dev);
+		} //if-else()
+		pthread_mutex_unlock(&dev_lock);
+		sleep_ms(100);
+	} //while()
+} //source_stop()
+
+static void source_release(unsigned char *buf)
+{
+	if (replay_file) {
+		replay_release_buffer(&replay, buf);
+	} else {
+		rtlsdr_release_buffer(dev, buf);
+		__atomic_sub_fetch(&source_lent, 1, __ATOMIC_RELEASE);
+	} //if-else()
+} //source_release()
+
+static uint32_t source_center_freq(void)
+{
+	return replay_file ? replay.center_freq : rtlsdr_get_center_freq(dev);
+} //source_center_freq()
+
+static uint32_t source_sample_rate(void)
+{
+	return replay_file ? replay.sample_rate : rtlsdr_get_sample_rate(dev);
+} //source_sample_rate()
+
+static void source_close(void)
+{
+	if (replay_file) {
+		replay_close(&replay);
+	} else {
+		rtlsdr_close(dev);
+	} //if-else()
+} //source_close()
+
 //Ducky: Added to allow "windowing" of resultant ffts
 uint32_t desiredFreqLow = 0;
 uint32_t desiredFreqHigh = 0;
@@ -97,11 +210,98 @@ double threshold_buffer = 0.5;
 
 double calculatedHalfSpan = 0;
 
-char enable_averaging = 1;
+enum spectrum_average spectrum_average = SPECTRUM_AVG_COHERENT;
+unsigned int spectrum_depth = SPECTRUM_DEFAULT_DEPTH;
+struct noise_floor_config noise_floor_cfg;
+
+//Ducky: FFT pipeline layout
+unsigned int fft_workers = 1;
+unsigned int fft_overlap = 0;
+int fft_plan_flags = FFTW_MEASURE;
+char *fft_wisdom_file = NULL;
+
+//Ducky: Window applied while converting, cuts the leakage of strong carriers outside the bands
+window_fn_t fft_window = rectangle;
+
+//Ducky: Channelizer decimation, 0 to FFT the full span
+unsigned int channel_decim = 0;
+int fft_points_set = 0;
+
+uint32_t ring_slots = DEFAULT_RING_SLOTS;
+enum sample_ring_policy ring_policy = SAMPLE_RING_DROP_OLDEST;
+
+//Ducky: IQ clients get a copy of every buffer next to the detector, -p enables it
+static struct iq_server iq_server;
+char *stream_addr = "127.0.0.1";
+int stream_port = 0;
+uint32_t stream_slots = DEFAULT_STREAM_SLOTS;
+
+//Ducky: Raw IQ around every detection goes to -D, pre/post trigger set with -M
+static struct iq_snapshot iq_snapshot;
+char *snapshot_dir = NULL;
+unsigned int snapshot_pre_ms = DEFAULT_SNAPSHOT_PRE_MS;
+unsigned int snapshot_post_ms = DEFAULT_SNAPSHOT_POST_MS;
+
+//Ducky: Noise floors and averaging history survive a restart in -j, saved every -J seconds and at exit
+static struct detector_state det_state;
+char *state_file = NULL;
+unsigned int state_interval = DEFAULT_STATE_INTERVAL;
+
+//Ducky: Stage latency histograms, dumped on SIGUSR1, every lat_interval seconds and at exit
+enum lat_stage {
+	LAT_RING,		//USB completion -> popped by ducky_fft
+	LAT_FILL,		//USB completion -> frame full
+	LAT_FFT_WAIT,
+	LAT_FFT,
+	LAT_DETECT_WAIT,
+	LAT_POWER,
+	LAT_FLOOR,
+	LAT_COMPARE,
+	LAT_FRAME,		//USB completion -> detector done
+	LAT_GPIO,		//USB completion -> rule output HIGH
+	LAT_STAGES
+};
+
+static struct lat_hist lat_hists[LAT_STAGES] = {
+	[LAT_RING] = { "usb -> ring pop" },
+	[LAT_FILL] = { "usb -> frame full" },
+	[LAT_FFT_WAIT] = { "wait for fft worker" },
+	[LAT_FFT] = { "fft" },
+	[LAT_DETECT_WAIT] = { "wait for detector" },
+	[LAT_POWER] = { "power spectrum" },
+	[LAT_FLOOR] = { "noise floor" },
+	[LAT_COMPARE] = { "threshold compare" },
+	[LAT_FRAME] = { "usb -> frame done" },
+	[LAT_GPIO] = { "usb -> gpio high" },
+};
+
+char *lat_file = NULL;
+unsigned int lat_interval = 0;
+static volatile sig_atomic_t lat_dump_requested = 0;
+
+enum logger_level log_level = LOGGER_INFO;
+
+//Ducky: CPU and real-time priority per thread role (-C), memory locked with -K
+static struct thread_sched thread_roles[THREAD_ROLES];
+int lock_memory = 0;
+
+//Ducky: Every band we watch, from -r or the -y/-z/-v/-w/-u options
+static struct rule_engine detection_rules;
+char *rules_file = NULL;
+
+//Ducky: Owns the pins, the detector only posts rule transitions to it
+static struct output_sched output_sched;
 
-int global_numq = 0;
-static struct llist *ll_buffers = 0;
-int llbuf_num=500;
+//Ducky: Where the scheduler sends pin levels and detection packets (-O)
+static struct output_sinks output_sinks;
+char *output_specs[OUTPUT_SINK_MAX];
+unsigned int n_output_specs = 0;
+
+//Ducky: Spectrum summaries for remote monitoring (-S/-T)
+static struct spectrum_stream spectrum_out;
+static struct spectrum_config spectrum_out_cfg;
+char *spectrum_specs[OUTPUT_SINK_MAX];
+unsigned int n_spectrum_specs = 0;
 
 static volatile int do_exit = 0;
 
@@ -110,16 +310,59 @@ void usage(void)
 	printf("rtl_tcp, an I/Q spectrum server for RTL2832 based DVB-T receivers. Can detect spikes in signals in certain freq window.\n"
 		"Will ignore \"DC Spike\" by dropping first few FFT ouput values to 0.\n\n"
 		"Usage:\n"
-		"\t[-a set to any value to DISABLE sample averaging]\n"
+		"\t[-a frame averaging: off, coherent, incoherent or welch[:frames], welch averages the power of the\n"
+		"\t    last frames (default: coherent, welch depth: %d), combine with -k and -l for Welch's method]\n"
+		"\t[-m noise floor estimator (default: max)]\n"
+		"\t  max                  mean of this frame's threshold window bucket maxima\n"
+		"\t  ema[:alpha]          moving average of the bucket maxima (default alpha: 0.1)\n"
+		"\t  median[:frames]      sliding median of the bucket maxima (default: 15 frames)\n"
+		"\t  cfar[:train[:guard]] cell averaging around each bin, no threshold window needed (default: 32:4)\n"
 		"\t[-f frequency to tune to [Hz]]\n"
 		"\t[-g gain (default: 0 for auto)]\n"
 		"\t[-s samplerate in Hz (default: 2048000 Hz)]\n"
 		"\t[-b number of buffers (default: 32, set by library)]\n"
-		"\t[-n max number of linked list buffers to keep (default: 500)]\n"
+		"\t[-c channelizer decimation, only FFT a channel of samplerate/c around the -y/-z and -v/-w windows\n"
+		"\t    (default: off, the FFT size is divided by c unless -x is given)]\n"
+		"\t[-n number of sample buffers to queue for the FFT (default: %d)]\n"
+		"\t[-o queue overflow policy, 'oldest' or 'newest' buffer is dropped (default: oldest)]\n"
 		"\t[-d device index (default: 0)]\n"
+		"\t[-U seconds to keep reopening a lost dongle (found again by its serial) before exiting,\n"
+		"\t    0 to exit right away (default: -1, forever)]\n"
+		"\t[-F replay a .cu8 recording instead of using the dongle, tuned as -f and -s say or else as its\n"
+		"\t    name does (..._434000000Hz_2048000sps.cu8 or ..._434.0M_2048k.cu8)]\n"
+		"\t[-R replay at the recording's real time pace instead of as fast as possible]\n"
+		"\t[-E write the replay's detection events to this file (default: stdout)]\n"
 		"\t[-u Sets the buffer to add to the dynamic buffer when determining a detection (default: 0.5) [db?]]\n"
+		"\t[-r rules file, one [name] section per band with band, reference, threshold, hysteresis,\n"
+		"\t    attack, release, min_pulse and output keys, replaces -y/-z/-v/-w/-u]\n"
 		"\t[-v Lower bound of theshold window [Hz] (must be specified if using -y/-z)]\n"
 		"\t[-w Upper bound of theshold window [Hz] (must be specified if using -y/-z]\n"
+        "\t[-t number of FFT worker threads (default: 1)]\n"
+        "\t[-l overlap between consecutive FFT frames in percent, e.g. 50 or 75 (default: 0)]\n"
+        "\t[-e FFTW planner effort: estimate, measure, patient or exhaustive (default: measure)]\n"
+        "\t[-k FFT window: rectangle, hamming, blackman, blackman-harris, hann-poisson, youssef, kaiser or bartlett,\n"
+        "\t    as in rtl_power (default: rectangle)]\n"
+        "\t[-C thread placement, repeatable: role=[cpus][:fifo|rr|other[:priority]], roles usb, convert, fft,\n"
+        "\t    detect and output, e.g. usb=0:fifo:60 or fft=2-3:rr (each FFT worker gets its own CPU of the list)]\n"
+        "\t[-K lock all memory into RAM and prefault it, no page faults once running]\n"
+        "\t[-W FFTW wisdom file, loaded before planning and updated afterwards]\n"
+        "\t[-j detector state file, resumed on start if it fits the setup and saved at exit, keeps the\n"
+        "\t    noise floors, averaging history and FFTW wisdom over a restart (default: off)]\n"
+        "\t[-J also save the detector state every J seconds, 0 for only at exit (default: %d)]\n"
+        "\t[-H append latency histograms to this file instead of stdout (dumped on SIGUSR1 and at exit)]\n"
+        "\t[-i also dump the latency histograms every i seconds (default: 0, off)]\n"
+        "\t[-O detection output, repeatable: gpio, gpiochip[:/dev/gpiochipN], udp:host:port,\n"
+        "\t    unix:/path or file:/path (default: gpio where libbcm2835 is built in)]\n"
+        "\t[-S spectrum summaries, repeatable: udp:host:port, unix:/path, file:/path or mmap:/path\n"
+        "\t    for a ring file readers map, see spectrum_stream.h (default: off)]\n"
+        "\t[-T spectrum summary shape, bins[:fps[:u8|f16[:max|mean]]] (default: 1024:5:u8:max)]\n"
+        "\t[-D write the raw IQ around every detection to .cu8 files in this directory (default: off)]\n"
+        "\t[-M milliseconds of IQ before and after the detection, pre[:post] (default: %d:%d)]\n"
+        "\t[-p serve IQ to rtl_tcp clients on this port, any number of them next to the detector (default: off);\n"
+        "\t    clients may ask for a decimated channel and 4 bit or lossless compression, see iq_server.h]\n"
+        "\t[-A listen address for -p (default: 127.0.0.1)]\n"
+        "\t[-P buffers kept for IQ clients, a client further behind is dropped (default: %d)]\n"
+        "\t[-V log level: error, warn, info or debug, debug adds a time log per frame (default: info)]\n"
         "\t[-x The number of data points to use for each FFT (default: 2^18)]\n"
         "\t FFTW recommends you set N to one of the following:\n"
         "\t  -N = 2^a\n"
@@ -128,7 +371,7 @@ void usage(void)
         "\t  -N = 7^d\n"
         "\t  -N = 11^e || N = 13^f (where e+f is either 0 or 1) \n\t**Not sure what this means, this code will not compare N to this specific rule, so you may still get warnings following this recommendation.\n"
 		"\t[-y Lower bound of FFT window [Hz]\n"
-		"\t[-z Upper bound of FFT window [Hz]\n");
+		"\t[-z Upper bound of FFT window [Hz]\n", SPECTRUM_DEFAULT_DEPTH, DEFAULT_RING_SLOTS, DEFAULT_STATE_INTERVAL, DEFAULT_SNAPSHOT_PRE_MS, DEFAULT_SNAPSHOT_POST_MS, DEFAULT_STREAM_SLOTS);
 	exit(1);
 } //usage()
 
@@ -160,7 +403,6 @@ sighandler(int signum)
 	if (CTRL_C_EVENT == signum) {
 		fprintf(stdout, "Signal caught, exiting!\n");
 		do_exit = 1;
-		rtlsdr_cancel_async(dev);
 		return TRUE;
 	}
 	return FALSE;
@@ -170,10 +412,8 @@ static void sighandler(int signum)
 {
 	fprintf(stdout, "Signal caught, exiting!\n");
 	fprintf(stdout, "Max value difference global log10(output/threshold): %f\n", max_value_difference_global);
-	rtlsdr_cancel_async(dev);
-	bcm2835_gpio_clr(DETECTION_PIN);
-	bcm2835_gpio_fsel(DETECTION_PIN, BCM2835_GPIO_FSEL_INPT);
-	bcm2835_close();
+	//Ducky: Only the flag, ducky_fft cancels the source. Pins are released in main once
+	//	the output thread is gone
 	do_exit++;
 
     if (do_exit == 2) {
@@ -183,493 +423,667 @@ static void sighandler(int signum)
         exit(0);
     } //if-else
 }
+
+//Ducky: Only flags the dump, ducky_fft writes it within a second
+static void lat_sighandler(int signum)
+{
+	(void)signum;
+	lat_dump_requested = 1;
+}
 #endif
 
-void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
+static void lat_dump_all(void)
 {
-int i;
+	FILE *f = stdout;
 
-	if(!do_exit) {
-		struct llist *rpt = (struct llist*)malloc(sizeof(struct llist));
-		rpt->data = (unsigned char*)malloc(len);
+	if (lat_file && !(f = fopen(lat_file, "a"))) {
+		fprintf(stdout, "Could not open latency file %s\n", lat_file);
+		return;
+	} //if()
 
-		memcpy(rpt->data, buf, len);
+	lat_dump(f, lat_hists, LAT_STAGES);
 
-		rpt->len = len;
-		rpt->next = NULL;
+	if (f != stdout) {
+		fclose(f);
+	} //if()
+} //lat_dump_all()
 
-/* USED FOR TESTING DATA OUTPUT!
-        FILE *test_fp = fopen("/home/pi/sample_data.txt", "w");
+int rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx)
+{
+	unsigned char *evicted;
+	uint64_t stamp = 0;
+	int r;
+
+	//Ducky: Runs on the libusb event thread, must never allocate or block.
+	//	The buffer is kept (no copy) until ducky_fft releases it. When
+	//	ducky_fft falls behind the ring drops according to ring_policy.
+	if(do_exit)
+		return 0;
+
+	//Ducky: When libusb completed this buffer, the start of every latency measurement
+	if (replay_file) {
+		stamp = replay_buffer_time(&replay);
+	} else {
+		rtlsdr_get_buffer_time(dev, &stamp);
+	} //if-else()
 
-        for(i=0; i<len; i++) {
-            fprintf(test_fp, "%u,", rpt->data[i]);
-        }
-        exit(0);
-        do_exit = 1;
-*/
+	//Ducky: Before the ring lends the buffer out, once handed back librtlsdr may refill it
+	if (stream_port) {
+		iq_server_push(&iq_server, buf, len);
+	} //if()
 
-		pthread_mutex_lock(&ll_mutex);
+	r = sample_ring_push_ref(&ring, buf, len, stamp, &evicted);
+	if (r >= 0 && !replay_file)
+		__atomic_add_fetch(&source_lent, 1, __ATOMIC_RELAXED);
+	if (evicted)
+		source_release(evicted);
 
-		if (ll_buffers == NULL) {
-			ll_buffers = rpt;
-		} else {
-			struct llist *cur = ll_buffers;
-			int num_queued = 0;
+	return r >= 0;
+}
 
-			while (cur->next != NULL) {
-				cur = cur->next;
-				num_queued++;
-			}
+//Ducky: rtl_tcp client commands, runs on the IQ server thread. Anything that moves or
+//	reshapes the spectrum would pull it out from under the detection rules, so only
+//	gain and correction commands are applied.
+static void ducky_command(void *ctx, uint8_t cmd, uint32_t param)
+{
+	int gains[64];
+	int r, n;
 
-			if(llbuf_num && llbuf_num == num_queued-2){
-				struct llist *curelem;
+	//Ducky: A recording has no tuner to set
+	if (replay_file) {
+		logger_printf(LOGGER_WARN, "Client: ignoring command 0x%02x (%u) during replay", cmd, param);
+		return;
+	} //if()
 
-				free(ll_buffers->data);
-				curelem = ll_buffers->next;
-				free(ll_buffers);
-				ll_buffers = curelem;
-			}
+	//Ducky: The dongle may be gone or being reopened
+	pthread_mutex_lock(&dev_lock);
+	if (!dev) {
+		pthread_mutex_unlock(&dev_lock);
+		logger_printf(LOGGER_WARN, "Client: ignoring command 0x%02x (%u), the dongle is reconnecting", cmd, param);
+		return;
+	} //if()
 
-			cur->next = rpt;
+	switch (cmd) {
+	case 0x03:
+		logger_printf(LOGGER_INFO, "Client: set gain mode %u", param);
+		r = rtlsdr_set_tuner_gain_mode(dev, param);
+		if (r >= 0) {
+			dongle_tuning.gain_mode = param != 0;
+		} //if()
+		break;
+	case 0x04:
+		logger_printf(LOGGER_INFO, "Client: set gain %d", (int)param);
+		r = rtlsdr_set_tuner_gain(dev, (int)param);
+		if (r >= 0) {
+			dongle_tuning.gain = (int)param;
+		} //if()
+		break;
+	case 0x05:
+		logger_printf(LOGGER_INFO, "Client: set freq correction %d", (int)param);
+		r = rtlsdr_set_freq_correction(dev, (int)param);
+		if (r >= 0) {
+			dongle_tuning.ppm = (int)param;
+			dongle_tuning.ppm_set = 1;
+		} //if()
+		break;
+	case 0x06:
+		logger_printf(LOGGER_INFO, "Client: set if stage %u gain %d", param >> 16, (int16_t)(param & 0xffff));
+		r = rtlsdr_set_tuner_if_gain(dev, param >> 16, (int16_t)(param & 0xffff));
+		break;
+	case 0x08:
+		logger_printf(LOGGER_INFO, "Client: set agc mode %u", param);
+		r = rtlsdr_set_agc_mode(dev, param);
+		if (r >= 0) {
+			dongle_tuning.agc = (int)param;
+			dongle_tuning.agc_set = 1;
+		} //if()
+		break;
+	case 0x0d:
+		n = rtlsdr_get_tuner_gains(dev, NULL);
+		if (n <= 0 || n > (int)(sizeof(gains) / sizeof(gains[0])) || param >= (uint32_t)n) {
+			r = -1;
+			break;
+		} //if()
+		rtlsdr_get_tuner_gains(dev, gains);
+		logger_printf(LOGGER_INFO, "Client: set gain %d (index %u)", gains[param], param);
+		r = rtlsdr_set_tuner_gain(dev, gains[param]);
+		if (r >= 0) {
+			dongle_tuning.gain = gains[param];
+		} //if()
+		break;
+	case 0x01:	//frequency
+	case 0x02:	//sample rate
+	case 0x07:	//test mode
+	case 0x09:	//direct sampling
+	case 0x0a:	//offset tuning
+	case 0x0b:	//rtl xtal
+	case 0x0c:	//tuner xtal
+		logger_printf(LOGGER_WARN, "Client: ignoring command 0x%02x (%u), the detector owns the tuning", cmd, param);
+		r = 0;
+		break;
+	default:
+		logger_printf(LOGGER_WARN, "Client: unknown command 0x%02x", cmd);
+		r = 0;
+		break;
+	} //switch()
+	pthread_mutex_unlock(&dev_lock);
+
+	if (r < 0) {
+		logger_printf(LOGGER_WARN, "Client: command 0x%02x (%u) failed", cmd, param);
+	} //if()
+} //ducky_command()
 
- 			if (num_queued > global_numq)
-				printf("ll+, now %d\n", num_queued);
-			else if (num_queued < global_numq)
-				printf("ll-, now %d\n", num_queued);
-			else
-				printf("ll=, now %d\n", num_queued);
+//Ducky: Runs on the output scheduler thread, pulse timing is handled there
+static void ducky_output_write(void *ctx, unsigned int pin, int level, uint64_t t_usb)
+{
+	logger_printf(LOGGER_DEBUG, "Setting GPIO %u %s", pin, level ? "HIGH" : "LOW");
+	output_sinks_write(ctx, pin, level, t_usb);
 
-			global_numq = num_queued;
-		}
-		pthread_cond_signal(&cond);
-		pthread_mutex_unlock(&ll_mutex);
-	}
-}
+	if (level) {
+		lat_record_span(&lat_hists[LAT_GPIO], t_usb, lat_now());
+	} //if()
+} //ducky_output_write()
 
-static void *ducky_fft(void *arg)
+//Ducky: Also on the scheduler thread, a new detection asks for an IQ snapshot
+static void ducky_output_notify(void *ctx, const struct output_event *ev)
 {
-    struct llist *curelem, *prev;
-    //int bytesleft, bytessent, index;
-    struct timeval tv= {1,0};
-    struct timespec ts;
-    struct timeval tp;
-    fd_set writefds;
-    int r = 0;
-
-    //Ducky: variables for fftw (pulled from fftw3_doc)
-    fftw_complex *in, *out;
-    fftw_plan p;
-    double curr_output[desiredFFTPoints], max_value_threshold, threshold_array[MAX_BINS_FOR_MEDIAN + 1];
-	long double sum_threshold_maxes;
-	double old_fft[desiredFFTPoints][2];
-    long unsigned int i,j, curr_data_point = 0, curr_max_threshold = 0, threshold_array_transition = 0;
+	output_sinks_notify(ctx, ev);
 
-    //Ducky: Filter results to narrow band
-    uint32_t tunedFreqCenter = rtlsdr_get_center_freq(dev);
-    uint32_t span = rtlsdr_get_sample_rate(dev);
-    uint32_t lowerBound = tunedFreqCenter - span/2;
+	if (snapshot_dir && ev->active && iq_snapshot_trigger(&iq_snapshot, ev->t_usb, ev->name) < 0) {
+		logger_printf(LOGGER_WARN, "%s: too many snapshots pending, skipping this one", ev->name);
+	} //if()
+} //ducky_output_notify()
 
-	//TODO: Remove this test code
+//Ducky: Detector stage of the FFT pipeline, gets every frame in order
+static void ducky_detect(void *ctx, struct fft_job *job)
+{
+	struct ducky_detector *det = ctx;
+	struct rule_engine *eng = det->rules;
+	struct detection_rule *rule;
+	struct output_event ev;
+	fft_real *curr_output = det->spec.power;
+	unsigned int k;
 	double max_value_difference = 0;
-	double max_value_difference_old = 0;
-	struct timeval sample0, sample1, sample2, sample3, sample4, sample5, sample6, sample7, sample8;
+	uint64_t sample5, sample6, sample7, sample8;
 
-	//Convert dB to a decimal value
-	threshold_buffer = pow(10, threshold_buffer);
+	if (do_exit)
+		return;
 
-    //Calculate upper/lower array bounds
-    //Calculations derived on page 41 of Ducky's notebook
-    //Attempts to add 3% buffer edge to each side
-    long double pos_temp = 0;
+	//Need to FFTShift manually!
+	//Calculate magnitude of results (combine im with real)
+	sample5 = lat_now();
+	power_spectrum_run(&det->spec, job->out);
 
-    unsigned long int lower_pos = 0;
-    unsigned long int upper_pos = desiredFFTPoints - 1;
+	//Ignore first 5 output data points, now centered (get rid of the "DC Spike" or so I know it as)
+	//for(i=desiredFFTPoints/4; i<desiredFFTPoints/4 + 5; i++) { curr_output[i] = 0; }
 
-	unsigned long int threshold_lower_pos = 0;
-	unsigned long int threshold_upper_pos = desiredFFTPoints - 1;
+	sample6 = lat_now();
 
-    if (desiredFreqLow != 0) {
-        pos_temp = desiredFreqLow - lowerBound;
-        pos_temp = pos_temp/span;
-        pos_temp = pos_temp * desiredFFTPoints;
-        pos_temp = pos_temp - 0.01*desiredFFTPoints;
+	//Ducky: Bucket maxima are taken fresh from every frame, history lives in each rule's estimator
+	rule_engine_update(eng, curr_output);
 
-        lower_pos = (unsigned long int) pos_temp;
-    } //if()
+	sample7 = lat_now();
 
-    if (desiredFreqHigh != 0) {
-        pos_temp = desiredFreqHigh - lowerBound;
-        pos_temp = pos_temp/span;
-        pos_temp = pos_temp * desiredFFTPoints;
-        pos_temp = pos_temp + 0.01*desiredFFTPoints;
+	//Ducky: One pass over the sorted band segments evaluates every rule
+	rule_engine_run(eng, curr_output);
 
-        upper_pos = (unsigned long int) pos_temp;
-    } //if()
+	//Ducky: Cheap unless a summary is due, then a few kB go out
+	if (n_spectrum_specs) {
+		spectrum_stream_update(&spectrum_out, curr_output, job->t_usb);
+	} //if()
+
+	for (k=0; k<eng->n_rules; k++) {
+		rule = &eng->rules[k];
 
-	if (thresholdFreqLow != 0) {
-        pos_temp = thresholdFreqLow - lowerBound;
-        pos_temp = pos_temp/span;
-        pos_temp = pos_temp * desiredFFTPoints;
-        pos_temp = pos_temp - 0.01*desiredFFTPoints;
+		//TODO: Used for testing -- seeing what the max value difference was...
+		if (rule->peak > max_value_difference) {
+			max_value_difference = rule->peak;
+		} //if()
+
+		if (!rule->changed) {
+			continue;
+		} //if()
 
-        threshold_lower_pos = (unsigned long int) pos_temp;
+		if (rule->active) {
+			logger_printf(LOGGER_INFO, "*** I see a signal! *** %s: bin %lu, %.2f dB over the floor",
+				      rule->name, rule->peak_bin, 10 * log10(rule->peak));
+		} else {
+			logger_printf(LOGGER_INFO, "%s: signal gone", rule->name);
+		} //if-else()
+
+		//Ducky: Every change goes out as an event, GPIO rules also drive their pin
+		ev.pin = rule->output == RULE_OUTPUT_GPIO ? rule->pin : OUTPUT_NO_PIN;
+		ev.active = rule->active;
+		ev.t_usb = job->t_usb;
+		ev.rule = k;
+		ev.name = rule->name;
+		ev.bin = rule->peak_bin;
+		ev.freq = rule_engine_bin_freq(eng, rule->peak_bin);
+		ev.snr_db = 10 * log10(rule->peak);
+		if (output_sched_post(&output_sched, &ev) < 0) {
+			logger_printf(LOGGER_WARN, "%s: output queue full, transition lost", rule->name);
+		} //if()
+
+		//Ducky: Replay event list, positions in the file so runs can be compared with diff
+		if (event_out) {
+			fprintf(event_out, "event %llu %.6f %s %s bin %lu %u Hz %.2f dB\n",
+				(unsigned long long)job->end_sample, (double)job->end_sample / replay.sample_rate,
+				rule->name, rule->active ? "on" : "off", ev.bin, ev.freq, ev.snr_db);
+		} //if()
+	} //for()
+
+	if (max_value_difference > 0) {
+		//Set to 1 for continual update of max ratio
+		if (1) {
+			if (log10(max_value_difference) > max_value_difference_global) {
+				max_value_difference_global = log10(max_value_difference);
+			} //if()
+		} //if()
+
+		//Ducky: One line a second instead of clearing the console every frame
+		logger_status("Max SNR log10(output/threshold): %f [i-1: %f, global: %f] | queue %u/%u, %u dropped",
+			      log10(max_value_difference), log10(det->max_value_difference_old),
+			      max_value_difference_global, sample_ring_fill(&ring), ring.slot_count,
+			      sample_ring_dropped(&ring));
+
+	} else {
+		logger_status("No threshold! Threshold reported as  <= 0");
 	} //if()
 
-	if (thresholdFreqHigh != 0) {
-        pos_temp = thresholdFreqHigh - lowerBound;
-        pos_temp = pos_temp/span;
-        pos_temp = pos_temp * desiredFFTPoints;
-        pos_temp = pos_temp + 0.01*desiredFFTPoints;
+	//TODO: Remove, used for timing analysis
+	//Copy current data into history
+	det->max_value_difference_old = max_value_difference;
+
+	sample8 = lat_now();
 
-        threshold_upper_pos = (unsigned long int) pos_temp;
+	//Ducky: Between two frames is the only time the state is consistent, the writer thread does the rest
+	if (state_file) {
+		detector_state_poll(&det_state, det);
 	} //if()
 
-    //Check for out of array
-    if (lower_pos > desiredFFTPoints - 1) {
-        lower_pos = desiredFFTPoints - 1;
-    } //if()
+	lat_record_span(&lat_hists[LAT_FILL], job->t_usb, job->t_fill_end);
+	lat_record_span(&lat_hists[LAT_FFT_WAIT], job->t_fill_end, job->t_fft_start);
+	lat_record_span(&lat_hists[LAT_FFT], job->t_fft_start, job->t_fft_end);
+	lat_record_span(&lat_hists[LAT_DETECT_WAIT], job->t_fft_end, sample5);
+	lat_record_span(&lat_hists[LAT_POWER], sample5, sample6);
+	lat_record_span(&lat_hists[LAT_FLOOR], sample6, sample7);
+	lat_record_span(&lat_hists[LAT_COMPARE], sample7, sample8);
+	lat_record_span(&lat_hists[LAT_FRAME], job->t_usb, sample8);
+
+	//Ducky: The histograms have the distribution, this is the frame by frame view
+	if (logger_enabled(LOGGER_DEBUG)) {
+		logger_printf(LOGGER_DEBUG, "Time log (ms): fill %f | fft wait %f | fft %f | detect wait %f | "
+			      "magnitude %f | threshold %f | compare %f | total %f",
+			      (double) (job->t_fill_end - job->t_fill_start) / 1000000,
+			      (double) (job->t_fft_start - job->t_fill_end) / 1000000,
+			      (double) (job->t_fft_end - job->t_fft_start) / 1000000,
+			      (double) (sample5 - job->t_fft_end) / 1000000,
+			      (double) (sample6 - sample5) / 1000000,
+			      (double) (sample7 - sample6) / 1000000,
+			      (double) (sample8 - sample7) / 1000000,
+			      (double) (sample8 - job->t_fill_end) / 1000000);
+	} //if()
 
-    //Check for out of array
-    if (upper_pos > desiredFFTPoints - 1) {
-        upper_pos = desiredFFTPoints - 1;
-    } //if()
+} //ducky_detect()
 
-    //Check for out of array
-    if (threshold_lower_pos > desiredFFTPoints - 1) {
-        threshold_lower_pos = desiredFFTPoints - 1;
-    } //if()
+//Ducky: Says for every thread whether its -C settings took, nothing for roles left alone
+static void apply_thread_role(enum thread_role role, int index, pthread_t thread)
+{
+	const struct thread_sched *ts = &thread_roles[role];
+	const char *warn;
+	char report[128];
+
+	if (!ts->cpus && !ts->set_policy) {
+		return;
+	} //if()
+
+	warn = thread_sched_apply(ts, thread, index, report, sizeof(report)) < 0 ? "WARNING: " : "";
+
+	if (index >= 0) {
+		printf("%sThread %s %d: %s\n", warn, thread_role_names[role], index, report);
+	} else {
+		printf("%sThread %s: %s\n", warn, thread_role_names[role], report);
+	} //if-else()
+} //apply_thread_role()
+
+//Ducky: Middle of everything the rules look at (bands and reference bands)
+static uint32_t channel_center(uint32_t tunedFreqCenter, uint32_t *width)
+{
+	uint32_t freqs[4];
+	uint32_t lo = UINT32_MAX, hi = 0;
+	unsigned int k;
+	int i;
+
+	for (k=0; k<detection_rules.n_rules; k++) {
+		freqs[0] = detection_rules.rules[k].band_lo;
+		freqs[1] = detection_rules.rules[k].band_hi;
+		freqs[2] = detection_rules.rules[k].ref_lo;
+		freqs[3] = detection_rules.rules[k].ref_hi;
+
+		for (i=0; i<4; i++) {
+			if (freqs[i] != 0) {
+				lo = freqs[i] < lo ? freqs[i] : lo;
+				hi = freqs[i] > hi ? freqs[i] : hi;
+			} //if()
+		} //for()
+	} //for()
+
+	if (hi == 0) {
+		*width = 0;
+		return tunedFreqCenter;
+	} //if()
+
+	*width = hi - lo;
+	return lo + (hi - lo) / 2;
+} //channel_center()
 
-    //Check for out of array
-    if (threshold_upper_pos > desiredFFTPoints - 1) {
-        threshold_upper_pos = desiredFFTPoints - 1;
+static void *ducky_fft(void *arg)
+{
+    struct sample_slot *curelem;
+    struct fft_pipeline pipeline;
+    struct ducky_detector det;
+    struct detector_config det_cfg;
+    struct channelizer chan;
+    struct timeval plan_start, plan_end;
+    uint64_t lat_next = 0, state_next = 0, now;
+
+    //Ducky: Filter results to narrow band
+    uint32_t tunedFreqCenter = source_center_freq();
+    uint32_t span = source_sample_rate();
+
+    memset(&chan, 0, sizeof(chan));
+
+    //Ducky: Channelizer mode, only the band around the windows goes through the FFT
+    if (channel_decim > 1) {
+        uint32_t bandWidth;
+        uint32_t chanCenter = channel_center(tunedFreqCenter, &bandWidth);
+
+        if (channelizer_init(&chan, channel_decim, CHANNEL_TAPS_PER_PHASE,
+                             ((double)chanCenter - (double)tunedFreqCenter) / span, CHANNEL_BLOCK) < 0) {
+            fprintf(stdout, "Failed to set up a channel at %u Hz!\n", chanCenter);
+            do_exit = 1;
+            source_stop();
+            return 0;
+        } //if()
+
+        printf("Channelizer: %u Hz wide channel at %u Hz, decimation %u, %lu point FFT\n",
+               span / channel_decim, chanCenter, channel_decim, desiredFFTPoints);
+
+        //The filter rolls off towards the channel edges
+        if (bandWidth > span / channel_decim * 6 / 10) {
+            printf("WARNING: Windows span %u Hz, more than 60%% of the channel, lower -c\n", bandWidth);
+        } //if()
+
+        tunedFreqCenter = chanCenter;
+        span = span / channel_decim;
     } //if()
 
+    uint32_t lowerBound = tunedFreqCenter - span/2;
+    unsigned int k;
+
+    //Calculate upper/lower array bounds of every rule
+    //Calculations derived on page 41 of Ducky's notebook
+    //Attempts to add 1% buffer edge to each side
+    rule_engine_layout(&detection_rules, lowerBound, span, desiredFFTPoints, 0.01);
 
 printf("\nf0: %u\n", tunedFreqCenter);
 printf("span: %u\n", span);
-printf("lower_pos: %lu\n", lower_pos);
-printf("upper_pos: %lu\n", upper_pos);
-printf("threshold_lower_pos: %lu\n", threshold_lower_pos);
-printf("threshold_upper_pos: %lu\n", threshold_upper_pos);
 printf("desiredFreqP: %lu\n", desiredFFTPoints);
-printf("desiredFreqH: %u\n", desiredFreqHigh);
-printf("desiredFreqL: %u\n\n", desiredFreqLow);
+for (k=0; k<detection_rules.n_rules; k++) {
+    struct detection_rule *rule = &detection_rules.rules[k];
+
+    printf("rule %s: bins %lu-%lu, reference %lu-%lu, %.1f dB (hysteresis %.1f dB)\n",
+           rule->name, rule->lo, rule->hi, rule->ref_lo_bin, rule->ref_hi_bin,
+           rule->threshold_db, rule->hysteresis_db);
+} //for()
+printf("%u band segment(s)\n\n", detection_rules.n_segs);
+
+    //Ducky: Summaries cover the whole FFT, channel or not
+    if (n_spectrum_specs) {
+        if (spectrum_stream_init(&spectrum_out, &spectrum_out_cfg, desiredFFTPoints,
+                                 tunedFreqCenter, span) < 0) {
+            fprintf(stdout, "Failed to allocate spectrum summaries!\n");
+            n_spectrum_specs = 0;
+        } //if()
+        for (k=0; k<n_spectrum_specs; k++) {
+            if (spectrum_stream_open(&spectrum_out, spectrum_specs[k]) < 0) {
+                fprintf(stdout, "WARNING: Could not open spectrum output %s\n", spectrum_specs[k]);
+            } else {
+                printf("Spectrum summaries (%u bins, %u/s) go to %s\n",
+                       spectrum_out.cfg.bins, spectrum_out.cfg.fps, spectrum_specs[k]);
+            } //if-else()
+        } //for()
+    } //if()
 
-	//TODO: REMOVE THIS!
-//    FILE *sample_file = fopen("/home/pi/sample_data_new.txt", "w");
-    FILE *test_file = fopen("/home/pi/fft_output.txt", "w");
+    det_cfg.n_points = desiredFFTPoints;
+    det_cfg.average = spectrum_average;
+    det_cfg.depth = spectrum_depth;
+    det_cfg.floor = noise_floor_cfg;
+    det_cfg.rules = &detection_rules;
+
+    //Ducky: Magnitudes, old FFT output (for averaging) and the noise floor live in the detector's heap arena
+    if (ducky_detector_init(&det, &det_cfg) < 0) {
+        fprintf(stdout, "Failed to allocate detector buffers for %lu points!\n", desiredFFTPoints);
+        channelizer_free(&chan);
+        if (n_spectrum_specs) {
+            spectrum_stream_free(&spectrum_out);
+        } //if()
+        do_exit = 1;
+        source_stop();
+        return 0;
+    } //if()
+
+    //Ducky: Pick up where the last run stopped, the file is only used if everything lines up
+    if (state_file) {
+        if (detector_state_open(&det_state, state_file) == 0) {
+            if (detector_state_restore(&det_state, &det) == 0) {
+                printf("Resumed detector state from %s, saved %.0f s ago\n",
+                       state_file, detector_state_age(&det_state));
+            } //if()
+            if (detector_state_wisdom(&det_state) && fft_wisdom_import(detector_state_wisdom(&det_state)) == 0) {
+                printf("Loaded FFTW wisdom from %s\n", state_file);
+            } //if()
+            detector_state_close(&det_state);
+        } else {
+            printf("No usable detector state in %s, starting cold\n", state_file);
+        } //if-else()
+
+        if (detector_state_init(&det_state, &det) < 0) {
+            fprintf(stdout, "WARNING: Detector state will not be saved\n");
+            state_file = NULL;
+        } else if (state_interval) {
+            if (detector_state_start(&det_state, state_file) < 0) {
+                fprintf(stdout, "WARNING: No state writer thread, the detector state is only saved at exit\n");
+            } else {
+                state_next = lat_now() + (uint64_t)state_interval * 1000000000ULL;
+            } //if-else()
+        } //if-else()
+    } //if()
 
 	printf("\nAbout to enter ducky land!\n");
 
-    //Setup fftw
-    in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * desiredFFTPoints);
-    out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * desiredFFTPoints);
-    p = fftw_plan_dft_1d(desiredFFTPoints, in, out, FFTW_FORWARD, FFTW_MEASURE);
+	//Ducky: Snapshots are of what the dongle delivers, not of the channel
+	if (snapshot_dir) {
+		if (iq_snapshot_init(&iq_snapshot, snapshot_dir, source_center_freq(), source_sample_rate(),
+				     snapshot_pre_ms, snapshot_post_ms) < 0 || iq_snapshot_start(&iq_snapshot) < 0) {
+			fprintf(stdout, "WARNING: No IQ snapshots, could not set up the history\n");
+			iq_snapshot_free(&iq_snapshot);
+			snapshot_dir = NULL;
+		} else {
+			printf("IQ snapshots to %s, %u ms before and %u ms after each detection\n",
+			       snapshot_dir, snapshot_pre_ms, snapshot_post_ms);
+		} //if-else()
+	} //if()
+
+	output_sched_init(&output_sched, ducky_output_write, ducky_output_notify, &output_sinks);
+	for (k=0; k<detection_rules.n_rules; k++) {
+		if (detection_rules.rules[k].output == RULE_OUTPUT_GPIO) {
+			if (output_sinks_have_pins(&output_sinks)) {
+				printf("Initializing GPIO %u (%s) to LOW!\n", detection_rules.rules[k].pin, detection_rules.rules[k].name);
+			} //if()
+			if (output_sinks_claim(&output_sinks, detection_rules.rules[k].pin) < 0) {
+				fprintf(stdout, "WARNING: Could not claim GPIO %u for rule %s\n", detection_rules.rules[k].pin, detection_rules.rules[k].name);
+			} //if()
+			output_sched_add_pin(&output_sched, detection_rules.rules[k].pin,
+					     detection_rules.rules[k].min_pulse_ms * 1000);
+		} //if()
+	} //for()
 
+	if (output_sched_start(&output_sched) < 0) {
+		fprintf(stdout, "Failed to start the output thread!\n");
+		if (snapshot_dir) {
+			iq_snapshot_stop(&iq_snapshot);
+			iq_snapshot_free(&iq_snapshot);
+		} //if()
+		detector_state_free(&det_state);
+		ducky_detector_free(&det);
+		if (n_spectrum_specs) {
+			spectrum_stream_free(&spectrum_out);
+		} //if()
+		channelizer_free(&chan);
+		do_exit = 1;
+		source_stop();
+		return 0;
+	} //if()
+	apply_thread_role(THREAD_OUTPUT, -1, output_sched.thread);
+
+    //Reuse plans measured by an earlier run, planning 2^18 points on a Pi takes seconds
+    if (fft_wisdom_file) {
+        if (fft_wisdom_load(fft_wisdom_file) < 0) {
+            printf("No usable FFTW wisdom in %s, planning from scratch\n", fft_wisdom_file);
+        } else {
+            printf("Loaded FFTW wisdom from %s\n", fft_wisdom_file);
+        } //if-else()
+    } //if()
 
-    int mutex_lock_check = 0;
-    struct timespec abs_time;
+    //Setup fftw, one plan per worker
+    gettimeofday(&plan_start, NULL);
+    if (fft_pipeline_init(&pipeline, desiredFFTPoints, fft_overlap, fft_workers,
+                          fft_plan_flags, ducky_detect, &det) < 0 ||
+        (chan.decim && fft_pipeline_set_channelizer(&pipeline, &chan) < 0) ||
+        fft_pipeline_set_window(&pipeline, fft_window) < 0) {
+        fprintf(stdout, "Failed to set up the FFT pipeline!\n");
+        fft_pipeline_stop(&pipeline);
+        fft_pipeline_free(&pipeline);
+        output_sched_stop(&output_sched);
+        if (snapshot_dir) {
+            iq_snapshot_stop(&iq_snapshot);
+            iq_snapshot_free(&iq_snapshot);
+        } //if()
+        detector_state_free(&det_state);
+        ducky_detector_free(&det);
+        channelizer_free(&chan);
+        if (n_spectrum_specs) {
+            spectrum_stream_free(&spectrum_out);
+        } //if()
+        do_exit = 1;
+        source_stop();
+        return 0;
+    } //if()
+    gettimeofday(&plan_end, NULL);
 
+    printf("Planned %s precision FFT in %f (s)\n", FFT_PRECISION_NAME,
+           (double) (plan_end.tv_usec - plan_start.tv_usec) / 1000000 + (double) (plan_end.tv_sec - plan_start.tv_sec));
+    printf("Converting samples with %s kernels\n", iq_convert_name());
 
-	printf("Initializing DETECTION_PIN to LOW!\n");
-	//bcm2835_gpio_write(DETECTION_PIN, LOW);
-	bcm2835_gpio_fsel(DETECTION_PIN, BCM2835_GPIO_FSEL_OUTP);
-	bcm2835_gpio_write(DETECTION_PIN, LOW);
+    if (fft_wisdom_file && fft_wisdom_save(fft_wisdom_file) < 0) {
+        printf("Could not write FFTW wisdom to %s\n", fft_wisdom_file);
+    } //if()
 
+    printf("FFT pipeline: %u worker(s), %u%% overlap, %s window\n", fft_workers, fft_overlap, window_name(fft_window));
 
-double quickMax = 0;
-double quickMin = 999;
+    for (k=0; k<fft_workers; k++) {
+        apply_thread_role(THREAD_FFT, fft_workers > 1 ? (int)k : -1, pipeline.workers[k].thread);
+    } //for()
+    apply_thread_role(THREAD_DETECT, -1, pipeline.detector);
 
+	if (lat_interval) {
+		lat_next = lat_now() + (uint64_t)lat_interval * 1000000000ULL;
+	} //if()
 
 	while(!do_exit) {
-		//if (do_exit) {
-        //    sighandler(0);
-		//	pthread_exit(NULL);
-		//} //if()
-		gettimeofday(&sample0, NULL);
-
-		do {
-            clock_gettime(CLOCK_REALTIME , &abs_time);
-		    abs_time.tv_sec += 5;
-
-		    mutex_lock_check = pthread_mutex_timedlock(&ll_mutex, &abs_time);
-//		    mutex_lock_check = pthread_mutex_lock(&ll_mutex);
-
-		    if (do_exit) {
-			break;
-		    } //if()
-		} while(mutex_lock_check != 0);
-		//gettimeofday(&tp, NULL);
-		//ts.tv_sec = tp.tv_sec + 5;
-		//ts.tv_nsec = tp.tv_usec * 1000;
-		//r = pthread_cond_timedwait(&cond, &ll_mutex, &ts);
-		//if (r == ETIMEDOUT) {
-		//	pthread_mutex_unlock(&ll_mutex);
-		//	printf("fft worker condition timeout\n");
-		//	sighandler(0);
-		//	pthread_exit(NULL);
-        //} //if()
-
-		curelem = ll_buffers;
-		ll_buffers = 0;
-		pthread_mutex_unlock(&ll_mutex);
-
-		//Initial condition check
-		if (curelem != 0) {
-			printf("Putting samples into FFT array\n");
-			gettimeofday(&sample1, NULL);
+		//Sleeps until the callback publishes a buffer, wakes up periodically to check do_exit
+		curelem = sample_ring_pop(&ring, 1000);
+
+		//Ducky: Histogram dumps happen here, off the detector thread
+		now = lat_now();
+		if (lat_dump_requested || (lat_next && now >= lat_next)) {
+			lat_dump_requested = 0;
+			lat_dump_all();
+			if (lat_next) {
+				lat_next = now + (uint64_t)lat_interval * 1000000000ULL;
+			} //if()
 		} //if()
 
-        while(curelem != 0) {
-		    if (do_exit) {
-				break;
-		    } //if()
+		//Ducky: Only the request, a slow card must not keep this thread from draining the ring
+		if (state_next && now >= state_next) {
+			detector_state_request(&det_state);
+			state_next = now + (uint64_t)state_interval * 1000000000ULL;
+		} //if()
 
-			/* Should be no need for these 3 lines */
-            //bytesleft = curelem->len;
-            //index = 0;
-            //bytessent = 0;
+		if (curelem == NULL) {
+			//Ducky: The recording is over once everything it delivered is through
+			if (replay_done && !sample_ring_fill(&ring)) {
+				break;
+			} //if()
+			continue;
+		} //if()
 
-            //Convert real data to reals and imaginaries and store in array
-            for(j=1; j < curelem->len; j=j+2) {
+		lat_record_span(&lat_hists[LAT_RING], curelem->stamp, now);
 
-				//Subtract 128 to ensure data is centered on 0
-				//if (enable_averaging) {
-	            //    in[curr_data_point][0] = (curelem->data[j-1] - 128) + old_samples[curr_data_point][0];
-	            //    in[curr_data_point][1] = (curelem->data[j] - 128) + old_samples[curr_data_point][1];
-				//} else {
-    	        in[curr_data_point][0] = (curelem->data[j-1] - 128);
-        	    in[curr_data_point][1] = (curelem->data[j] - 128);
-				//}
-
-
-				//Copy current data into history
-				//old_samples[curr_data_point][0] = curelem->data[j-1] - 128;
-				//old_samples[curr_data_point][1] = curelem->data[j] - 128;
+		//Ducky: History for the snapshots, before the FFT can see a detection in it
+		if (snapshot_dir) {
+			iq_snapshot_push(&iq_snapshot, curelem->data, curelem->len, curelem->stamp);
+		} //if()
 
+		//Converter stage, blocks while every frame is still being worked on
+		fft_pipeline_push(&pipeline, curelem->data, curelem->len, curelem->stamp);
 
-                curr_data_point++;
+		source_release(curelem->data);
+		sample_ring_release(&ring, curelem);
+	} //while()
 
-                //For testing -> Print samples to a file
-                //fprintf(sample_file, "%u, %u,", curelem->data[j-1], curelem->data[j]);
+    //Ducky: Stop the source before the long shutdown, the callback only drops buffers from here on
+    source_stop();
 
-                //Is it time to crunch FFTs yet?
-				if (curr_data_point >= desiredFFTPoints) {
+    //Ducky: Every full frame of a recording is detected, the event list must not depend on timing
+    if (replay_done && !do_exit) {
+        fft_pipeline_drain(&pipeline);
+    } //if()
 
-					gettimeofday(&sample2, NULL);
+    fft_pipeline_stop(&pipeline);
 
-                    //Reset variable to reuse it
-                    curr_data_point = 0;
+    //Ducky: The detector is idle now, the state of the last frame goes to disk
+    if (state_file) {
+        detector_state_stop(&det_state);
+        detector_state_capture(&det_state, &det);
+        if (detector_state_write(&det_state, state_file) == 0) {
+            printf("Saved detector state to %s\n", state_file);
+        } //if()
+        detector_state_free(&det_state);
+    } //if()
 
-                    //This is a test to see if this function if a blocking function
-                    fprintf(stdout, "Cruncing FFT...!  ");
-					gettimeofday(&sample3, NULL);
-                    fftw_execute(p); //Repeat as needed
-					gettimeofday(&sample4, NULL);
-                    fprintf(stdout, "...finished crunching!\n");
-
-                    //Need to FFTShift manually!
-                    //Calculate magnitude of results (combine im with real)
-					printf("Calculating Magnitudes while FFT Shifting\n");
-					gettimeofday(&sample5, NULL);
-                    for(i=desiredFFTPoints/2; i < desiredFFTPoints; i++) {
-
-						if (enable_averaging) {
-	                        curr_output[curr_data_point] = pow(out[i][0] + old_fft[i][0], 2) + pow(out[i][1] + old_fft[i][1], 2);
-						} else {
-	                        curr_output[curr_data_point] = pow(out[i][0], 2) + pow(out[i][1], 2);
-						} //if-else()
-
-						//Write output to history
-						old_fft[i][0] = out[i][0];
-						old_fft[i][1] = out[i][1];
+    fft_pipeline_free(&pipeline);
 
-                        curr_data_point++;
-                    } //for()
-
-                    for(i=0; i < desiredFFTPoints/2; i++) {
+    //Pins go LOW once the last pulse is out
+    output_sched_stop(&output_sched);
 
-						if (enable_averaging) {
-	                        curr_output[curr_data_point] = pow(out[i][0] + old_fft[i][0], 2) + pow(out[i][1] + old_fft[i][1], 2);
-						} else {
-	                        curr_output[curr_data_point] = pow(out[i][0], 2) + pow(out[i][1], 2);
-						} //if-else()
-
-						//Write output to history
-						old_fft[i][0] = out[i][0];
-						old_fft[i][1] = out[i][1];
-
-                        curr_data_point++;
-                    } //for()
-
-					//Ignore first 5 output data points, now centered (get rid of the "DC Spike" or so I know it as)
-					//for(i=desiredFFTPoints/4; i<desiredFFTPoints/4 + 5; i++) { curr_output[i] = 0; }
-
-					gettimeofday(&sample6, NULL);
-
-					printf("Finding average threshold max\n");
-
-					//Get max signal in threshold
-					//max_value_threshold = 0;
-					sum_threshold_maxes = 0;
-					max_value_difference = 0.0;
-					curr_max_threshold = 0;
-					threshold_array_transition = (threshold_upper_pos - threshold_lower_pos) / MAX_BINS_FOR_MEDIAN;
-
-					if (thresholdFreqLow != 0 || thresholdFreqHigh != 0) {
-						for(i=threshold_lower_pos; i<threshold_upper_pos; i++) {
-							if (i > (threshold_array_transition * curr_max_threshold) + threshold_lower_pos) {
-								curr_max_threshold++;
-							} //if()
-
-							if (curr_output[i] > threshold_array[curr_max_threshold]) {
-								threshold_array[curr_max_threshold] = curr_output[i];
-							} //if()
-						} //for()
-					} //if()
-
-					for (i=0; i<curr_max_threshold; i++) {
-						sum_threshold_maxes += threshold_array[i];
-					} //for()
-
-					max_value_threshold = sum_threshold_maxes / curr_max_threshold;
-
-					gettimeofday(&sample7, NULL);
-					printf("Checking window for spike.\n");
-                    //Check window for signal
-                    if (max_value_threshold > 0) {
-                        for(i=lower_pos; i<upper_pos; i++) {
-							//TODO: Used for testing -- seeing what the max value difference was...
-							if ( curr_output[i] / max_value_threshold > max_value_difference) {
-								max_value_difference = curr_output[i] / max_value_threshold;
-							} //if()
-
-							//Note: threshold_buffer is converted to decimal value earlier in this function.
-                            if ( curr_output[i] / max_value_threshold > threshold_buffer) {
-                                //do_exit = 1;
-
-                                fprintf(stdout, "*** I see a signal! ***\n");
-
-								//Ensures uController sees the pulse (~0.1 ms delay)
-								if (bcm2835_gpio_lev(DETECTION_PIN) == HIGH) {
-									bcm2835_gpio_write(DETECTION_PIN, LOW);
-									bcm2835_delayMicroseconds(90);
-								} //if()
-
-								printf("Setting DETECTION_PIN HIGH\n");
-								bcm2835_gpio_write(DETECTION_PIN, HIGH);
-								//bcm2835_delay(1000);
-
-								//Set to 1 for print to file on detection, 0 for no print to file
-								if (0) {
-									fprintf(stdout, "\nPrinting data to file...\n");
-
-									//Add large spike to signify search bounderies
-									curr_output[lower_pos] = 10000000000000;
-									curr_output[upper_pos] = 10000000000000;
-									curr_output[threshold_lower_pos] = 10000000000000;
-									curr_output[threshold_upper_pos] = 10000000000000;
-
-                    	            //For testing -> Print ffts to a file
-                        	        for(i=0; i < desiredFFTPoints; i++) {
-                            	        fprintf(test_file, "%f,", curr_output[i]);
-	                                } //for()
-    	                            fprintf(stdout, "...done\n\nGoodbye!\n\n");
-
-        	                        do_exit = 1;
-								} //if()
-
-								//exit(0);
-
-								break;
-/*                            } else if ( curr_output[i] / max_value_threshold < pow(10,-1.0)) { //WHY DOES THIS HAPPEN!?!?!
-
-								//Set to 1 for print to file on detection, 0 for no print to file
-								if (1) {
-									fprintf(stdout, "\nPrinting data to file...\n");
-
-									//Add large spike to signify search bounderies
-									curr_output[lower_pos] = 10000000000000;
-									curr_output[upper_pos] = 10000000000000;
-									curr_output[threshold_lower_pos] = 10000000000000;
-									curr_output[threshold_upper_pos] = 10000000000000;
-
-                    	            //For testing -> Print ffts to a file
-                        	        for(i=0; i < desiredFFTPoints; i++) {
-                            	        fprintf(test_file, "%f,", curr_output[i]);
-	                                } //for()
-    	                            fprintf(stdout, "...done\n\nGoodbye!\n\n");
-
-        	                        do_exit = 1;
-								} //if()
-
-*/
-                            } else {
-								if (bcm2835_gpio_lev(DETECTION_PIN) != LOW) {
-									printf("Setting DETECTION_PIN LOW\n");
-									bcm2835_gpio_write(DETECTION_PIN, LOW);
-								} //if()
-							} //if-else()
-                        } //for()
-
-						//Set to 1 for continual update of max ratio
-						if (1) {
-							if (log10(max_value_difference) > max_value_difference_global) {
-								max_value_difference_global = log10(max_value_difference);
-							} //if()
-						} //if()
-
-						//Clear the console
-						system("clear");
-
-						//printf("Max SNR (output/threshold): %f\n", max_value_difference);
-						printf("Max SNR log10(output/threshold): %f\n", log10(max_value_difference));
-						printf("Max SNR log10(output/threshold): %f [i-1]\n", log10(max_value_difference_old));
-						printf("Max value difference global log10(output/threshold): %f\n", max_value_difference_global);
-
-                    } else {
-						printf("No threshold! Threshold reported as  <= 0\n");
-					} //if()
-
-                    //Reset variables
-                    curr_data_point = 0;
-                    //freopen(NULL, "w", sample_file);
-                    //freopen(NULL, "w", test_file);
-
-					//TODO: Remove, used for timing analysis
-					//Copy current data into history
-					max_value_difference_old = max_value_difference;
-
-					gettimeofday(&sample8, NULL);
-
-
-		printf("\n***** Time log! *****\n");
-		printf("-Mutex locking global linked list: %f (ms)\n", (double) (sample1.tv_usec - sample0.tv_usec) / 1000000 + (double) (sample1.tv_sec - sample0.tv_sec)); //1-0
-		printf("-Inputing samples into FFT array & history: %f (ms)\n", (double) (sample2.tv_usec - sample1.tv_usec) / 1000000 + (double) (sample2.tv_sec - sample1.tv_sec)); //2-1
-		printf("-Crunching FFT: %f (ms)\n", (double) (sample4.tv_usec - sample3.tv_usec) / 1000000 + (double) (sample4.tv_sec - sample3.tv_sec)); //4-3
-		printf("-Calculating magnitude and FFT Shift: %f (ms)\n", (double) (sample6.tv_usec - sample5.tv_usec) / 1000000 + (double) (sample6.tv_sec - sample5.tv_sec)); //6-5
-		printf("-Threshold find: %f (ms)\n", (double) (sample7.tv_usec - sample6.tv_usec) / 1000000 + (double) (sample7.tv_sec - sample6.tv_sec)); //7-6
-		printf("-Above threshold comparisons: %f (ms)\n", (double) (sample8.tv_usec - sample7.tv_usec) / 1000000 + (double) (sample8.tv_sec - sample7.tv_sec)); //8-7
-		printf("-Total: %f (ms)\n\n", (double) (sample8.tv_usec - sample1.tv_usec) / 1000000 + (double) (sample8.tv_sec - sample1.tv_sec)); //8-1
-
-
-                } //if()
-            } //for(each data point in buffer)
-
-            prev = curelem;
-            curelem = curelem->next;
-            free(prev->data);
-            free(prev);
-        } //while(we have not reached the end of the buffer)
+    //Pending snapshots get what was recorded until now
+    if (snapshot_dir) {
+        iq_snapshot_stop(&iq_snapshot);
+        printf("%u IQ snapshot(s) written, %u truncated, %u skipped\n",
+               iq_snapshot.written, iq_snapshot.truncated, iq_snapshot.dropped);
+        iq_snapshot_free(&iq_snapshot);
+    } //if()
 
-	} //while()
+    lat_dump_all();
 
-//    fclose(sample_file);
-//    fclose(test_file);
+    ducky_detector_free(&det);
+    channelizer_free(&chan);
 
-    fftw_destroy_plan(p);
-    fftw_free(in);
-    fftw_free(out);
+    if (n_spectrum_specs) {
+        spectrum_stream_free(&spectrum_out);
+    } //if()
 
     return 0;
 
@@ -694,22 +1108,126 @@ static int set_gain_by_index(rtlsdr_dev_t *_dev, unsigned int index)
 	return res;
 }
 
+//Ducky: Everything tune_dongle() sets, from dongle_tuning
+static void tune_dongle(rtlsdr_dev_t *d)
+{
+	int r;
+
+	/* Set the frequency */
+	r = rtlsdr_set_center_freq(d, dongle_tuning.frequency);
+	if (r < 0)
+		fprintf(stdout, "WARNING: Failed to set center freq.\n");
+	else
+		fprintf(stdout, "Tuned to %i Hz.\n", dongle_tuning.frequency);
+
+	if (!dongle_tuning.gain_mode) {
+		 /* Enable automatic gain */
+		r = rtlsdr_set_tuner_gain_mode(d, 0);
+        fprintf(stdout, "Enabling automatic gain...\n");
+		if (r < 0)
+			fprintf(stdout, "WARNING: Failed to enable automatic gain.\n");
+	} else {
+		/* Enable manual gain */
+		r = rtlsdr_set_tuner_gain_mode(d, 1);
+		if (r < 0)
+			fprintf(stdout, "WARNING: Failed to enable manual gain.\n");
+
+		/* Set the tuner gain */
+		r = rtlsdr_set_tuner_gain(d, dongle_tuning.gain);
+		if (r < 0)
+			fprintf(stdout, "WARNING: Failed to set tuner gain.\n");
+		else
+			fprintf(stdout, "Tuner gain set to %f dB.\n", dongle_tuning.gain/10.0);
+	}
+
+	//Ducky: Only what clients changed, the options don't set these
+	if (dongle_tuning.ppm_set && rtlsdr_set_freq_correction(d, dongle_tuning.ppm) < 0)
+		fprintf(stdout, "WARNING: Failed to set freq correction.\n");
+	if (dongle_tuning.agc_set && rtlsdr_set_agc_mode(d, dongle_tuning.agc) < 0)
+		fprintf(stdout, "WARNING: Failed to set agc mode.\n");
+
+	/* Reset endpoint before we start reading from it (mandatory) */
+	r = rtlsdr_reset_buffer(d);
+	if (r < 0)
+		fprintf(stdout, "WARNING: Failed to reset buffers.\n");
+} //tune_dongle()
+
+//Ducky: The dongle fell off the bus, wait for it to come back and set it up as it was.
+//	ducky_fft and the pipeline never notice, they just get no samples for a while.
+static int reconnect_dongle(void)
+{
+	rtlsdr_dev_t *lost = dev, *found = NULL;
+	uint64_t lost_at = lat_now(), give_up = 0, gap;
+	unsigned int attempts = 0;
+	int index;
+
+	usb_losses++;
+	logger_printf(LOGGER_WARN, "Lost the dongle, trying to reopen %s every %d ms",
+		      dev_serial[0] ? dev_serial : "it", RECONNECT_POLL_MS);
+
+	//Ducky: Lent buffers go away with the handle, ducky_fft gives every one back first
+	while (__atomic_load_n(&source_lent, __ATOMIC_ACQUIRE) && !do_exit) {
+		sleep_ms(1);
+	} //while()
+	if (do_exit) {
+		return -1;
+	} //if()
+
+	pthread_mutex_lock(&dev_lock);
+	dev = NULL;
+	pthread_mutex_unlock(&dev_lock);
+	rtlsdr_close(lost);
+
+	if (reconnect_timeout > 0) {
+		give_up = lost_at + (uint64_t)reconnect_timeout * 1000000000ULL;
+	} //if()
+
+	while (!do_exit && (!give_up || lat_now() < give_up)) {
+		sleep_ms(RECONNECT_POLL_MS);
+		attempts++;
+		usb_attempts++;
+
+		//Ducky: By serial, the index changes when other dongles come and go
+		index = dev_serial[0] ? rtlsdr_get_index_by_serial(dev_serial) : (int)dev_index;
+		if (index < 0 || rtlsdr_open(&found, (uint32_t)index) < 0 || !found) {
+			found = NULL;
+			continue;
+		} //if()
+
+		if (rtlsdr_set_sample_rate(found, dongle_tuning.samp_rate) < 0)
+			fprintf(stdout, "WARNING: Failed to set sample rate.\n");
+		tune_dongle(found);
+
+		pthread_mutex_lock(&dev_lock);
+		dev = found;
+		pthread_mutex_unlock(&dev_lock);
+
+		gap = lat_now() - lost_at;
+		usb_gap_total += gap;
+		if (gap > usb_gap_max) {
+			usb_gap_max = gap;
+		} //if()
+		logger_printf(LOGGER_WARN, "Dongle back after %u attempt(s), %.1f s without samples",
+			      attempts, gap / 1e9);
+		return 0;
+	} //while()
+
+	logger_printf(LOGGER_ERROR, "Gave up on the dongle after %u attempt(s)", attempts);
+	return -1;
+} //reconnect_dongle()
+
 int main(int argc, char **argv)
 {
 	int r, opt, i;
 	uint32_t frequency = 100000000, samp_rate = 2048000;
-	struct sockaddr_in local, remote;
 	int device_count;
-	uint32_t dev_index = 0, buf_num = 0;
+	uint32_t buf_num = 0;
 	int gain = 0;
-	struct llist *curelem,*prev;
+	int freq_set = 0, rate_set = 0;
 	pthread_attr_t attr;
 	void *status;
-	struct timeval tv = {1,0};
-	struct linger ling = {1,0};
-	fd_set readfds;
-	u_long blockmode = 1;
 	dongle_info_t dongle_info;
+	struct sample_slot *curelem;
 #ifdef _WIN32
 	WSADATA wsd;
 	i = WSAStartup(MAKEWORD(2,2), &wsd);
@@ -717,30 +1235,163 @@ int main(int argc, char **argv)
 	struct sigaction sigact, sigign;
 #endif
 
-	while ((opt = getopt(argc, argv, "a:d:f:g:s:b:n:v:w:u:y:x:z:")) != -1) {
+	noise_floor_defaults(&noise_floor_cfg);
+	spectrum_stream_defaults(&spectrum_out_cfg);
+
+	while ((opt = getopt(argc, argv, "a:c:C:d:D:e:E:f:F:g:s:b:H:i:j:J:k:Kl:m:M:n:o:O:p:P:r:RS:T:t:U:v:V:w:W:u:y:x:z:A:")) != -1) {
 		switch (opt) {
 		case 'a':
-			enable_averaging = 0;
-			printf("Disabling averaging\n");
+			//Ducky: Any other value keeps the old "-a disables averaging" meaning, a bad welch depth is an error
+			r = spectrum_parse_average(optarg, &spectrum_depth);
+			if (r == -2) {
+				fprintf(stderr, "Bad Welch depth in %s, 1-%d frames\n", optarg, SPECTRUM_MAX_DEPTH);
+				usage();
+			} //if()
+			spectrum_average = r < 0 ? SPECTRUM_AVG_NONE : (enum spectrum_average)r;
+			if (SPECTRUM_AVG_NONE == spectrum_average)
+				printf("Disabling averaging\n");
+			break;
+		case 'c':
+			channel_decim = (unsigned int) atoi(optarg);
+			if (channel_decim < 2) {
+				channel_decim = 0;
+			} //if()
+			break;
+		case 'm':
+			if (noise_floor_parse(&noise_floor_cfg, optarg) < 0) {
+				fprintf(stderr, "Unknown noise floor estimator %s\n", optarg);
+				usage();
+			} //if()
 			break;
 		case 'd':
 			dev_index = atoi(optarg);
 			break;
 		case 'f':
 			frequency = (uint32_t)atof(optarg);
+			freq_set = 1;
 			break;
 		case 'g':
 			gain = (int)(atof(optarg) * 10); /* tenths of a dB */
 			break;
 		case 's':
 			samp_rate = (uint32_t)atof(optarg);
+			rate_set = 1;
 			break;
 		case 'b':
 			buf_num = atoi(optarg);
 			break;
 		case 'n':
-			llbuf_num = atoi(optarg);
-			printf("Max buffers set to: %d\n", llbuf_num);
+			ring_slots = (uint32_t) atoi(optarg);
+			printf("Sample buffers set to: %u\n", ring_slots);
+			break;
+		case 'o':
+			if (!strcmp(optarg, "newest"))
+				ring_policy = SAMPLE_RING_DROP_NEWEST;
+			else if (!strcmp(optarg, "oldest"))
+				ring_policy = SAMPLE_RING_DROP_OLDEST;
+			else
+				usage();
+			break;
+		case 'e':
+			fft_plan_flags = fft_parse_effort(optarg);
+			if (fft_plan_flags < 0)
+				usage();
+			break;
+		case 'W':
+			fft_wisdom_file = optarg;
+			break;
+		case 'C':
+			if (thread_sched_parse(thread_roles, optarg) < 0) {
+				fprintf(stderr, "Bad thread setting %s\n", optarg);
+				usage();
+			} //if()
+			break;
+		case 'K':
+			lock_memory = 1;
+			break;
+		case 'U':
+			reconnect_timeout = atoi(optarg);
+			break;
+		case 'j':
+			state_file = optarg;
+			break;
+		case 'J':
+			state_interval = (unsigned int) atoi(optarg);
+			break;
+		case 'k':
+			fft_window = window_lookup(optarg);
+			if (!fft_window) {
+				fprintf(stderr, "Unknown window %s\n", optarg);
+				usage();
+			} //if()
+			break;
+		case 'H':
+			lat_file = optarg;
+			break;
+		case 'i':
+			lat_interval = (unsigned int) atoi(optarg);
+			break;
+		case 'r':
+			rules_file = optarg;
+			break;
+		case 'O':
+			if (n_output_specs == OUTPUT_SINK_MAX)
+				usage();
+			output_specs[n_output_specs++] = optarg;
+			break;
+		case 'S':
+			if (n_spectrum_specs == OUTPUT_SINK_MAX)
+				usage();
+			spectrum_specs[n_spectrum_specs++] = optarg;
+			break;
+		case 'T':
+			if (spectrum_stream_parse(&spectrum_out_cfg, optarg) < 0) {
+				fprintf(stderr, "Bad spectrum summary shape %s\n", optarg);
+				usage();
+			} //if()
+			break;
+		case 'F':
+			replay_file = optarg;
+			break;
+		case 'R':
+			replay_realtime = 1;
+			break;
+		case 'E':
+			event_file = optarg;
+			break;
+		case 'D':
+			snapshot_dir = optarg;
+			break;
+		case 'M':
+			if (iq_snapshot_parse(&snapshot_pre_ms, &snapshot_post_ms, optarg) < 0) {
+				fprintf(stderr, "Bad snapshot length %s\n", optarg);
+				usage();
+			} //if()
+			break;
+		case 'p':
+			stream_port = atoi(optarg);
+			break;
+		case 'A':
+			stream_addr = optarg;
+			break;
+		case 'P':
+			stream_slots = (uint32_t) atoi(optarg);
+			break;
+		case 'V':
+			r = logger_parse_level(optarg);
+			if (r < 0)
+				usage();
+			log_level = (enum logger_level)r;
+			break;
+		case 't':
+			fft_workers = (unsigned int) atoi(optarg);
+			if (fft_workers < 1)
+				usage();
+			break;
+		case 'l':
+			fft_overlap = (unsigned int) atoi(optarg);
+			if (fft_overlap > 90)
+				usage();
 			break;
 		case 'v':
 			thresholdFreqLow = (uint32_t) atoi(optarg);
@@ -757,6 +1408,7 @@ int main(int argc, char **argv)
             break;
         case 'x':
             desiredFFTPoints = (long unsigned int) atoi(optarg);
+            fft_points_set = 1;
             printf("Number of points for each FFT: %lu", desiredFFTPoints);
             break;
         case 'z':
@@ -772,22 +1424,94 @@ int main(int argc, char **argv)
 	if (argc < optind)
 		usage();
 
-	device_count = rtlsdr_get_device_count();
-	if (!device_count) {
-		fprintf(stdout, "No supported devices found.\n");
-		exit(1);
+	//Ducky: Before anything big is allocated, so every buffer is faulted in once at allocation
+	if (lock_memory) {
+		char report[128];
+
+		r = thread_sched_lock_memory(report, sizeof(report));
+		printf("%s%s\n", r < 0 ? "WARNING: " : "", report);
+		thread_sched_prefault_stack(PREFAULT_STACK);
 	}
 
-	printf("Found %d device(s).\n", device_count);
-	printf("Threshold buffer is 10^%f\n", threshold_buffer);
+	if (rules_file) {
+		r = rule_engine_load(&detection_rules, rules_file);
+		if (r <= 0) {
+			fprintf(stdout, "No detection rules in %s\n", rules_file);
+			exit(1);
+		}
+		printf("Loaded %d detection rule(s) from %s\n", r, rules_file);
+	}
 
-	rtlsdr_open(&dev, dev_index);
-	if (NULL == dev) {
-	fprintf(stdout, "Failed to open rtlsdr device #%d.\n", dev_index);
-		exit(1);
+	//Ducky: Pins go to the bcm2835 library unless other outputs are given
+#ifdef HAVE_BCM2835
+	if (!n_output_specs) {
+		output_specs[n_output_specs++] = "gpio";
 	}
+#endif
+	for (i=0; i<(int)n_output_specs; i++) {
+		if (output_sinks_open(&output_sinks, output_specs[i]) < 0) {
+			fprintf(stdout, "Could not open output %s\n", output_specs[i]);
+			output_sinks_close(&output_sinks);
+			exit(1);
+		}
+		printf("Detections go to %s\n", output_specs[i]);
+	}
+
+	//Ducky: Same bin width over the narrower channel
+	if (channel_decim && !fft_points_set) {
+		desiredFFTPoints /= channel_decim;
+	} //if()
+
+	printf("Threshold buffer is 10^%f\n", threshold_buffer);
+
+	//Ducky: The replay pool never outgrows the ring, so no buffer of the recording is dropped
+	if (replay_file) {
+		uint32_t guess_freq = frequency, guess_rate = samp_rate;
+
+		replay_guess_tuning(replay_file, &guess_freq, &guess_rate);
+		if (!freq_set) {
+			frequency = guess_freq;
+		}
+		if (!rate_set) {
+			samp_rate = guess_rate;
+		}
+		if (replay_open(&replay, replay_file, frequency, samp_rate, replay_realtime,
+				DEFAULT_BUF_LENGTH, ring_slots) < 0) {
+			exit(1);
+		}
+		event_out = stdout;
+		if (event_file && !(event_out = fopen(event_file, "w"))) {
+			fprintf(stdout, "Could not open event file %s\n", event_file);
+			replay_close(&replay);
+			exit(1);
+		}
+		printf("Replaying %s (%u Hz, %u S/s) %s\n", replay_file, frequency, samp_rate,
+		       replay_realtime ? "in real time" : "as fast as possible");
+	} else {
+		device_count = rtlsdr_get_device_count();
+		if (!device_count) {
+			fprintf(stdout, "No supported devices found.\n");
+			exit(1);
+		}
+
+		printf("Found %d device(s).\n", device_count);
+
+		rtlsdr_open(&dev, dev_index);
+		if (NULL == dev) {
+		fprintf(stdout, "Failed to open rtlsdr device #%d.\n", dev_index);
+			exit(1);
+		}
+
+		printf("Using %s\n", rtlsdr_get_device_name(dev_index));
 
-	printf("Using %s\n", rtlsdr_get_device_name(dev_index));
+		//Ducky: What a reconnect looks for, the index may differ once it is back
+		if (rtlsdr_get_device_usb_strings(dev_index, NULL, NULL, dev_serial) < 0) {
+			dev_serial[0] = '\0';
+		} //if()
+		if (reconnect_timeout && !dev_serial[0]) {
+			fprintf(stdout, "WARNING: The dongle has no serial, a lost one is reopened as device #%d\n", dev_index);
+		} //if()
+	} //if-else()
 #ifndef _WIN32
 	sigact.sa_handler = sighandler;
 	sigemptyset(&sigact.sa_mask);
@@ -797,13 +1521,17 @@ int main(int argc, char **argv)
 	sigaction(SIGTERM, &sigact, NULL);
 	sigaction(SIGQUIT, &sigact, NULL);
 	sigaction(SIGPIPE, &sigign, NULL);
+	sigact.sa_handler = lat_sighandler;
+	sigaction(SIGUSR1, &sigact, NULL);
 #else
 	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sighandler, TRUE );
 #endif
 	/* Set the sample rate */
-	r = rtlsdr_set_sample_rate(dev, samp_rate);
-	if (r < 0)
-		fprintf(stdout, "WARNING: Failed to set sample rate.\n");
+	if (dev) {
+		r = rtlsdr_set_sample_rate(dev, samp_rate);
+		if (r < 0)
+			fprintf(stdout, "WARNING: Failed to set sample rate.\n");
+	}
 
     /* Ducky: Warn of possibly un-optimal FFT sample usage */
     if ( (desiredFFTPoints % 2) && (desiredFFTPoints % 3) &&
@@ -819,7 +1547,7 @@ int main(int argc, char **argv)
 
 
     /* Ducky: Calculate requested span, compare to sample rate */
-    calculatedHalfSpan = rtlsdr_get_sample_rate(dev) / 2;
+    calculatedHalfSpan = source_sample_rate() / 2;
 
     if (desiredFreqHigh && (desiredFreqHigh > (frequency + calculatedHalfSpan) || desiredFreqHigh < (frequency - calculatedHalfSpan))) {
         fprintf(stdout, "Desired upper bound is outside the output span.\n \
@@ -857,85 +1585,126 @@ int main(int argc, char **argv)
         thresholdFreqHigh = 0;
     } //if()
 
-    if (!desiredFreqLow && !desiredFreqHigh) {
+    if (!rules_file && !desiredFreqLow && !desiredFreqHigh) {
         fprintf(stdout, "WARNING: No freq window specified, will not search for signal!! Specify with -y & -z params\n");
     } //if()
 
 
+	//Ducky: CFAR takes its floor from the bins around the band, the threshold window is not used
 	//Check for proper threshold window
-	if ((desiredFreqLow || desiredFreqHigh) &&
+	if (!rules_file && (desiredFreqLow || desiredFreqHigh) &&
+		NOISE_FLOOR_CFAR != noise_floor_cfg.method &&
 		!(thresholdFreqHigh < desiredFreqLow) &&
 		!(desiredFreqHigh < thresholdFreqLow)) {
 		fprintf(stdout, "WARNING: Your FFT window overlaps with your threshold window\n");
 	} //if()
 
 	//Check to see if threshold window was even set
-	if ((desiredFreqLow || desiredFreqHigh) && !thresholdFreqLow && !thresholdFreqHigh) {
+	if (!rules_file && (desiredFreqLow || desiredFreqHigh) && !thresholdFreqLow && !thresholdFreqHigh &&
+		NOISE_FLOOR_CFAR != noise_floor_cfg.method) {
 		fprintf(stdout, "WARNING: You specified an FFT window, but failed to specify a threshold window.  No detection algorithm will run\n");
 	} //if()
 
+	//Ducky: Without a rules file the single window options make one rule on DETECTION_PIN.
+	//	Without them there is no rule, a band of 0/0 would be the whole span, DC spike included
+	if (!rules_file && (desiredFreqLow || desiredFreqHigh)) {
+		struct detection_rule rule;
+
+		memset(&rule, 0, sizeof(rule));
+		strcpy(rule.name, "default");
+		rule.band_lo = desiredFreqLow;
+		rule.band_hi = desiredFreqHigh;
+		rule.ref_lo = thresholdFreqLow;
+		rule.ref_hi = thresholdFreqHigh;
+		rule.threshold_db = 10 * threshold_buffer;
+		rule.output = RULE_OUTPUT_GPIO;
+		rule.pin = DETECTION_PIN;
+		rule_engine_add(&detection_rules, &rule);
+	} else if (rules_file) {
+		for (i=0; i<(int)detection_rules.n_rules; i++) {
+			struct detection_rule *rule = &detection_rules.rules[i];
+
+			if (rule->band_lo < frequency - calculatedHalfSpan || rule->band_hi > frequency + calculatedHalfSpan) {
+				fprintf(stdout, "WARNING: Band of rule %s is not within (%f, %f)Hz, it is cut at the edge\n",
+					rule->name, frequency-calculatedHalfSpan, frequency+calculatedHalfSpan);
+			} //if()
+		} //for()
+	} //if-else()
+
+
+
+	//Ducky: Nothing to tune during a replay
+	if (!dev)
+		goto tuned;
+
+	dongle_tuning.frequency = frequency;
+	dongle_tuning.samp_rate = samp_rate;
+	dongle_tuning.gain_mode = gain != 0;
+	dongle_tuning.gain = gain;
+	tune_dongle(dev);
+
+tuned:
 
+	pthread_mutex_init(&exit_cond_lock, NULL);
+	pthread_cond_init(&exit_cond, NULL);
 
-	/* Set the frequency */
-	r = rtlsdr_set_center_freq(dev, frequency);
-	if (r < 0)
-		fprintf(stdout, "WARNING: Failed to set center freq.\n");
-	else
-		fprintf(stdout, "Tuned to %i Hz.\n", frequency);
+	//Ducky: Pick the fastest u8 -> float conversion before any thread uses it
+	iq_convert_init();
 
-	if (0 == gain) {
-		 /* Enable automatic gain */
-		r = rtlsdr_set_tuner_gain_mode(dev, 0);
-        fprintf(stdout, "Enabling automatic gain...\n");
-		if (r < 0)
-			fprintf(stdout, "WARNING: Failed to enable automatic gain.\n");
-	} else {
-		/* Enable manual gain */
-		r = rtlsdr_set_tuner_gain_mode(dev, 1);
-		if (r < 0)
-			fprintf(stdout, "WARNING: Failed to enable manual gain.\n");
-
-		/* Set the tuner gain */
-		r = rtlsdr_set_tuner_gain(dev, gain);
-		if (r < 0)
-			fprintf(stdout, "WARNING: Failed to set tuner gain.\n");
-		else
-			fprintf(stdout, "Tuner gain set to %f dB.\n", gain/10.0);
+	//Ducky: The detector only queues its output, a low priority thread prints it
+	if (logger_init(LOG_SLOTS, log_level, LOG_STATUS_MS, stdout) < 0) {
+		fprintf(stdout, "Failed to start the log thread.\n");
+		source_close();
+		exit(1);
 	}
 
-	/* Reset endpoint before we start reading from it (mandatory) */
-	r = rtlsdr_reset_buffer(dev);
-	if (r < 0)
-		fprintf(stdout, "WARNING: Failed to reset buffers.\n");
-
-	pthread_mutex_init(&exit_cond_lock, NULL);
-	pthread_mutex_init(&ll_mutex, NULL);
-	pthread_mutex_init(&exit_cond_lock, NULL);
-	pthread_cond_init(&cond, NULL);
-	pthread_cond_init(&exit_cond, NULL);
+	//Ducky: The ring only carries pointers, the sample memory is lent by librtlsdr
+	if (sample_ring_init(&ring, ring_slots, 0, ring_policy) < 0) {
+		fprintf(stdout, "Failed to allocate %u sample buffers.\n", ring_slots);
+		source_close();
+		exit(1);
+	}
 
 	//DUCKY: TOOK OUT WHILE LOOP BECAUSE THE PROGRAM WOULD
 	//	STOP RESPONDING IF IT LOST THE SOCKET
 	//while(1) {
 
-        printf("\nSkipping any TCP connection requirement\n");
-
-		printf("\nInitializing GPIO pin library (bcm2835)");
-		if (!bcm2835_init()) {
-			printf("\nCould not initialize bcm2835!!");
-			return 1;
-		} //if()
-
 		memset(&dongle_info, 0, sizeof(dongle_info));
 		memcpy(&dongle_info.magic, "RTL0", 4);
 
-		r = rtlsdr_get_tuner_type(dev);
-		if (r >= 0)
-			dongle_info.tuner_type = htonl(r);
+		if (dev) {
+			r = rtlsdr_get_tuner_type(dev);
+			if (r >= 0)
+				dongle_info.tuner_type = htonl(r);
 
-		r = rtlsdr_get_tuner_gains(dev, NULL);
-		if (r >= 0)
-			dongle_info.tuner_gain_count = htonl(r);
+			r = rtlsdr_get_tuner_gains(dev, NULL);
+			if (r >= 0)
+				dongle_info.tuner_gain_count = htonl(r);
+		}
+
+		//Ducky: rtl_tcp clients are served alongside the detector, not instead of it
+		if (stream_port) {
+			r = iq_server_init(&iq_server, stream_addr, stream_port, stream_slots,
+					   DEFAULT_BUF_LENGTH, &dongle_info, sizeof(dongle_info));
+			if (r == 0) {
+				iq_server_set_command(&iq_server, ducky_command, NULL);
+				iq_server_set_tuning(&iq_server, source_center_freq(), source_sample_rate());
+				r = iq_server_start(&iq_server);
+				if (r < 0) {
+					iq_server_free(&iq_server);
+				} //if()
+			} //if()
+			if (r < 0) {
+				fprintf(stdout, "Could not start the IQ server\n");
+				output_sinks_close(&output_sinks);
+				logger_stop();
+				sample_ring_free(&ring);
+				goto out;
+			} //if()
+			printf("Streaming IQ on %s:%d\n", stream_addr, stream_port);
+		} else {
+			printf("\nNo IQ streaming (-p), detector only\n");
+		} //if-else()
 
 		pthread_attr_init(&attr);
 		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
@@ -945,28 +1714,82 @@ int main(int argc, char **argv)
 
 		pthread_attr_destroy(&attr);
 
-		r = rtlsdr_read_async(dev, rtlsdr_callback, NULL, buf_num, 0);
+		//Ducky: This thread only runs the libusb event loop (or the replay) from here on
+		apply_thread_role(THREAD_CONVERT, -1, ducky_fft_thread);
+		apply_thread_role(THREAD_USB, -1, pthread_self());
+
+		if (replay_file) {
+			//Ducky: Same callback, the detector can't tell the recording from the dongle
+			r = replay_run(&replay, rtlsdr_callback, NULL);
+			replay_done = 1;
+		} else {
+			//Ducky: One spare per ring slot so the library never runs out while we hold buffers.
+			//	A lost dongle streams into the same ring again once reopened, the FFT plans,
+			//	noise floors and averaging carry on.
+			do {
+				r = rtlsdr_read_async_zerocopy(dev, rtlsdr_callback, NULL, buf_num,
+					DEFAULT_BUF_LENGTH, ring.slot_count + 1);
+			} while (!do_exit && reconnect_timeout && rtlsdr_is_device_lost(dev) == 1 &&
+				 reconnect_dongle() == 0);
+
+			//Ducky: Nothing streams any more, ducky_fft would wait forever
+			do_exit = 1;
+		} //if-else()
+		source_stopped = 1;
 
 		//Ducky: Added our own FFT
+		sample_ring_wake(&ring);
 		pthread_join(ducky_fft_thread, &status);
 
+		if (stream_port) {
+			iq_server_stop(&iq_server);
+			if (iq_server_evicted(&iq_server)) {
+				printf("Dropped %u slow IQ clients\n", iq_server_evicted(&iq_server));
+			} //if()
+			iq_server_free(&iq_server);
+		} //if()
+
 		printf("all threads dead..\n");
-		curelem = ll_buffers;
-		ll_buffers = 0;
-
-		while(curelem != 0) {
-			prev = curelem;
-			curelem = curelem->next;
-			free(prev->data);
-			free(prev);
+
+		//Ducky: Throughput is up to the last detected frame, not the last read
+		if (replay_file) {
+			double secs = (double)(lat_now() - replay.t_start) / 1e9;
+
+			printf("Replayed %llu samples in %.3f s: %.0f samples/s, %.2fx real time",
+			       (unsigned long long)replay.samples, secs, replay.samples / secs,
+			       replay.samples / secs / replay.sample_rate);
+			if (replay_realtime) {
+				printf(", %u buffers late", replay.late);
+			}
+			printf("\n");
+			if (event_out != stdout) {
+				fclose(event_out);
+			}
+		} //if()
+
+		if (usb_losses) {
+			printf("Lost the dongle %u time(s), %u reconnect attempt(s), %.1f s without samples (longest %.1f s)\n",
+			       usb_losses, usb_attempts, usb_gap_total / 1e9, usb_gap_max / 1e9);
+		} //if()
+
+		if (output_sinks_lost(&output_sinks)) {
+			printf("Lost %u detection outputs\n", output_sinks_lost(&output_sinks));
+		}
+		output_sinks_close(&output_sinks);
+
+		while ((curelem = sample_ring_pop(&ring, 0)) != NULL) {
+			source_release(curelem->data);
+			sample_ring_release(&ring, curelem);
 		}
+		logger_stop();
+		printf("Dropped %u sample buffers\n", sample_ring_dropped(&ring));
+		sample_ring_free(&ring);
 
 		do_exit = 0;
-		global_numq = 0;
 	//}
 
 out:
-	rtlsdr_close(dev);
+	source_close();
 #ifdef _WIN32
 	WSACleanup();
 #endif
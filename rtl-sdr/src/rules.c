@@ -0,0 +1,505 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "rules.h"
+
+#define RULE_LINE_LEN	256
+
+int rule_engine_add(struct rule_engine *eng, const struct detection_rule *rule)
+{
+	if (eng->n_rules == RULE_MAX)
+		return -1;
+
+	eng->rules[eng->n_rules++] = *rule;
+
+	return 0;
+}
+
+static char *trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+
+	return s;
+}
+
+/* two frequencies in Hz, "433.92e6" style accepted */
+static int parse_band(const char *val, uint32_t *lo, uint32_t *hi)
+{
+	double a, b;
+	char *end;
+
+	a = strtod(val, &end);
+	b = strtod(end, &end);
+	if (*trim(end) || a < 1 || b <= a || b > UINT32_MAX)
+		return -1;
+
+	*lo = (uint32_t)a;
+	*hi = (uint32_t)b;
+
+	return 0;
+}
+
+static int parse_db(const char *val, double *db)
+{
+	char *end;
+
+	*db = strtod(val, &end);
+
+	return *trim(end) ? -1 : 0;
+}
+
+static int parse_count(const char *val, unsigned int *n, long max)
+{
+	char *end;
+	long v;
+
+	v = strtol(val, &end, 10);
+	if (*trim(end) || v < 0 || v > max)
+		return -1;
+
+	*n = (unsigned int)v;
+
+	return 0;
+}
+
+static int parse_output(const char *val, struct detection_rule *rule)
+{
+	char *end;
+	long pin;
+
+	if (!strcmp(val, "none")) {
+		rule->output = RULE_OUTPUT_NONE;
+		return 0;
+	}
+
+	if (strncmp(val, "gpio", 4) || !isspace((unsigned char)val[4]))
+		return -1;
+
+	pin = strtol(val + 4, &end, 10);
+	if (*trim(end) || pin < 0 || pin > 53)
+		return -1;
+
+	rule->output = RULE_OUTPUT_GPIO;
+	rule->pin = (unsigned int)pin;
+
+	return 0;
+}
+
+static int finish_rule(struct rule_engine *eng, struct detection_rule *rule,
+		       const char *path, int line)
+{
+	if (!rule->band_lo) {
+		fprintf(stderr, "%s:%d: rule %s has no band\n", path, line,
+			rule->name);
+		return -1;
+	}
+
+	if (rule->hysteresis_db < 0) {
+		fprintf(stderr, "%s:%d: negative hysteresis in rule %s\n", path,
+			line, rule->name);
+		return -1;
+	}
+
+	if (rule_engine_add(eng, rule) < 0) {
+		fprintf(stderr, "%s:%d: more than %d rules\n", path, line,
+			RULE_MAX);
+		return -1;
+	}
+
+	return 0;
+}
+
+int rule_engine_load(struct rule_engine *eng, const char *path)
+{
+	struct detection_rule rule;
+	char buf[RULE_LINE_LEN], *s, *val;
+	unsigned int start = eng->n_rules;
+	int line = 0, in_rule = 0, r = -1;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open rules file %s\n", path);
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		buf[strcspn(buf, "#;")] = '\0';
+		s = trim(buf);
+		if (!*s)
+			continue;
+
+		if ('[' == *s) {
+			len = strlen(s);
+			if (s[len - 1] != ']' || len < 3 || len - 2 >= RULE_NAME_LEN) {
+				fprintf(stderr, "%s:%d: bad rule name\n", path, line);
+				goto out;
+			}
+			if (in_rule && finish_rule(eng, &rule, path, line) < 0)
+				goto out;
+
+			memset(&rule, 0, sizeof(rule));
+			memcpy(rule.name, s + 1, len - 2);
+			in_rule = 1;
+			continue;
+		}
+
+		val = strchr(s, '=');
+		if (!in_rule || !val) {
+			fprintf(stderr, "%s:%d: expected [rule] or key = value\n",
+				path, line);
+			goto out;
+		}
+		*val = '\0';
+		s = trim(s);
+		val = trim(val + 1);
+
+		if (!strcmp(s, "band"))
+			r = parse_band(val, &rule.band_lo, &rule.band_hi);
+		else if (!strcmp(s, "reference"))
+			r = parse_band(val, &rule.ref_lo, &rule.ref_hi);
+		else if (!strcmp(s, "threshold"))
+			r = parse_db(val, &rule.threshold_db);
+		else if (!strcmp(s, "hysteresis"))
+			r = parse_db(val, &rule.hysteresis_db);
+		else if (!strcmp(s, "attack"))
+			r = parse_count(val, &rule.attack, 1000);
+		else if (!strcmp(s, "release"))
+			r = parse_count(val, &rule.release, 1000);
+		else if (!strcmp(s, "min_pulse"))
+			r = parse_count(val, &rule.min_pulse_ms, 60000);
+		else if (!strcmp(s, "output"))
+			r = parse_output(val, &rule);
+		else
+			r = -1;
+
+		if (r < 0) {
+			fprintf(stderr, "%s:%d: bad %s\n", path, line, s);
+			goto out;
+		}
+	}
+
+	r = -1;
+	if (in_rule && finish_rule(eng, &rule, path, line) < 0)
+		goto out;
+
+	r = (int)(eng->n_rules - start);
+out:
+	fclose(f);
+
+	return r;
+}
+
+static unsigned long freq_to_bin(uint32_t freq, int upper, uint32_t lower_bound,
+				 uint32_t span, unsigned long n_points,
+				 double margin)
+{
+	double pos;
+
+	if (!freq)
+		return upper ? n_points - 1 : 0;
+
+	pos = ((double)freq - lower_bound) / span * n_points;
+	pos += (upper ? margin : -margin) * n_points;
+
+	if (pos < 0)
+		return 0;
+	if (pos > n_points - 1)
+		return n_points - 1;
+
+	return (unsigned long)pos;
+}
+
+/* cut the bands into disjoint sorted segments, each with its rules */
+static void build_segments(struct rule_engine *eng)
+{
+	unsigned long edges[2 * RULE_MAX], e;
+	unsigned int n = 0, i, j, k;
+	struct rule_segment *seg;
+	struct detection_rule *rule;
+
+	for (i = 0; i < eng->n_rules; i++) {
+		rule = &eng->rules[i];
+		if (rule->lo >= rule->hi)
+			continue;
+		edges[n++] = rule->lo;
+		edges[n++] = rule->hi;
+	}
+
+	/* insertion sort, at most 2 * RULE_MAX edges */
+	for (i = 1; i < n; i++) {
+		e = edges[i];
+		for (j = i; j > 0 && edges[j - 1] > e; j--)
+			edges[j] = edges[j - 1];
+		edges[j] = e;
+	}
+
+	eng->n_segs = 0;
+	k = 0;
+	for (i = 0; i + 1 < n; i++) {
+		if (edges[i] == edges[i + 1])
+			continue;
+
+		seg = &eng->segs[eng->n_segs];
+		seg->lo = edges[i];
+		seg->hi = edges[i + 1];
+		seg->first = k;
+		seg->count = 0;
+
+		for (j = 0; j < eng->n_rules; j++) {
+			rule = &eng->rules[j];
+			if (rule->lo <= seg->lo && rule->hi >= seg->hi) {
+				eng->members[k++] = j;
+				seg->count++;
+			}
+		}
+
+		/* a gap between bands */
+		if (seg->count)
+			eng->n_segs++;
+	}
+}
+
+void rule_engine_layout(struct rule_engine *eng, uint32_t lower_bound,
+			uint32_t span, unsigned long n_points, double margin)
+{
+	struct detection_rule *rule;
+	unsigned int i;
+
+	eng->lower_bound = lower_bound;
+	eng->span = span;
+	eng->n_points = n_points;
+
+	for (i = 0; i < eng->n_rules; i++) {
+		rule = &eng->rules[i];
+
+		rule->lo = freq_to_bin(rule->band_lo, 0, lower_bound, span,
+				       n_points, margin);
+		rule->hi = freq_to_bin(rule->band_hi, 1, lower_bound, span,
+				       n_points, margin);
+
+		if (!rule->ref_lo && !rule->ref_hi) {
+			rule->ref_lo_bin = rule->ref_hi_bin = 0;
+			continue;
+		}
+		rule->ref_lo_bin = freq_to_bin(rule->ref_lo, 0, lower_bound,
+					       span, n_points, margin);
+		rule->ref_hi_bin = freq_to_bin(rule->ref_hi, 1, lower_bound,
+					       span, n_points, margin);
+	}
+
+	build_segments(eng);
+}
+
+uint32_t rule_engine_bin_freq(const struct rule_engine *eng, unsigned long bin)
+{
+	if (!eng->n_points)
+		return 0;
+
+	return eng->lower_bound +
+	       (uint32_t)((double)bin * eng->span / eng->n_points);
+}
+
+/* bins covered by any rule, what the shared cfar has to level */
+static void band_union(const struct rule_engine *eng, unsigned long *lo,
+		       unsigned long *hi)
+{
+	*lo = *hi = 0;
+	if (eng->n_segs) {
+		*lo = eng->segs[0].lo;
+		*hi = eng->segs[eng->n_segs - 1].hi;
+	}
+}
+
+size_t rule_engine_size(const struct rule_engine *eng,
+			const struct noise_floor_config *cfg,
+			unsigned int max_buckets)
+{
+	const struct detection_rule *rule;
+	unsigned long lo, hi;
+	size_t size = 0;
+	unsigned int i;
+
+	if (NOISE_FLOOR_CFAR == cfg->method) {
+		band_union(eng, &lo, &hi);
+		return noise_floor_size(cfg, 0, 0, max_buckets, lo, hi);
+	}
+
+	for (i = 0; i < eng->n_rules; i++) {
+		rule = &eng->rules[i];
+		size += noise_floor_size(cfg, rule->ref_lo_bin, rule->ref_hi_bin,
+					 max_buckets, rule->lo, rule->hi);
+	}
+
+	return size;
+}
+
+int rule_engine_init(struct rule_engine *eng, struct detector_arena *arena,
+		     const struct noise_floor_config *cfg,
+		     unsigned long n_points, unsigned int max_buckets)
+{
+	struct detection_rule *rule;
+	unsigned long lo, hi;
+	unsigned int i;
+
+	eng->floor_cfg = *cfg;
+	memset(&eng->cfar, 0, sizeof(eng->cfar));
+
+	if (NOISE_FLOOR_CFAR == cfg->method) {
+		band_union(eng, &lo, &hi);
+		if (noise_floor_init(&eng->cfar, arena, cfg, n_points, 0, 0,
+				     max_buckets, lo, hi) < 0)
+			return -1;
+	}
+
+	for (i = 0; i < eng->n_rules; i++) {
+		rule = &eng->rules[i];
+
+		rule->on_ratio = pow(10, rule->threshold_db / 10);
+		rule->off_ratio = pow(10, (rule->threshold_db -
+					   rule->hysteresis_db) / 10);
+		rule->peak = 0;
+		rule->active = 0;
+		rule->changed = 0;
+		rule->pending = 0;
+		if (!rule->attack)
+			rule->attack = 1;
+		if (!rule->release)
+			rule->release = 1;
+
+		if (NOISE_FLOOR_CFAR != cfg->method &&
+		    noise_floor_init(&rule->floor, arena, cfg, n_points,
+				     rule->ref_lo_bin, rule->ref_hi_bin,
+				     max_buckets, rule->lo, rule->hi) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* strongest bin of a segment against the shared per bin cfar level */
+static double segment_peak_cfar(const struct noise_floor *cfar,
+				const fft_real *power,
+				const struct rule_segment *seg,
+				unsigned long *bin)
+{
+	double best = 0, level;
+	unsigned long i;
+
+	*bin = seg->lo;
+	for (i = seg->lo; i < seg->hi; i++) {
+		level = noise_floor_level(cfar, i);
+		if (level > 0 && power[i] > best * level) {
+			best = power[i] / level;
+			*bin = i;
+		}
+	}
+
+	return best;
+}
+
+static fft_real segment_max(const fft_real *power,
+			    const struct rule_segment *seg, unsigned long *bin)
+{
+	fft_real best = power[seg->lo];
+	unsigned long i;
+
+	*bin = seg->lo;
+	for (i = seg->lo + 1; i < seg->hi; i++) {
+		if (power[i] > best) {
+			best = power[i];
+			*bin = i;
+		}
+	}
+
+	return best;
+}
+
+void rule_engine_update(struct rule_engine *eng, const fft_real *power)
+{
+	unsigned int i;
+
+	if (NOISE_FLOOR_CFAR == eng->floor_cfg.method) {
+		noise_floor_update(&eng->cfar, power);
+		return;
+	}
+
+	for (i = 0; i < eng->n_rules; i++)
+		noise_floor_update(&eng->rules[i].floor, power);
+}
+
+void rule_engine_run(struct rule_engine *eng, const fft_real *power)
+{
+	int cfar = NOISE_FLOOR_CFAR == eng->floor_cfg.method;
+	const struct rule_segment *seg;
+	struct detection_rule *rule;
+	unsigned long bin;
+	double peak, level;
+	unsigned int i, k;
+
+	for (i = 0; i < eng->n_rules; i++) {
+		eng->rules[i].peak = 0;
+		eng->rules[i].peak_bin = eng->rules[i].lo;
+	}
+
+	for (k = 0; k < eng->n_segs; k++) {
+		seg = &eng->segs[k];
+		peak = cfar ? segment_peak_cfar(&eng->cfar, power, seg, &bin)
+			    : segment_max(power, seg, &bin);
+
+		for (i = 0; i < seg->count; i++) {
+			rule = &eng->rules[eng->members[seg->first + i]];
+			level = cfar ? 1.0 : rule->floor.floor;
+			if (level > 0 && peak / level > rule->peak) {
+				rule->peak = peak / level;
+				rule->peak_bin = bin;
+			}
+		}
+	}
+
+	for (i = 0; i < eng->n_rules; i++) {
+		rule = &eng->rules[i];
+		rule->changed = 0;
+
+		if ((!rule->active && rule->peak > rule->on_ratio) ||
+		    (rule->active && rule->peak < rule->off_ratio))
+			rule->pending++;
+		else
+			rule->pending = 0;
+
+		if (rule->pending >= (rule->active ? rule->release : rule->attack)) {
+			rule->active = !rule->active;
+			rule->changed = 1;
+			rule->pending = 0;
+		}
+	}
+}
@@ -0,0 +1,169 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __RULES_H
+#define __RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft_types.h"
+#include "noise_floor.h"
+
+/*
+ * Detection rules evaluated against one shared power spectrum per frame.
+ *
+ * A rule watches a band and fires when the strongest bin in it rises
+ * threshold dB above the noise floor of its reference band; it clears once
+ * the band drops below threshold - hysteresis dB. Either change only takes
+ * effect after it held for attack (or release) frames in a row, a single
+ * noisy frame doesn't toggle the output. Each reference band gets
+ * its own estimator of the configured method. With cfar the level of every
+ * bin comes from its neighbours instead and reference bands are unused.
+ *
+ * The bands are cut into disjoint segments at every band edge, sorted by
+ * frequency, each listing the rules that cover it. A frame then looks at
+ * every bin once, however many rules overlap, and every rule gets the
+ * maximum of its segments.
+ *
+ * Rules file, one section per rule, frequencies in Hz:
+ *
+ *	[keyfob]
+ *	band = 433050000 434790000
+ *	reference = 432000000 433000000
+ *	threshold = 6		# dB
+ *	hysteresis = 2		# dB, default 0
+ *	attack = 2		# frames, default 1
+ *	release = 3		# frames, default 1
+ *	min_pulse = 5		# ms the output stays HIGH at least, default 0
+ *	output = gpio 17	# BCM GPIO number, or "none"
+ */
+
+#define RULE_NAME_LEN		32
+#define RULE_MAX		32
+#define RULE_MAX_SEGMENTS	(2 * RULE_MAX)
+
+enum rule_output {
+	RULE_OUTPUT_NONE = 0,
+	RULE_OUTPUT_GPIO
+};
+
+struct detection_rule {
+	char name[RULE_NAME_LEN];
+
+	/* as configured, Hz; 0 for the edge of the spectrum, a reference
+	 * with both edges 0 is no reference */
+	uint32_t band_lo;
+	uint32_t band_hi;
+	uint32_t ref_lo;
+	uint32_t ref_hi;
+	double threshold_db;
+	double hysteresis_db;
+	unsigned int attack;		/* frames, 0 is taken as 1 */
+	unsigned int release;
+	unsigned int min_pulse_ms;
+	enum rule_output output;
+	unsigned int pin;
+
+	/* FFT shifted bins, [lo, hi), set by rule_engine_layout() */
+	unsigned long lo;
+	unsigned long hi;
+	unsigned long ref_lo_bin;
+	unsigned long ref_hi_bin;
+
+	struct noise_floor floor;	/* over the reference band */
+	double on_ratio;		/* linear power over the floor */
+	double off_ratio;
+
+	/* result of the last frame */
+	double peak;			/* strongest bin over its level */
+	unsigned long peak_bin;
+	int active;
+	int changed;			/* active flipped this frame */
+	unsigned int pending;		/* frames the band disagreed with active */
+};
+
+struct rule_segment {
+	unsigned long lo;
+	unsigned long hi;
+	unsigned int first;		/* into rule_engine.members */
+	unsigned int count;
+};
+
+struct rule_engine {
+	struct detection_rule rules[RULE_MAX];
+	unsigned int n_rules;
+
+	struct rule_segment segs[RULE_MAX_SEGMENTS];
+	unsigned int n_segs;
+	unsigned int members[RULE_MAX_SEGMENTS * RULE_MAX];
+
+	struct noise_floor_config floor_cfg;
+	struct noise_floor cfar;	/* shared by every rule with cfar */
+
+	/* spectrum the bins were laid out for */
+	uint32_t lower_bound;
+	uint32_t span;
+	unsigned long n_points;
+};
+
+/*!
+ * Read the rules from a file, after any rules already added.
+ *
+ * \return number of rules loaded, -1 on a malformed file (the reason is
+ *	   printed with its line number)
+ */
+int rule_engine_load(struct rule_engine *eng, const char *path);
+
+/* append a rule, -1 once RULE_MAX rules are set */
+int rule_engine_add(struct rule_engine *eng, const struct detection_rule *rule);
+
+/*!
+ * Map every band to bins and build the segment table.
+ *
+ * \param lower_bound frequency of bin 0 in Hz
+ * \param span bandwidth of the spectrum in Hz
+ * \param margin fraction of n_points every band and reference band is
+ *		 widened by on each side
+ */
+void rule_engine_layout(struct rule_engine *eng, uint32_t lower_bound,
+			uint32_t span, unsigned long n_points, double margin);
+
+/* centre frequency of an FFT shifted bin in Hz, after rule_engine_layout() */
+uint32_t rule_engine_bin_freq(const struct rule_engine *eng, unsigned long bin);
+
+/* bytes of detector arena the estimators of all rules need */
+size_t rule_engine_size(const struct rule_engine *eng,
+			const struct noise_floor_config *cfg,
+			unsigned int max_buckets);
+
+/*!
+ * Set up the estimators after rule_engine_layout().
+ *
+ * \return 0 on success, -1 if the arena is too small
+ */
+int rule_engine_init(struct rule_engine *eng, struct detector_arena *arena,
+		     const struct noise_floor_config *cfg,
+		     unsigned long n_points, unsigned int max_buckets);
+
+/* fold one FFT shifted power spectrum into every noise floor */
+void rule_engine_update(struct rule_engine *eng, const fft_real *power);
+
+/* evaluate every rule against the spectrum its floors were updated with */
+void rule_engine_run(struct rule_engine *eng, const fft_real *power);
+
+#endif /* __RULES_H */
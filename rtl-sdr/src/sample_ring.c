@@ -0,0 +1,266 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sample_ring.h"
+
+/* indices are free running, the slot count is a power of two so the
+ * position stays continuous when they wrap */
+#define RING_POS(ring, idx)	((idx) & ((ring)->slot_count - 1))
+
+static void avail_push(struct sample_ring *ring, uint32_t slot)
+{
+	uint32_t head = __atomic_load_n(&ring->avail_head, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ring->avail[RING_POS(ring, head)], slot, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->avail_head, head + 1, __ATOMIC_RELEASE);
+}
+
+static int avail_pop(struct sample_ring *ring, uint32_t *slot)
+{
+	uint32_t tail = __atomic_load_n(&ring->avail_tail, __ATOMIC_RELAXED);
+
+	if (tail == __atomic_load_n(&ring->avail_head, __ATOMIC_ACQUIRE))
+		return -1;
+
+	*slot = __atomic_load_n(&ring->avail[RING_POS(ring, tail)], __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->avail_tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+static void filled_push(struct sample_ring *ring, uint32_t slot)
+{
+	uint32_t head = __atomic_load_n(&ring->filled_head, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&ring->filled[RING_POS(ring, head)], slot, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->filled_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Both the consumer and a producer evicting the oldest slot pop from the
+ * filled queue, so the tail is claimed with CAS. A reader that loses the
+ * race simply retries with the new tail.
+ */
+static int filled_pop(struct sample_ring *ring, uint32_t *slot)
+{
+	uint32_t tail = __atomic_load_n(&ring->filled_tail, __ATOMIC_ACQUIRE);
+
+	do {
+		if (tail == __atomic_load_n(&ring->filled_head, __ATOMIC_ACQUIRE))
+			return -1;
+		*slot = __atomic_load_n(&ring->filled[RING_POS(ring, tail)],
+					__ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(&ring->filled_tail, &tail, tail + 1,
+					      0, __ATOMIC_ACQ_REL,
+					      __ATOMIC_ACQUIRE));
+
+	return 0;
+}
+
+int sample_ring_init(struct sample_ring *ring, uint32_t slot_count,
+		     uint32_t slot_size, enum sample_ring_policy policy)
+{
+	uint32_t i;
+
+	memset(ring, 0, sizeof(*ring));
+
+	if (!slot_count || slot_count > 0x80000000u)
+		return -1;
+
+	for (i = 1; i < slot_count; i <<= 1)
+		;
+	slot_count = i;
+
+	ring->slot_count = slot_count;
+	ring->slot_size = slot_size;
+	ring->policy = policy;
+
+	if (slot_size)
+		ring->pool = malloc((size_t)slot_count * slot_size);
+	ring->slots = calloc(slot_count, sizeof(struct sample_slot));
+	ring->filled = calloc(slot_count, sizeof(uint32_t));
+	ring->avail = calloc(slot_count, sizeof(uint32_t));
+
+	if ((slot_size && !ring->pool) || !ring->slots || !ring->filled ||
+	    !ring->avail) {
+		sample_ring_free(ring);
+		return -1;
+	}
+
+	/* touch the pool now so the callback never takes a page fault on it */
+	if (slot_size)
+		memset(ring->pool, 128, (size_t)slot_count * slot_size);
+
+	for (i = 0; i < slot_count; i++) {
+		if (slot_size)
+			ring->slots[i].data = ring->pool + (size_t)i * slot_size;
+		ring->avail[i] = i;
+	}
+	ring->avail_head = slot_count;
+
+	pthread_mutex_init(&ring->wait_lock, NULL);
+	pthread_cond_init(&ring->wait_cond, NULL);
+
+	return 0;
+}
+
+void sample_ring_free(struct sample_ring *ring)
+{
+	if (ring->slots) {
+		pthread_mutex_destroy(&ring->wait_lock);
+		pthread_cond_destroy(&ring->wait_cond);
+	}
+
+	free(ring->pool);
+	free(ring->slots);
+	free(ring->filled);
+	free(ring->avail);
+
+	memset(ring, 0, sizeof(*ring));
+}
+
+/* find a slot for the producer, evicting the oldest one if the policy allows */
+static int ring_claim(struct sample_ring *ring, uint32_t *idx)
+{
+	if (!avail_pop(ring, idx))
+		return 0;
+
+	__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+
+	if (SAMPLE_RING_DROP_NEWEST == ring->policy || filled_pop(ring, idx) < 0)
+		return -1;
+
+	return 1;
+}
+
+static void ring_publish(struct sample_ring *ring, uint32_t idx)
+{
+	filled_push(ring, idx);
+	__atomic_add_fetch(&ring->pushed, 1, __ATOMIC_RELAXED);
+
+	/*
+	 * Signalled without the lock so the callback can't stall behind the
+	 * consumer. A wakeup lost to the consumer's check-then-sleep window
+	 * costs at most one pop timeout, and the next buffer wakes it anyway.
+	 */
+	pthread_cond_signal(&ring->wait_cond);
+}
+
+int sample_ring_push(struct sample_ring *ring, const unsigned char *buf,
+		     uint32_t len, uint64_t stamp)
+{
+	struct sample_slot *slot;
+	uint32_t idx;
+	int r;
+
+	r = ring_claim(ring, &idx);
+	if (r < 0)
+		return r;
+
+	if (len > ring->slot_size)
+		len = ring->slot_size;
+
+	slot = &ring->slots[idx];
+	memcpy(slot->data, buf, len);
+	slot->len = len;
+	slot->stamp = stamp;
+
+	ring_publish(ring, idx);
+
+	return r;
+}
+
+int sample_ring_push_ref(struct sample_ring *ring, unsigned char *buf,
+			 uint32_t len, uint64_t stamp, unsigned char **evicted)
+{
+	struct sample_slot *slot;
+	uint32_t idx;
+	int r;
+
+	*evicted = NULL;
+
+	r = ring_claim(ring, &idx);
+	if (r < 0)
+		return r;
+
+	slot = &ring->slots[idx];
+	if (r > 0)
+		*evicted = slot->data;
+	slot->data = buf;
+	slot->len = len;
+	slot->stamp = stamp;
+
+	ring_publish(ring, idx);
+
+	return r;
+}
+
+struct sample_slot *sample_ring_pop(struct sample_ring *ring, int timeout_ms)
+{
+	struct timespec abs_time;
+	uint32_t idx;
+
+	if (!filled_pop(ring, &idx))
+		return &ring->slots[idx];
+
+	clock_gettime(CLOCK_REALTIME, &abs_time);
+	abs_time.tv_sec += timeout_ms / 1000;
+	abs_time.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if (abs_time.tv_nsec >= 1000000000L) {
+		abs_time.tv_sec++;
+		abs_time.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ring->wait_lock);
+	if (filled_pop(ring, &idx) < 0) {
+		pthread_cond_timedwait(&ring->wait_cond, &ring->wait_lock,
+				       &abs_time);
+		if (filled_pop(ring, &idx) < 0) {
+			pthread_mutex_unlock(&ring->wait_lock);
+			return NULL;
+		}
+	}
+	pthread_mutex_unlock(&ring->wait_lock);
+
+	return &ring->slots[idx];
+}
+
+void sample_ring_release(struct sample_ring *ring, struct sample_slot *slot)
+{
+	avail_push(ring, (uint32_t)(slot - ring->slots));
+}
+
+void sample_ring_wake(struct sample_ring *ring)
+{
+	pthread_mutex_lock(&ring->wait_lock);
+	pthread_cond_broadcast(&ring->wait_cond);
+	pthread_mutex_unlock(&ring->wait_lock);
+}
+
+uint32_t sample_ring_fill(struct sample_ring *ring)
+{
+	return __atomic_load_n(&ring->filled_head, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&ring->filled_tail, __ATOMIC_ACQUIRE);
+}
+
+uint32_t sample_ring_dropped(struct sample_ring *ring)
+{
+	return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,136 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SAMPLE_RING_H
+#define __SAMPLE_RING_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Preallocated single-producer/single-consumer ring of sample buffers.
+ *
+ * The producer (the librtlsdr async callback) copies every USB buffer into a
+ * free slot and publishes it, the consumer (the FFT thread) pops slots in
+ * order and hands them back once it is done with them. Neither side ever
+ * allocates or takes a lock on the fast path; the only lock is the one the
+ * consumer sleeps on while the ring is empty.
+ *
+ * Slots travel between two index queues: the "filled" queue (producer ->
+ * consumer) and the "avail" queue (consumer -> producer). When the producer
+ * finds no free slot it either drops the incoming buffer or steals the
+ * oldest filled slot, depending on the overflow policy.
+ *
+ * A ring created with a slot size of 0 owns no sample memory and only passes
+ * buffer pointers lent by librtlsdr, see sample_ring_push_ref().
+ */
+
+enum sample_ring_policy {
+	SAMPLE_RING_DROP_OLDEST = 0,
+	SAMPLE_RING_DROP_NEWEST
+};
+
+struct sample_slot {
+	unsigned char *data;
+	uint32_t len;
+	uint64_t stamp;		/* CLOCK_MONOTONIC ns the buffer was completed */
+};
+
+struct sample_ring {
+	uint32_t slot_count;
+	uint32_t slot_size;
+	enum sample_ring_policy policy;
+	unsigned char *pool;
+	struct sample_slot *slots;
+
+	/* producer -> consumer, tail is claimed with CAS so the producer can
+	 * steal the oldest slot when the policy is SAMPLE_RING_DROP_OLDEST */
+	uint32_t *filled;
+	uint32_t filled_head;
+	uint32_t filled_tail;
+
+	/* consumer -> producer */
+	uint32_t *avail;
+	uint32_t avail_head;
+	uint32_t avail_tail;
+
+	uint32_t pushed;
+	uint32_t dropped;
+
+	pthread_mutex_t wait_lock;
+	pthread_cond_t wait_cond;
+};
+
+/*!
+ * Allocate all slots of the ring up front.
+ *
+ * \param ring ring to initialize
+ * \param slot_count number of sample buffers to keep, rounded up to a power
+ *		    of two
+ * \param slot_size size of each buffer in bytes, longer pushes are truncated,
+ *		   0 for a ring that only carries borrowed buffers
+ * \param policy what to do when the consumer falls behind
+ * \return 0 on success, -1 on allocation failure
+ */
+int sample_ring_init(struct sample_ring *ring, uint32_t slot_count,
+		     uint32_t slot_size, enum sample_ring_policy policy);
+
+void sample_ring_free(struct sample_ring *ring);
+
+/*!
+ * Copy a buffer into the ring. Producer side only, never blocks.
+ *
+ * \param stamp completion time of the buffer, passed on in the slot
+ * \return 0 if stored, 1 if stored after dropping the oldest slot,
+ *	   -1 if the buffer itself was dropped
+ */
+int sample_ring_push(struct sample_ring *ring, const unsigned char *buf,
+		     uint32_t len, uint64_t stamp);
+
+/*!
+ * Queue a borrowed buffer without copying it. Producer side only, never
+ * blocks.
+ *
+ * \param stamp completion time of the buffer, passed on in the slot
+ * \param evicted set to the buffer of the slot that was dropped to make room,
+ *		  NULL otherwise; the producer is responsible for returning it
+ * \return 0 if stored, 1 if stored after dropping the oldest slot,
+ *	   -1 if the buffer itself was dropped
+ */
+int sample_ring_push_ref(struct sample_ring *ring, unsigned char *buf,
+			 uint32_t len, uint64_t stamp, unsigned char **evicted);
+
+/*!
+ * Take the oldest filled slot. Consumer side only.
+ *
+ * \param timeout_ms how long to sleep while the ring is empty
+ * \return the slot, or NULL on timeout or wakeup; must be given back with
+ *	   sample_ring_release() before popping the next one
+ */
+struct sample_slot *sample_ring_pop(struct sample_ring *ring, int timeout_ms);
+
+void sample_ring_release(struct sample_ring *ring, struct sample_slot *slot);
+
+/* wake a consumer sleeping in sample_ring_pop(), used on shutdown */
+void sample_ring_wake(struct sample_ring *ring);
+
+/* number of slots currently waiting for the consumer */
+uint32_t sample_ring_fill(struct sample_ring *ring);
+
+uint32_t sample_ring_dropped(struct sample_ring *ring);
+
+#endif /* __SAMPLE_RING_H */
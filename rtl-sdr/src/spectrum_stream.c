@@ -0,0 +1,330 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "spectrum_stream.h"
+#include "latency.h"
+
+#define DB_FLOOR	-200.0f		/* for empty bins */
+#define U8_CODES	255
+
+/* no padding, readers overlay the struct */
+typedef char spectrum_header_size_check[
+	sizeof(struct spectrum_header) == 56 ? 1 : -1];
+
+void spectrum_stream_defaults(struct spectrum_config *cfg)
+{
+	cfg->bins = 1024;
+	cfg->fps = 5;
+	cfg->format = SPECTRUM_U8;
+	cfg->reduce = SPECTRUM_MAX;
+}
+
+int spectrum_stream_parse(struct spectrum_config *cfg, const char *arg)
+{
+	char buf[64], *tok, *save = NULL;
+	int field = 0;
+	long v;
+
+	if (strlen(arg) >= sizeof(buf))
+		return -1;
+	strcpy(buf, arg);
+
+	for (tok = strtok_r(buf, ":", &save); tok;
+	     tok = strtok_r(NULL, ":", &save), field++) {
+		switch (field) {
+		case 0:
+		case 1:
+			v = strtol(tok, NULL, 10);
+			if (v < 1 || (field == 0 && v > SPECTRUM_MAX_BINS) ||
+			    (field == 1 && v > 1000))
+				return -1;
+			if (field == 0)
+				cfg->bins = (unsigned int)v;
+			else
+				cfg->fps = (unsigned int)v;
+			break;
+		case 2:
+			if (!strcmp(tok, "u8"))
+				cfg->format = SPECTRUM_U8;
+			else if (!strcmp(tok, "f16"))
+				cfg->format = SPECTRUM_F16;
+			else
+				return -1;
+			break;
+		case 3:
+			if (!strcmp(tok, "max"))
+				cfg->reduce = SPECTRUM_MAX;
+			else if (!strcmp(tok, "mean"))
+				cfg->reduce = SPECTRUM_MEAN;
+			else
+				return -1;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static size_t bin_bytes(const struct spectrum_config *cfg)
+{
+	return cfg->format == SPECTRUM_F16 ? 2 : 1;
+}
+
+int spectrum_stream_init(struct spectrum_stream *ss,
+			 const struct spectrum_config *cfg,
+			 unsigned long n_points, uint32_t center_freq,
+			 uint32_t span)
+{
+	memset(ss, 0, sizeof(*ss));
+	ss->cfg = *cfg;
+	if (ss->cfg.bins > n_points)
+		ss->cfg.bins = (unsigned int)n_points;
+	ss->n_points = n_points;
+	ss->center_freq = center_freq;
+	ss->span = span;
+
+	ss->frame_size = sizeof(struct spectrum_header) +
+			 ss->cfg.bins * bin_bytes(&ss->cfg);
+	ss->acc = calloc(ss->cfg.bins, sizeof(*ss->acc));
+	ss->frame = calloc(1, ss->frame_size);
+	if (!ss->acc || !ss->frame) {
+		spectrum_stream_free(ss);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ring_open(struct spectrum_stream *ss, const char *path)
+{
+	int fd;
+	void *map;
+
+	if (ss->ring) {
+		fprintf(stderr, "Only one spectrum ring file\n");
+		return -1;
+	}
+
+	ss->ring_size = sizeof(struct spectrum_ring_header) +
+			SPECTRUM_RING_SLOTS * ss->frame_size;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, (off_t)ss->ring_size) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	map = mmap(NULL, ss->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	ss->ring = map;
+	ss->ring->magic = SPECTRUM_RING_MAGIC;
+	ss->ring->version = SPECTRUM_VERSION;
+	ss->ring->slot_count = SPECTRUM_RING_SLOTS;
+	ss->ring->slot_size = (uint32_t)ss->frame_size;
+	ss->ring->head = 0;
+
+	return 0;
+}
+
+int spectrum_stream_open(struct spectrum_stream *ss, const char *spec)
+{
+	unsigned int n = ss->sinks.n_sinks;
+
+	if (!strncmp(spec, "mmap:", 5))
+		return ring_open(ss, spec + 5);
+
+	if (output_sinks_open(&ss->sinks, spec) < 0)
+		return -1;
+
+	if (ss->sinks.sinks[n].iface->claim) {
+		fprintf(stderr, "%s can't take spectra\n", spec);
+		ss->sinks.sinks[n].iface->close(&ss->sinks.sinks[n]);
+		ss->sinks.n_sinks = n;
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint16_t float_to_half(float f)
+{
+	union { float f; uint32_t u; } v;
+	uint32_t sign, mant;
+	int exp;
+
+	v.f = f;
+	sign = (v.u >> 16) & 0x8000;
+	exp = (int)((v.u >> 23) & 0xff) - 127 + 15;
+	mant = v.u & 0x7fffff;
+
+	if (((v.u >> 23) & 0xff) == 0xff)
+		return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+	if (exp >= 31)
+		return (uint16_t)(sign | 0x7c00);
+	if (exp <= 0) {
+		if (exp < -10)
+			return (uint16_t)sign;
+		mant |= 0x800000;
+		return (uint16_t)(sign | ((mant >> (14 - exp)) +
+					  ((mant >> (13 - exp)) & 1)));
+	}
+
+	/* a carry out of the mantissa correctly bumps the exponent */
+	return (uint16_t)(sign | (((uint32_t)exp << 10) + (mant >> 13) +
+				  ((mant >> 12) & 1)));
+}
+
+static void publish(struct spectrum_stream *ss)
+{
+	struct spectrum_header *h = (struct spectrum_header *)ss->frame;
+	unsigned char *bins = ss->frame + sizeof(*h);
+	unsigned long lo, hi;
+	float db, db_min = 0, db_max = 0, scale;
+	int32_t min_mdb = 0;
+	unsigned int b;
+	uint16_t half;
+	long code;
+
+	/* acc becomes dB in place */
+	for (b = 0; b < ss->cfg.bins; b++) {
+		scale = 1;
+		if (ss->cfg.reduce == SPECTRUM_MEAN) {
+			lo = (unsigned long)b * ss->n_points / ss->cfg.bins;
+			hi = (unsigned long)(b + 1) * ss->n_points / ss->cfg.bins;
+			scale = 1.0f / ((hi - lo) * ss->frames);
+		}
+		db = ss->acc[b] > 0 ? 10 * log10f(ss->acc[b] * scale) : DB_FLOOR;
+		if (!b || db < db_min)
+			db_min = db;
+		if (!b || db > db_max)
+			db_max = db;
+		ss->acc[b] = db;
+	}
+
+	if (ss->cfg.format == SPECTRUM_U8) {
+		/* keep the top of the range, the peaks are what matters */
+		if (db_max - db_min > U8_CODES * SPECTRUM_U8_STEP_MDB / 1000.0f)
+			db_min = db_max - U8_CODES * SPECTRUM_U8_STEP_MDB / 1000.0f;
+		min_mdb = (int32_t)floorf(db_min) * 1000;
+		for (b = 0; b < ss->cfg.bins; b++) {
+			code = lrintf((ss->acc[b] * 1000 - min_mdb) /
+				      SPECTRUM_U8_STEP_MDB);
+			bins[b] = (unsigned char)(code < 0 ? 0 :
+						  code > U8_CODES ? U8_CODES : code);
+		}
+	} else {
+		for (b = 0; b < ss->cfg.bins; b++) {
+			half = htons(float_to_half(ss->acc[b]));
+			memcpy(bins + 2 * b, &half, 2);
+		}
+	}
+
+	h->magic = htonl(SPECTRUM_MAGIC);
+	h->version = htons(SPECTRUM_VERSION);
+	h->header_size = htons(sizeof(*h));
+	h->seq = htonl(ss->seq);
+	h->format = (uint8_t)ss->cfg.format;
+	h->reduce = (uint8_t)ss->cfg.reduce;
+	h->bins = htons((uint16_t)ss->cfg.bins);
+	h->t_usb = output_hton64(ss->t_usb);
+	h->t_wall = output_hton64(lat_to_wall(ss->t_usb));
+	h->center_freq = htonl(ss->center_freq);
+	h->span = htonl(ss->span);
+	h->frames = htonl(ss->frames);
+	h->db_min_mdb = (int32_t)htonl((uint32_t)min_mdb);
+	h->db_step_mdb = htonl(ss->cfg.format == SPECTRUM_U8 ?
+			       SPECTRUM_U8_STEP_MDB : 0);
+
+	if (ss->ring) {
+		memcpy((unsigned char *)(ss->ring + 1) +
+		       (ss->seq % SPECTRUM_RING_SLOTS) * ss->frame_size,
+		       ss->frame, ss->frame_size);
+		__atomic_store_n(&ss->ring->head, ss->seq + 1, __ATOMIC_RELEASE);
+	}
+	output_sinks_send(&ss->sinks, ss->frame, ss->frame_size);
+
+	ss->seq++;
+	ss->frames = 0;
+	memset(ss->acc, 0, ss->cfg.bins * sizeof(*ss->acc));
+}
+
+void spectrum_stream_update(struct spectrum_stream *ss, const fft_real *power,
+			    uint64_t t_usb)
+{
+	unsigned long lo, hi, i;
+	unsigned int b;
+	float v;
+
+	for (b = 0; b < ss->cfg.bins; b++) {
+		lo = (unsigned long)b * ss->n_points / ss->cfg.bins;
+		hi = (unsigned long)(b + 1) * ss->n_points / ss->cfg.bins;
+		v = ss->acc[b];
+
+		if (ss->cfg.reduce == SPECTRUM_MAX) {
+			for (i = lo; i < hi; i++)
+				if (power[i] > v)
+					v = (float)power[i];
+		} else {
+			for (i = lo; i < hi; i++)
+				v += (float)power[i];
+		}
+		ss->acc[b] = v;
+	}
+
+	ss->frames++;
+	ss->t_usb = t_usb;
+
+	if (!ss->next_due)
+		ss->next_due = t_usb;
+	if (t_usb >= ss->next_due) {
+		publish(ss);
+		ss->next_due += 1000000000ULL / ss->cfg.fps;
+		/* don't make up for a stall with a burst */
+		if (ss->next_due < t_usb)
+			ss->next_due = t_usb + 1000000000ULL / ss->cfg.fps;
+	}
+}
+
+void spectrum_stream_free(struct spectrum_stream *ss)
+{
+	output_sinks_close(&ss->sinks);
+	if (ss->ring)
+		munmap(ss->ring, ss->ring_size);
+	free(ss->acc);
+	free(ss->frame);
+	ss->ring = NULL;
+	ss->acc = NULL;
+	ss->frame = NULL;
+}
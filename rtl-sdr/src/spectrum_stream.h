@@ -0,0 +1,155 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SPECTRUM_STREAM_H
+#define __SPECTRUM_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "fft_types.h"
+#include "output_sink.h"
+
+/*
+ * Spectrum summaries of what the detector sees, for remote monitoring.
+ *
+ * Every frame's power spectrum is folded into a few bins (each the max or
+ * mean of its group of FFT bins) and held over the frames until the next
+ * summary is due, fps times a second. A summary is a struct spectrum_header
+ * followed by the bins in dB, either as u8 codes (db_min + code * db_step)
+ * or as IEEE half floats; integers and halves in network byte order.
+ *
+ * Summaries go to any event sink of output_sink.h (udp, unix, file) as one
+ * datagram or record each, and/or to a ring file readers can mmap:
+ *
+ *	struct spectrum_ring_header, then slot_count slots of slot_size bytes,
+ *	summary seq in slot seq % slot_count
+ *
+ * The ring header is in host byte order. head is the number of summaries
+ * written; a reader that saw head == h copies slot (h - 1) % slot_count,
+ * then reads head again and keeps the copy only if head - h < slot_count - 1.
+ * The writer starts on that slot again with summary h - 1 + slot_count,
+ * while head is still h + slot_count - 1, so the copy may be torn from then
+ * on.
+ *
+ * Publishing runs on the detector thread: a memcpy into the ring and
+ * non-blocking sends, at most fps times a second.
+ */
+
+#define SPECTRUM_MAGIC		0x44535043U	/* "DSPC" */
+#define SPECTRUM_RING_MAGIC	0x44535052U	/* "DSPR" */
+#define SPECTRUM_VERSION	1
+#define SPECTRUM_MAX_BINS	8192
+#define SPECTRUM_RING_SLOTS	16
+#define SPECTRUM_U8_STEP_MDB	500		/* 0.5 dB per u8 code */
+
+enum spectrum_format {
+	SPECTRUM_U8 = 0,
+	SPECTRUM_F16
+};
+
+enum spectrum_reduce {
+	SPECTRUM_MAX = 0,
+	SPECTRUM_MEAN
+};
+
+struct spectrum_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;	/* bins start here */
+	uint32_t seq;
+	uint8_t format;		/* enum spectrum_format */
+	uint8_t reduce;		/* enum spectrum_reduce */
+	uint16_t bins;
+	uint64_t t_usb;		/* ns, CLOCK_MONOTONIC of the last frame's USB transfer */
+	uint64_t t_wall;	/* ns since the epoch, same instant */
+	uint32_t center_freq;	/* Hz */
+	uint32_t span;		/* Hz covered by the bins */
+	uint32_t frames;	/* FFT frames in this summary */
+	int32_t db_min_mdb;	/* u8: dB of code 0, 1/1000 dB */
+	uint32_t db_step_mdb;	/* u8: dB per code, 1/1000 dB */
+	uint32_t reserved;
+};
+
+struct spectrum_ring_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	uint32_t head;		/* written last, with release semantics */
+	uint32_t reserved[3];
+};
+
+struct spectrum_config {
+	unsigned int bins;
+	unsigned int fps;
+	enum spectrum_format format;
+	enum spectrum_reduce reduce;
+};
+
+struct spectrum_stream {
+	struct spectrum_config cfg;
+	unsigned long n_points;
+	uint32_t center_freq;
+	uint32_t span;
+
+	float *acc;		/* per bin, max or sum over the frames */
+	uint32_t frames;
+	uint64_t next_due;	/* ns, t_usb clock */
+	uint64_t t_usb;
+	uint32_t seq;
+
+	unsigned char *frame;	/* header + encoded bins */
+	size_t frame_size;
+
+	struct output_sinks sinks;
+	struct spectrum_ring_header *ring;
+	size_t ring_size;
+};
+
+/* 1024 bins, 5 summaries a second, u8 codes of the max */
+void spectrum_stream_defaults(struct spectrum_config *cfg);
+
+/*!
+ * Parse "bins[:fps[:u8|f16[:max|mean]]]".
+ *
+ * \return 0 on success, -1 on a malformed string
+ */
+int spectrum_stream_parse(struct spectrum_config *cfg, const char *arg);
+
+/* set up for frames of n_points FFT shifted bins covering span around
+ * center_freq, 0 on success, -1 on allocation failure */
+int spectrum_stream_init(struct spectrum_stream *ss,
+			 const struct spectrum_config *cfg,
+			 unsigned long n_points, uint32_t center_freq,
+			 uint32_t span);
+
+/*!
+ * Add a destination: "mmap:/path" for the ring file, anything else is
+ * opened with output_sinks_open() and must be an event sink.
+ *
+ * \return 0 on success, -1 on failure (the reason is printed)
+ */
+int spectrum_stream_open(struct spectrum_stream *ss, const char *spec);
+
+/* fold in one power spectrum, publish if a summary is due */
+void spectrum_stream_update(struct spectrum_stream *ss, const fft_real *power,
+			    uint64_t t_usb);
+
+void spectrum_stream_free(struct spectrum_stream *ss);
+
+#endif /* __SPECTRUM_STREAM_H */
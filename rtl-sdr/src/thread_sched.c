@@ -0,0 +1,292 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE		/* pthread_setaffinity_np() */
+
+#include <alloca.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "thread_sched.h"
+
+#define DEFAULT_RT_PRIORITY	50
+#define MAX_CPUS		64
+
+const char *thread_role_names[THREAD_ROLES] = {
+	[THREAD_USB] = "usb",
+	[THREAD_CONVERT] = "convert",
+	[THREAD_FFT] = "fft",
+	[THREAD_DETECT] = "detect",
+	[THREAD_OUTPUT] = "output",
+};
+
+/* "0,2-3" up to the first ':' */
+static int parse_cpus(const char *s, const char **end, uint64_t *cpus)
+{
+	unsigned long lo, hi;
+	char *e;
+
+	*cpus = 0;
+	while (*s && *s != ':') {
+		lo = strtoul(s, &e, 10);
+		if (e == s)
+			return -1;
+		hi = lo;
+		if (*e == '-') {
+			s = e + 1;
+			hi = strtoul(s, &e, 10);
+			if (e == s)
+				return -1;
+		}
+		if (lo > hi || hi >= MAX_CPUS)
+			return -1;
+		for (; lo <= hi; lo++)
+			*cpus |= 1ULL << lo;
+
+		s = e;
+		if (*s == ',')
+			s++;
+		else if (*s && *s != ':')
+			return -1;
+	}
+	*end = s;
+
+	return 0;
+}
+
+int thread_sched_parse(struct thread_sched *roles, const char *spec)
+{
+	struct thread_sched ts;
+	const char *eq = strchr(spec, '='), *p;
+	char *end;
+	unsigned int r;
+	long prio;
+
+	if (!eq)
+		return -1;
+	for (r = 0; r < THREAD_ROLES; r++) {
+		if (strlen(thread_role_names[r]) == (size_t)(eq - spec) &&
+		    !strncmp(spec, thread_role_names[r], eq - spec))
+			break;
+	}
+	if (r == THREAD_ROLES)
+		return -1;
+
+	memset(&ts, 0, sizeof(ts));
+	if (parse_cpus(eq + 1, &p, &ts.cpus) < 0)
+		return -1;
+
+	if (*p == ':') {
+		p++;
+		if (!strncmp(p, "fifo", 4)) {
+			ts.policy = SCHED_FIFO;
+			p += 4;
+		} else if (!strncmp(p, "rr", 2)) {
+			ts.policy = SCHED_RR;
+			p += 2;
+		} else if (!strncmp(p, "other", 5)) {
+			ts.policy = SCHED_OTHER;
+			p += 5;
+		} else {
+			return -1;
+		}
+		ts.set_policy = 1;
+		ts.priority = ts.policy == SCHED_OTHER ? 0 : DEFAULT_RT_PRIORITY;
+
+		if (*p == ':' && ts.policy != SCHED_OTHER) {
+			prio = strtol(p + 1, &end, 10);
+			if (end == p + 1 || prio < 1 || prio > 99)
+				return -1;
+			ts.priority = (int)prio;
+			p = end;
+		}
+	}
+	if (*p)
+		return -1;
+
+	roles[r] = ts;
+	return 0;
+}
+
+static void append(char *report, size_t len, const char *fmt, ...)
+{
+	size_t used = strlen(report);
+	va_list ap;
+
+	if (used >= len)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(report + used, len - used, fmt, ap);
+	va_end(ap);
+}
+
+static void append_cpus(char *report, size_t len, uint64_t cpus)
+{
+	unsigned int lo, hi;
+	const char *sep = "";
+
+	for (lo = 0; lo < MAX_CPUS; lo++) {
+		if (!(cpus >> lo & 1))
+			continue;
+		for (hi = lo; hi + 1 < MAX_CPUS && (cpus >> (hi + 1) & 1); hi++)
+			;
+		if (hi == lo)
+			append(report, len, "%s%u", sep, lo);
+		else
+			append(report, len, "%s%u-%u", sep, lo, hi);
+		sep = ",";
+		lo = hi;
+	}
+}
+
+/* the index-th CPU of cpus, round robin */
+static uint64_t nth_cpu(uint64_t cpus, unsigned int index)
+{
+	unsigned int n = 0, cpu;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++)
+		n += cpus >> cpu & 1;
+	index %= n;
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if ((cpus >> cpu & 1) && !index--)
+			break;
+	}
+	return 1ULL << cpu;
+}
+
+static int set_affinity(pthread_t thread, uint64_t cpus)
+{
+#ifdef __linux__
+	cpu_set_t want, got;
+	unsigned int cpu;
+	int err;
+
+	CPU_ZERO(&want);
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (cpus >> cpu & 1)
+			CPU_SET(cpu, &want);
+	}
+
+	err = pthread_setaffinity_np(thread, sizeof(want), &want);
+	if (!err)
+		err = pthread_getaffinity_np(thread, sizeof(got), &got);
+	if (!err && !CPU_EQUAL(&want, &got))
+		err = EINVAL;
+	return err;
+#else
+	(void)thread;
+	(void)cpus;
+	return ENOSYS;
+#endif
+}
+
+static int set_policy(pthread_t thread, int policy, int priority)
+{
+	struct sched_param param;
+	int err, got;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	err = pthread_setschedparam(thread, policy, &param);
+	if (!err)
+		err = pthread_getschedparam(thread, &got, &param);
+	if (!err && (got != policy || param.sched_priority != priority))
+		err = EINVAL;
+	return err;
+}
+
+int thread_sched_apply(const struct thread_sched *ts, pthread_t thread,
+		       int index, char *report, size_t len)
+{
+	uint64_t cpus;
+	int err, r = 0;
+
+	report[0] = '\0';
+
+	if (ts->cpus) {
+		cpus = index >= 0 ? nth_cpu(ts->cpus, index) : ts->cpus;
+		append(report, len, "cpu ");
+		append_cpus(report, len, cpus);
+		err = set_affinity(thread, cpus);
+		if (err) {
+			append(report, len, " failed (%s)", strerror(err));
+			r = -1;
+		}
+	}
+
+	if (ts->set_policy) {
+		if (ts->cpus)
+			append(report, len, ", ");
+		if (ts->policy == SCHED_OTHER)
+			append(report, len, "SCHED_OTHER");
+		else
+			append(report, len, "%s %d", ts->policy == SCHED_FIFO ?
+			       "SCHED_FIFO" : "SCHED_RR", ts->priority);
+		err = set_policy(thread, ts->policy, ts->priority);
+		if (err) {
+			append(report, len, " failed (%s)", strerror(err));
+			r = -1;
+		}
+	}
+
+	if (!ts->cpus && !ts->set_policy)
+		append(report, len, "default");
+
+	return r;
+}
+
+int thread_sched_lock_memory(char *report, size_t len)
+{
+	struct rlimit rl;
+
+	/* freed buffers stay in the heap, locked, instead of going back */
+#ifdef __GLIBC__
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+#endif
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+		snprintf(report, len, "could not lock memory (%s)", strerror(errno));
+		if (getrlimit(RLIMIT_MEMLOCK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+			append(report, len, ", RLIMIT_MEMLOCK is %llu kB",
+			       (unsigned long long)rl.rlim_cur / 1024);
+		return -1;
+	}
+
+	snprintf(report, len, "all memory locked, buffers are faulted in as they are allocated");
+	return 0;
+}
+
+void thread_sched_prefault_stack(size_t stack_size)
+{
+	volatile unsigned char *stack = alloca(stack_size);
+	size_t page = (size_t)sysconf(_SC_PAGESIZE), i;
+
+	for (i = 0; i < stack_size; i += page)
+		stack[i] = 0;
+}
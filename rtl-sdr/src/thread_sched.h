@@ -0,0 +1,96 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __THREAD_SCHED_H
+#define __THREAD_SCHED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * Thread topology: CPU affinity and real-time scheduling per thread role,
+ * and locking all memory so a page fault can't stall a real-time thread.
+ *
+ * A role is set with
+ *
+ *	role=[cpus][:policy[:priority]]
+ *
+ * cpus is a list like 0,2-3 (empty to leave the affinity alone), policy is
+ * fifo, rr or other and priority 1-99 for fifo and rr (default: 50). When
+ * a role has several threads (the FFT workers) and several CPUs, thread i
+ * gets the i-th CPU of the list, round robin, otherwise every thread of
+ * the role may run on all of them.
+ *
+ * Settings are read back after they are made, a setting only counts as
+ * taken when the kernel reports it. Real-time policies need CAP_SYS_NICE
+ * or an RLIMIT_RTPRIO, locking memory CAP_IPC_LOCK or a large enough
+ * RLIMIT_MEMLOCK, without them the settings fail and the thread keeps
+ * running as before.
+ */
+
+enum thread_role {
+	THREAD_USB = 0,		/* libusb events, or the replay reader */
+	THREAD_CONVERT,		/* sample ring to FFT frames */
+	THREAD_FFT,		/* every FFT worker */
+	THREAD_DETECT,
+	THREAD_OUTPUT,		/* output scheduler, drives the pins */
+	THREAD_ROLES
+};
+
+struct thread_sched {
+	uint64_t cpus;		/* bit n for CPU n, 0 to leave the affinity */
+	int policy;		/* SCHED_FIFO, SCHED_RR, SCHED_OTHER */
+	int priority;
+	int set_policy;
+};
+
+extern const char *thread_role_names[THREAD_ROLES];
+
+/*!
+ * Parse one role=... setting into the role's slot of roles.
+ *
+ * \return 0 on success, -1 on an unknown role or malformed setting
+ */
+int thread_sched_parse(struct thread_sched *roles, const char *spec);
+
+/*!
+ * Apply ts to thread and read it back.
+ *
+ * \param index thread of the role, picks its CPU from the list, -1 for
+ *	  the whole list
+ * \param report what was asked for and whether it took, for the log
+ * \return 0 if everything took effect (or nothing was asked), -1 if a
+ *	   setting did not
+ */
+int thread_sched_apply(const struct thread_sched *ts, pthread_t thread,
+		       int index, char *report, size_t len);
+
+/*!
+ * Lock all current and future memory into RAM and keep the heap from
+ * handing pages back, so buffers stay resident. Call before the big
+ * buffers are allocated, they are then faulted in as they are mapped.
+ *
+ * \param report the outcome, for the log
+ * \return 0 on success, -1 if the memory could not be locked
+ */
+int thread_sched_lock_memory(char *report, size_t len);
+
+/* fault in stack_size bytes of the calling thread's stack */
+void thread_sched_prefault_stack(size_t stack_size);
+
+#endif /* __THREAD_SCHED_H */
@@ -0,0 +1,166 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ * Copyright (C) 2012 by Kyle Keen <keenerd@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* the window functions of rtl_power, shared with the rtl_tcp detector */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+
+#include "window.h"
+
+double rectangle(int i, int length)
+{
+	return 1.0;
+}
+
+double hamming(int i, int length)
+{
+	double a, b, w, N1;
+	a = 25.0/46.0;
+	b = 21.0/46.0;
+	N1 = (double)(length-1);
+	w = a - b*cos(2*i*M_PI/N1);
+	return w;
+}
+
+double blackman(int i, int length)
+{
+	double a0, a1, a2, w, N1;
+	a0 = 7938.0/18608.0;
+	a1 = 9240.0/18608.0;
+	a2 = 1430.0/18608.0;
+	N1 = (double)(length-1);
+	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1);
+	return w;
+}
+
+double blackman_harris(int i, int length)
+{
+	double a0, a1, a2, a3, w, N1;
+	a0 = 0.35875;
+	a1 = 0.48829;
+	a2 = 0.14128;
+	a3 = 0.01168;
+	N1 = (double)(length-1);
+	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1) - a3*cos(6*i*M_PI/N1);
+	return w;
+}
+
+double hann_poisson(int i, int length)
+{
+	double a, N1, w;
+	a = 2.0;
+	N1 = (double)(length-1);
+	w = 0.5 * (1 - cos(2*M_PI*i/N1)) * \
+	    pow(M_E, (-a*(double)abs((int)(N1-1-2*i)))/N1);
+	return w;
+}
+
+double youssef(int i, int length)
+/* really a blackman-harris-poisson window, but that is a mouthful */
+{
+	double a, a0, a1, a2, a3, w, N1;
+	a0 = 0.35875;
+	a1 = 0.48829;
+	a2 = 0.14128;
+	a3 = 0.01168;
+	N1 = (double)(length-1);
+	w = a0 - a1*cos(2*i*M_PI/N1) + a2*cos(4*i*M_PI/N1) - a3*cos(6*i*M_PI/N1);
+	a = 0.0025;
+	w *= pow(M_E, (-a*(double)abs((int)(N1-1-2*i)))/N1);
+	return w;
+}
+
+/* modified Bessel function of the first kind, order 0, by its series */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, q = x * x / 4;
+	int k;
+
+	for (k = 1; k < 50 && term > sum * 1e-17; k++) {
+		term *= q / ((double)k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+double kaiser(int i, int length)
+/* beta 6, sidelobes around -44 dB, between hamming and blackman */
+{
+	double beta, N1, r, w;
+	beta = 6.0;
+	N1 = (double)(length-1);
+	if (N1 <= 0) {
+		return 1.0;}
+	r = 2*i/N1 - 1;
+	w = bessel_i0(beta * sqrt(1 - r*r)) / bessel_i0(beta);
+	return w;
+}
+
+double bartlett(int i, int length)
+{
+	double N1, L, w;
+	L = (double)length;
+	N1 = L - 1;
+	w = (i - N1/2) / (L/2);
+	if (w < 0) {
+		w = -w;}
+	w = 1 - w;
+	return w;
+}
+
+static const struct {
+	const char *name;
+	window_fn_t fn;
+} windows[] = {
+	{ "rectangle", rectangle },
+	{ "hamming", hamming },
+	{ "blackman", blackman },
+	{ "blackman-harris", blackman_harris },
+	{ "hann-poisson", hann_poisson },
+	{ "youssef", youssef },
+	{ "kaiser", kaiser },
+	{ "bartlett", bartlett },
+};
+
+window_fn_t window_lookup(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+		if (!strcmp(windows[i].name, name))
+			return windows[i].fn;
+
+	return NULL;
+}
+
+const char *window_name(window_fn_t fn)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(windows) / sizeof(windows[0]); i++)
+		if (windows[i].fn == fn)
+			return windows[i].name;
+
+	return "custom";
+}
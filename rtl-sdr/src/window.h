@@ -0,0 +1,49 @@
+/*
+ * rtl-sdr, turns your Realtek RTL2832 based DVB dongle into a SDR receiver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WINDOW_H
+#define __WINDOW_H
+
+/*
+ * FFT window functions, coefficient i of a length point window. Taken out
+ * of rtl_power so the rtl_tcp detector can use the same ones.
+ */
+
+typedef double (*window_fn_t)(int i, int length);
+
+double rectangle(int i, int length);
+double hamming(int i, int length);
+double blackman(int i, int length);
+double blackman_harris(int i, int length);
+double hann_poisson(int i, int length);
+double youssef(int i, int length);
+double kaiser(int i, int length);
+double bartlett(int i, int length);
+
+/*!
+ * Find a window by its rtl_power -w name.
+ *
+ * \param name rectangle, hamming, blackman, blackman-harris, hann-poisson,
+ *	       youssef, kaiser or bartlett
+ * \return the window function, NULL for an unknown name
+ */
+window_fn_t window_lookup(const char *name);
+
+/* rtl_power -w name of a window function */
+const char *window_name(window_fn_t fn);
+
+#endif /* __WINDOW_H */